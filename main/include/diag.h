@@ -0,0 +1,47 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef DIAG_H
+#define DIAG_H
+
+/* Includes */
+/* STD APIs */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Defines */
+#define DIAG_FORMAT_VERSION 1
+#define DIAG_ENCODED_MAX 512 /* longest attribute value ATT allows */
+#define DIAG_CONN_NONE 0xFFFF /* conn field of device-wide records */
+
+/* Header flags */
+#define DIAG_F_TRUNCATED 0x01 /* records left out, the value was full */
+
+/* Public types */
+/* Record types, new ones go at the end */
+typedef enum {
+    DIAG_REC_GAP = 1,   /* gap_counters_t */
+    DIAG_REC_GATT,      /* gatt_svr_counters_t */
+    DIAG_REC_MIDI_TASK, /* midi_task_stats_t */
+    DIAG_REC_LINK,      /* per connection: rx_writes, rx_events,
+                           rx_max_per_event, rx_per_event[] of gap_link_t */
+    DIAG_REC_MERGE,     /* per connection: midi_merge_src_stats_t with the
+                           fields of thin inline */
+    DIAG_REC_HEART_RATE, /* heart_rate_tx_stats_t */
+    DIAG_REC_OUT,        /* per connection: depth_max[], dropped[],
+                            packets_sent, notify_failed of midi_out_stats_t */
+    DIAG_REC_POOL,       /* midi_pool_stats_t */
+} diag_record_t;
+
+/*
+ * Encoded counters, little endian:
+ *   u8 version, u8 flags
+ *   then records: u8 type, u16 conn handle, u8 n, n u32 counters in the
+ *   order of the fields named with the type
+ * Readers skip record types they do not know by n.
+ */
+
+/* Public function declarations */
+size_t diag_encode(uint8_t *buf, size_t cap);
+
+#endif // DIAG_H
@@ -16,8 +16,52 @@
 #define BLE_GAP_URI_PREFIX_HTTPS 0x17
 #define BLE_GAP_LE_ROLE_PERIPHERAL 0x00
 
+/* Histogram of writes per connection event, the last bucket takes the rest */
+#define GAP_LINK_RX_BUCKETS 8
+
+/* Public types */
+typedef struct {
+    uint16_t conn_handle;
+    uint8_t tx_phy; /* BLE_GAP_LE_PHY_1M or BLE_GAP_LE_PHY_2M */
+    uint8_t rx_phy;
+    uint16_t max_tx_octets; /* LL payload, 27 until extended */
+    uint16_t max_rx_octets;
+    uint16_t conn_itvl; /* 1.25 ms units */
+
+    /*
+     * Writes received, grouped into connection events by arrival time: a
+     * write more than half an interval after the first one of the current
+     * event starts the next event.
+     */
+    uint32_t rx_writes;
+    uint32_t rx_events;
+    uint16_t rx_max_per_event;
+    uint32_t rx_per_event[GAP_LINK_RX_BUCKETS]; /* events by writes - 1 */
+    int64_t rx_event_us;                        /* current event start */
+    uint16_t rx_in_event;                       /* writes in current event */
+} gap_link_t;
+
+typedef struct {
+    uint32_t connects;
+    uint32_t connect_failures;
+    uint32_t disconnects;
+    uint32_t conn_updates; /* connection parameter updates */
+    uint32_t subscribes;
+    uint32_t notify_tx_errors; /* notifications or indications that failed */
+    uint32_t mtu_updates;
+} gap_counters_t;
+
 /* Public function declarations */
-void adv_init(void);
+int adv_init(const struct ble_hs_adv_fields *adv_fields,
+             const struct ble_hs_adv_fields *rsp_fields, ble_gap_event_fn *cb,
+             void *cb_arg);
+int adv_start(void);
+int adv_start_fast(void);
+void bond_init(void);
+int gap_link_get(uint16_t conn_handle, gap_link_t *link);
+int gap_link_handles(uint16_t *handles, int max);
+void gap_link_rx(uint16_t conn_handle);
+void gap_get_counters(gap_counters_t *counters);
 int gap_init(void);
 
 #endif // GAP_SVC_H
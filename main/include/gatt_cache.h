@@ -0,0 +1,29 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef GATT_CACHE_H
+#define GATT_CACHE_H
+
+/* Includes */
+/* STD APIs */
+#include <stdint.h>
+
+/* NimBLE GATT APIs */
+#include "host/ble_gatt.h"
+
+/* Defines */
+#define GATT_CACHE_HASH_SIZE 16
+
+/*
+ * Generic Attribute service with Service Changed, Client Supported Features
+ * and Database Hash. Centrals that find the hash unchanged since their last
+ * connection reuse their cached handles instead of rediscovering services.
+ * Robust caching is not offered.
+ */
+
+/* Public function declarations */
+int gatt_cache_init(void);
+void gatt_cache_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg);
+void gatt_cache_start(void);
+
+#endif // GATT_CACHE_H
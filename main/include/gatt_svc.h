@@ -9,15 +9,34 @@
 /* Includes */
 /* NimBLE GATT APIs */
 #include "host/ble_gatt.h"
-#include "services/gatt/ble_svc_gatt.h"
 
 /* NimBLE GAP APIs */
 #include "host/ble_gap.h"
 
+/* Public types */
+typedef struct {
+    uint32_t sent;      /* notifications and indications handed to NimBLE */
+    uint32_t coalesced; /* values replaced by a newer one before sending */
+    uint32_t failed;    /* sends refused or indications not confirmed */
+} heart_rate_tx_stats_t;
+
+typedef struct {
+    uint32_t hr_reads;   /* heart rate characteristic reads */
+    uint32_t led_writes; /* LED characteristic writes */
+    uint32_t led_frames; /* LED frame characteristic writes applied */
+    uint32_t led_pixels; /* pixels set by those frames */
+    uint32_t led_stream_frames; /* streamed frames shown */
+    uint32_t subscribes; /* subscription changes, disconnects included */
+    uint32_t bad_access; /* accesses rejected as unexpected */
+} gatt_svr_counters_t;
+
 /* Public function declarations */
 void send_heart_rate_indication(void);
+void get_heart_rate_tx_stats(heart_rate_tx_stats_t *stats);
+void gatt_svr_get_counters(gatt_svr_counters_t *counters);
 void gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg);
 void gatt_svr_subscribe_cb(struct ble_gap_event *event);
+void gatt_svr_notify_tx_cb(struct ble_gap_event *event);
 int gatt_svc_init(void);
 
 #endif // GATT_SVR_H
@@ -7,14 +7,31 @@
 #define HEART_RATE_H
 
 /* Includes */
-/* ESP APIs */
-#include "esp_random.h"
+/* STD APIs */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /* Defines */
 #define HEART_RATE_TASK_PERIOD (1000 / portTICK_PERIOD_MS)
 
+/* Heart Rate Measurement flags */
+#define HEART_RATE_FLAG_VALUE_U16 0x01
+#define HEART_RATE_FLAG_RR_PRESENT 0x10
+
+/* RR intervals per measurement, small enough to fit the default ATT MTU */
+#define HEART_RATE_RR_MAX 8
+#define HEART_RATE_MEAS_MAX (3 + 2 * HEART_RATE_RR_MAX)
+
+/* RR intervals kept for subscribers that were not sent the latest values */
+#define HEART_RATE_RR_LOG 32
+
 /* Public function declarations */
+void heart_rate_init(void);
+void heart_rate_push_samples(const int32_t *samples, size_t count);
 uint8_t get_heart_rate(void);
 void update_heart_rate(void);
+uint32_t heart_rate_rr_end(void);
+uint16_t heart_rate_read_measurement(uint8_t *buf, uint32_t *rr_next);
 
 #endif // HEART_RATE_H
@@ -15,10 +15,18 @@
 /* Defines */
 #define BLINK_GPIO CONFIG_BLINK_GPIO
 
+#ifdef CONFIG_BLINK_LED_STRIP
+#define LED_PIXELS CONFIG_BLINK_LED_STRIP_PIXELS
+#else
+#define LED_PIXELS 1
+#endif
+
 /* Public function declarations */
 uint8_t get_led_state(void);
 void led_on(void);
 void led_off(void);
+int led_frame_write(const uint8_t *buf, size_t len);
+int led_stream_write(const uint8_t *buf, size_t len);
 void led_init(void);
 
 #endif // LED_H
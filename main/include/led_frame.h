@@ -0,0 +1,46 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef LED_FRAME_H
+#define LED_FRAME_H
+
+/* Includes */
+/* STD APIs */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Defines */
+#define LED_FRAME_PALETTE_SIZE 16
+
+/*
+ * A frame is one ATT write holding any number of packed operations, applied
+ * in order, little endian:
+ *   PALETTE  u8 index, u8 r, u8 g, u8 b
+ *   RANGE    u16 first, u8 n, n x (u8 r, u8 g, u8 b)
+ *   FILL     u16 first, u16 n, u8 r, u8 g, u8 b
+ *   INDEXED  u16 first, u16 n, (n + 1) / 2 bytes of 4-bit palette indices,
+ *            low nibble first
+ * Palette entries set by a frame stay for later frames.
+ */
+#define LED_FRAME_OP_PALETTE 0x01
+#define LED_FRAME_OP_RANGE 0x02
+#define LED_FRAME_OP_FILL 0x03
+#define LED_FRAME_OP_INDEXED 0x04
+
+/* Public types */
+typedef void led_frame_set_fn(uint16_t index, uint8_t r, uint8_t g, uint8_t b,
+                              void *arg);
+
+typedef struct {
+    uint16_t num_pixels;
+    uint8_t palette[LED_FRAME_PALETTE_SIZE][3];
+    led_frame_set_fn *set;
+    void *arg;
+} led_frame_t;
+
+/* Public function declarations */
+void led_frame_init(led_frame_t *frame, uint16_t num_pixels,
+                    led_frame_set_fn *set, void *arg);
+int led_frame_apply(led_frame_t *frame, const uint8_t *buf, size_t len);
+
+#endif // LED_FRAME_H
@@ -0,0 +1,53 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef LED_STREAM_H
+#define LED_STREAM_H
+
+/* Includes */
+#include "led_frame.h"
+#include <stdbool.h>
+
+/* Defines */
+/*
+ * Streamed animation frames, split into packets of one write each:
+ *   u8 flags, u8 frame number, u16 first pixel (little endian), tokens
+ * A token is a byte c followed by pixels, 3 bytes each:
+ *   c < 0x80   c + 1 literal pixels follow
+ *   c >= 0x80  (c & 0x7F) + 1 copies of the one pixel that follows
+ * Keyframe pixels are colors. Delta pixels are XORed into the previous
+ * frame, so a run of zeros leaves pixels unchanged. A frame's packets
+ * cover consecutive pixels from 0 and the last one, flagged END, completes
+ * the strip; only then is the frame shown. Delta frames number on from the
+ * frame shown before; after a lost or malformed packet deltas are rejected
+ * until the next keyframe.
+ */
+#define LED_STREAM_KEY 0x01
+#define LED_STREAM_END 0x80
+#define LED_STREAM_HDR_LEN 4
+
+/* Public types */
+typedef struct {
+    uint16_t num_pixels;
+    uint8_t (*pixels)[3]; /* last frame shown, and the next being decoded */
+    led_frame_set_fn *set;
+    void *arg;
+
+    uint16_t pos;  /* pixels decoded of the frame in progress */
+    uint8_t frame; /* number of the frame in progress or last shown */
+    bool key;
+    bool in_frame;
+    bool synced; /* pixels hold the frame shown, deltas may follow */
+    uint16_t dirty_lo;
+    uint16_t dirty_hi;
+
+    uint32_t frames;   /* frames shown */
+    uint32_t rejected; /* packets rejected */
+} led_stream_t;
+
+/* Public function declarations */
+void led_stream_init(led_stream_t *stream, uint8_t (*pixels)[3],
+                     uint16_t num_pixels, led_frame_set_fn *set, void *arg);
+int led_stream_input(led_stream_t *stream, const uint8_t *buf, size_t len);
+
+#endif // LED_STREAM_H
@@ -0,0 +1,56 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef LF_QUEUE_H
+#define LF_QUEUE_H
+
+/* Includes */
+/* STD APIs */
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* FreeRTOS APIs */
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+/* Defines */
+/* Producer and consumer indices live on separate cache lines */
+#define LF_CACHE_LINE 32
+#define LF_ALIGNED __attribute__((aligned(LF_CACHE_LINE)))
+
+/* Public types */
+/*
+ * Lets the consumer sleep on its task notification while a queue is empty.
+ * Producers only notify when the consumer has announced that it sleeps, so
+ * a busy consumer costs them a single load per push.
+ */
+typedef struct {
+    _Atomic bool sleeping;
+    TaskHandle_t task;
+} lf_waiter_t;
+
+/*
+ * Wait-free single-producer single-consumer ring of pointers. Each side
+ * keeps a private copy of the other side's index and only reloads it when
+ * the ring looks full or empty.
+ */
+typedef struct {
+    LF_ALIGNED _Atomic uint32_t head; /* written by the producer */
+    uint32_t tail_cache;
+    LF_ALIGNED _Atomic uint32_t tail; /* written by the consumer */
+    uint32_t head_cache;
+    LF_ALIGNED uint32_t mask;
+    void **slots;
+    lf_waiter_t waiter;
+} lf_spsc_t;
+
+/* Public function declarations */
+/* len is the number of slots and must be a power of two */
+void lf_spsc_init(lf_spsc_t *q, void **slots, uint32_t len);
+bool lf_spsc_push(lf_spsc_t *q, void *item);
+void *lf_spsc_pop(lf_spsc_t *q);
+void *lf_spsc_pop_wait(lf_spsc_t *q, TickType_t timeout);
+uint32_t lf_spsc_depth(lf_spsc_t *q);
+
+#endif // LF_QUEUE_H
@@ -0,0 +1,45 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef LOG_POLICY_H
+#define LOG_POLICY_H
+
+/*
+ * Compile-time log levels per module, set under "Logging" in menuconfig.
+ *
+ *   E, W  faults, always built in
+ *   I     state changes: connections, bonds, advertising
+ *   D, V  per-event and per-access detail, built out unless the module
+ *         level is raised to debug
+ *
+ * Hot paths count events with counters instead of logging them. A source
+ * file picks its module before anything includes esp_log.h:
+ *
+ *   #define LOG_POLICY_MODULE GAP
+ *   #include "log_policy.h"
+ */
+
+/* Includes */
+#include "sdkconfig.h"
+#include <stdatomic.h>
+
+/* Defines */
+#define LOG_POLICY_LEVEL_GAP CONFIG_BLE_LOG_LEVEL_GAP
+#define LOG_POLICY_LEVEL_GATT CONFIG_BLE_LOG_LEVEL_GATT
+#define LOG_POLICY_LEVEL_MIDI CONFIG_BLE_LOG_LEVEL_MIDI
+
+#define LOG_POLICY_CAT(m) LOG_POLICY_LEVEL_##m
+#define LOG_POLICY_LEVEL(m) LOG_POLICY_CAT(m)
+
+#ifdef LOG_POLICY_MODULE
+#ifdef LOG_LOCAL_LEVEL
+#error "log_policy.h must be included before esp_log.h"
+#endif
+#define LOG_LOCAL_LEVEL LOG_POLICY_LEVEL(LOG_POLICY_MODULE)
+#endif
+
+/* Bump a diagnostics counter from any task */
+#define LOG_POLICY_COUNT(counter)                                              \
+    atomic_fetch_add_explicit(&(counter), 1, memory_order_relaxed)
+
+#endif // LOG_POLICY_H
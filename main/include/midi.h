@@ -0,0 +1,97 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef MIDI_H
+#define MIDI_H
+
+/* Includes */
+/* STD APIs */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Defines */
+/* Status bytes */
+#define MIDI_NOTE_OFF 0x80
+#define MIDI_NOTE_ON 0x90
+#define MIDI_POLY_PRESSURE 0xA0
+#define MIDI_CONTROL_CHANGE 0xB0
+#define MIDI_PROGRAM_CHANGE 0xC0
+#define MIDI_CHANNEL_PRESSURE 0xD0
+#define MIDI_PITCH_BEND 0xE0
+#define MIDI_SYSEX_START 0xF0
+#define MIDI_SYSEX_END 0xF7
+#define MIDI_TIMING_CLOCK 0xF8
+#define MIDI_SYSTEM_RESET 0xFF
+
+#define MIDI_STATUS_TYPE(s) ((s) & 0xF0)
+#define MIDI_STATUS_CHANNEL(s) ((s) & 0x0F)
+#define MIDI_IS_CHANNEL_MSG(s) ((s) >= 0x80 && (s) < 0xF0)
+#define MIDI_IS_REALTIME(s) ((s) >= 0xF8)
+
+/* BLE-MIDI timestamps are 13-bit millisecond counters */
+#define MIDI_BLE_TS_MASK 0x1FFF
+
+/* SysEx chunk flags passed to midi_sysex_cb_t */
+#define MIDI_SYSEX_F_START 0x01
+#define MIDI_SYSEX_F_END 0x02
+#define MIDI_SYSEX_F_ABORT 0x04
+
+/* Decoder return codes */
+#define MIDI_ERR_HEADER 1
+#define MIDI_ERR_TRUNCATED 2
+#define MIDI_ERR_UNEXPECTED_DATA 3
+
+/* Public types */
+/* A complete non-SysEx MIDI message */
+typedef struct {
+    uint8_t data[3];    /* status byte followed by up to two data bytes */
+    uint8_t len;        /* number of valid bytes in data, 1..3 */
+    uint16_t timestamp; /* 13-bit BLE-MIDI timestamp */
+} midi_event_t;
+
+typedef void (*midi_event_cb_t)(const midi_event_t *ev, void *arg);
+
+/*
+ * SysEx payloads are delivered in chunks as they arrive. The first chunk
+ * starts with 0xF0 and carries MIDI_SYSEX_F_START, the last one ends with
+ * 0xF7 and carries MIDI_SYSEX_F_END. A SysEx cut short by a new status byte
+ * is reported with an empty MIDI_SYSEX_F_ABORT chunk.
+ */
+typedef void (*midi_sysex_cb_t)(const uint8_t *data, size_t len, uint8_t flags,
+                                void *arg);
+
+/* Per-source BLE-MIDI decoder state */
+typedef struct {
+    uint8_t running_status;
+    bool in_sysex;
+} midi_parser_t;
+
+/* Outbound BLE-MIDI packet under construction */
+typedef struct {
+    uint8_t *buf;
+    uint16_t cap;
+    uint16_t len;
+    uint8_t ts_low;
+    uint8_t running_status;
+    bool in_sysex;
+} midi_packet_t;
+
+/* Public function declarations */
+uint8_t midi_msg_len(uint8_t status);
+uint32_t midi_now_ms(void);
+uint16_t midi_ble_now(void);
+
+void midi_parser_reset(midi_parser_t *parser);
+int midi_ble_decode(midi_parser_t *parser, const uint8_t *buf, size_t len,
+                    midi_event_cb_t event_cb, midi_sysex_cb_t sysex_cb,
+                    void *arg);
+
+void midi_packet_init(midi_packet_t *pkt, uint8_t *buf, uint16_t cap,
+                      uint16_t timestamp);
+bool midi_packet_empty(const midi_packet_t *pkt);
+bool midi_packet_append(midi_packet_t *pkt, const midi_event_t *ev);
+size_t midi_packet_append_sysex(midi_packet_t *pkt, const uint8_t *data,
+                                size_t len);
+
+#endif // MIDI_H
@@ -0,0 +1,57 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef MIDI_CURVE_H
+#define MIDI_CURVE_H
+
+/* Includes */
+#include "midi.h"
+
+/* Defines */
+#define MIDI_CURVE_MAX_POINTS 8
+
+/*
+ * Curve SysEx, using the non-commercial manufacturer ID:
+ *   F0 7D 01 01 <ch> <target> <type> <amount> [<x> <y>]... F7  set a curve
+ *   F0 7D 01 02 F7                                            reset all
+ * ch 0x7F addresses every channel, breakpoints are only used by
+ * MIDI_CURVE_BREAKPOINTS.
+ */
+#define MIDI_CURVE_SYSEX_ID 0x7D
+#define MIDI_CURVE_SYSEX_DEVICE 0x01
+#define MIDI_CURVE_SYSEX_SET 0x01
+#define MIDI_CURVE_SYSEX_RESET 0x02
+#define MIDI_CURVE_ALL_CHANNELS 0x7F
+
+/* Public types */
+typedef enum {
+    MIDI_CURVE_VELOCITY,
+    MIDI_CURVE_CC,
+    MIDI_CURVE_TARGETS,
+} midi_curve_target_t;
+
+typedef enum {
+    MIDI_CURVE_LINEAR,
+    MIDI_CURVE_EXP,
+    MIDI_CURVE_LOG,
+    MIDI_CURVE_S,
+    MIDI_CURVE_BREAKPOINTS,
+    MIDI_CURVE_TYPES,
+} midi_curve_type_t;
+
+/* Curve description as stored in NVS, turned into a 128-entry table */
+typedef struct {
+    uint8_t type;   /* midi_curve_type_t */
+    uint8_t amount; /* steepness of the exp, log and S curves, 0-127 */
+    uint8_t num_points;
+    uint8_t points[MIDI_CURVE_MAX_POINTS][2]; /* (x, y), ascending x */
+} midi_curve_spec_t;
+
+/* Public function declarations */
+void midi_curve_init(void);
+void midi_curve_apply(midi_event_t *ev);
+int midi_curve_set(uint8_t ch, midi_curve_target_t target,
+                   const midi_curve_spec_t *spec);
+bool midi_curve_handle_sysex(const uint8_t *data, size_t len);
+
+#endif // MIDI_CURVE_H
@@ -0,0 +1,40 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef MIDI_MERGE_H
+#define MIDI_MERGE_H
+
+/* Includes */
+#include "midi.h"
+#include "midi_out.h"
+#include "midi_thin.h"
+
+/* Defines */
+#define MIDI_MERGE_NO_SLOT (-1)
+
+/* Public types */
+typedef struct {
+    uint32_t events_in;
+    uint32_t sysex_in;
+    uint32_t sysex_dropped;
+    uint32_t decode_errors;
+    uint32_t notes_released; /* note offs sent for it on disconnect */
+    midi_thin_stats_t thin;
+} midi_merge_src_stats_t;
+
+/* Sees every complete SysEx first, returns true to keep it from the peers */
+typedef bool (*midi_merge_sysex_cb_t)(const uint8_t *data, size_t len,
+                                      void *arg);
+
+/* Public function declarations */
+void midi_merge_init(uint16_t chr_val_handle, midi_event_cb_t local_cb,
+                     midi_merge_sysex_cb_t sysex_cb, void *arg);
+int midi_merge_connect(uint16_t conn_handle);
+void midi_merge_disconnect(uint16_t conn_handle);
+void midi_merge_subscribe(uint16_t conn_handle, bool enabled);
+int midi_merge_slot(uint16_t conn_handle);
+int midi_merge_input(uint16_t conn_handle, const uint8_t *buf, size_t len);
+int32_t midi_merge_poll(void);
+void midi_merge_get_stats(uint8_t slot, midi_merge_src_stats_t *stats);
+
+#endif // MIDI_MERGE_H
@@ -0,0 +1,53 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef MIDI_OUT_H
+#define MIDI_OUT_H
+
+/* Includes */
+#include "midi.h"
+#include "sdkconfig.h"
+
+/* Defines */
+#define MIDI_MAX_PEERS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+/* Delay before output refused by the stack, usually for want of mbufs, is
+ * tried again */
+#define MIDI_OUT_RETRY_MS 5
+
+/* Public types */
+/*
+ * Outbound lanes in the order they get packet space. Note on and off go
+ * ahead of the other channel voice and system common messages, so a
+ * controller flood on one channel never holds up the notes of another.
+ * A note still waits for the messages of its own channel queued before
+ * it, so it never overtakes a sustain pedal or program change; those
+ * keep their order among themselves. System realtime may jump ahead of
+ * everything.
+ */
+typedef enum {
+    MIDI_OUT_LANE_REALTIME,
+    MIDI_OUT_LANE_NOTE,
+    MIDI_OUT_LANE_CONTROL,
+    MIDI_OUT_LANE_SYSEX,
+    MIDI_OUT_LANES,
+} midi_out_lane_t;
+
+typedef struct {
+    uint32_t depth[MIDI_OUT_LANES];     /* messages currently queued */
+    uint32_t depth_max[MIDI_OUT_LANES]; /* high-water mark since open */
+    uint32_t dropped[MIDI_OUT_LANES];   /* messages refused, lane full */
+    uint32_t packets_sent;
+    uint32_t notify_failed;
+} midi_out_stats_t;
+
+/* Public function declarations */
+void midi_out_init(uint16_t chr_val_handle);
+void midi_out_open(uint8_t slot, uint16_t conn_handle);
+void midi_out_close(uint8_t slot);
+bool midi_out_is_open(uint8_t slot);
+bool midi_out_push(uint8_t slot, const midi_event_t *ev);
+bool midi_out_push_sysex(uint8_t slot, const uint8_t *data, uint16_t len);
+bool midi_out_flush(void);
+void midi_out_get_stats(uint8_t slot, midi_out_stats_t *stats);
+
+#endif // MIDI_OUT_H
@@ -0,0 +1,41 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef MIDI_POOL_H
+#define MIDI_POOL_H
+
+/* Includes */
+/* STD APIs */
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+/* Defines */
+/* Room for one write of a full ATT MTU and the header it travels with,
+ * rounded to keep every block word aligned */
+#define MIDI_POOL_BLOCK_SIZE ((CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU + 16 + 3) & ~3)
+
+/* Public types */
+typedef struct {
+    uint16_t size;         /* blocks in the pool */
+    uint16_t in_use;       /* blocks currently allocated */
+    uint16_t high_water;   /* most blocks allocated at once since boot */
+    uint32_t alloc_failed; /* allocations refused because the pool was empty */
+} midi_pool_stats_t;
+
+/*
+ * Fixed-block pool for MIDI data handed between tasks, sized by
+ * CONFIG_MIDI_POOL_SIZE. Each core keeps a small cache of free blocks in
+ * front of a lock-free shared free list, so allocation never takes a lock
+ * or touches the heap and is safe from tasks and ISRs alike. A block may
+ * be freed on another core than the one that allocated it.
+ */
+
+/* Public function declarations */
+void midi_pool_init(void);
+void *midi_pool_alloc(void);
+void midi_pool_free(void *block);
+uint16_t midi_pool_available(void);
+void midi_pool_get_stats(midi_pool_stats_t *stats);
+
+#endif // MIDI_POOL_H
@@ -0,0 +1,44 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef MIDI_ROUTE_H
+#define MIDI_ROUTE_H
+
+/* Includes */
+#include "midi.h"
+
+/* Defines */
+/* Message type bits of midi_route_config_t.type_mask */
+#define MIDI_ROUTE_NOTE (1u << 0)
+#define MIDI_ROUTE_POLY_PRESSURE (1u << 1)
+#define MIDI_ROUTE_CONTROL_CHANGE (1u << 2)
+#define MIDI_ROUTE_PROGRAM_CHANGE (1u << 3)
+#define MIDI_ROUTE_CHANNEL_PRESSURE (1u << 4)
+#define MIDI_ROUTE_PITCH_BEND (1u << 5)
+#define MIDI_ROUTE_SYSTEM_COMMON (1u << 6)
+#define MIDI_ROUTE_REALTIME (1u << 7)
+#define MIDI_ROUTE_SYSEX (1u << 8)
+#define MIDI_ROUTE_ALL 0x01FF
+
+#define MIDI_ROUTE_CHANNEL_DROP 0xFF
+#define MIDI_ROUTE_VELOCITY_UNITY 64
+#define MIDI_ROUTE_CONFIG_VERSION 1
+
+/* Public types */
+/* Routing configuration as stored in NVS */
+typedef struct {
+    uint8_t version;
+    uint8_t velocity_gain;  /* note-on velocity * gain / 64 */
+    int8_t velocity_offset; /* added after the gain, result kept in 1..127 */
+    uint8_t reserved;
+    uint16_t type_mask;     /* MIDI_ROUTE_* bits of messages to pass */
+    uint8_t channel_map[16]; /* output channel, or MIDI_ROUTE_CHANNEL_DROP */
+    int8_t transpose[16];    /* semitones, per input channel */
+} midi_route_config_t;
+
+/* Public function declarations */
+void midi_route_init(void);
+bool midi_route_apply(midi_event_t *ev);
+bool midi_route_pass_sysex(void);
+
+#endif // MIDI_ROUTE_H
@@ -0,0 +1,49 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef MIDI_STATE_H
+#define MIDI_STATE_H
+
+/* Includes */
+#include "midi.h"
+
+/* Defines */
+#define MIDI_CHANNELS 16
+#define MIDI_STATE_PITCH_BEND_CENTER 0x2000
+/* Velocity used when replaying held notes, the bitset does not keep it */
+#define MIDI_STATE_SNAPSHOT_VELOCITY 64
+
+/* Public types */
+/*
+ * Channel state tracked from the decoded event stream. Bitsets come first
+ * so that the snapshot walk and the note path touch as few cache lines as
+ * possible.
+ */
+typedef struct {
+    uint32_t notes[MIDI_CHANNELS][4];  /* held notes, one bit per key */
+    uint32_t cc_set[MIDI_CHANNELS][4]; /* controllers seen since reset */
+    uint16_t active;                   /* channels with any state */
+    uint16_t program_set;
+    uint16_t bend_set;
+    uint16_t nrpn_last; /* channels whose last parameter select was NRPN */
+    uint8_t program[MIDI_CHANNELS];
+    uint16_t pitch_bend[MIDI_CHANNELS];
+    uint8_t cc[MIDI_CHANNELS][128];
+} midi_state_t;
+
+/* Resumable position of a snapshot walk */
+typedef struct {
+    uint8_t channel;
+    uint8_t phase;
+    uint8_t index;
+} midi_state_cursor_t;
+
+/* Public function declarations */
+void midi_state_reset(midi_state_t *state);
+void midi_state_apply(midi_state_t *state, const midi_event_t *ev);
+void midi_state_cursor_init(midi_state_cursor_t *cursor);
+uint16_t midi_state_snapshot(const midi_state_t *state,
+                             midi_state_cursor_t *cursor, uint8_t *buf,
+                             uint16_t cap, uint16_t timestamp);
+
+#endif // MIDI_STATE_H
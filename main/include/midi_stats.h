@@ -0,0 +1,56 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef MIDI_STATS_H
+#define MIDI_STATS_H
+
+/* Includes */
+#include "midi.h"
+#include "sdkconfig.h"
+
+/* Defines */
+/* Bucket i counts samples of [2^(i+SHIFT), 2^(i+SHIFT+1)) CPU cycles, the
+ * first one also all shorter samples and the last one all longer ones. At
+ * 240 MHz that spans 2 us to 17 ms. */
+#define MIDI_STATS_BUCKETS 15
+#define MIDI_STATS_BUCKET_SHIFT 8
+#define MIDI_STATS_FORMAT_VERSION 2
+/* Worst case, every varint at its longest; must fit one attribute value */
+#define MIDI_STATS_ENCODED_MAX                                                 \
+    (6 + MIDI_STATS_STAGES * (5 + 5 + 10 + 2 + MIDI_STATS_BUCKETS * 5))
+
+/* Write this to the stats characteristic to clear all histograms */
+#define MIDI_STATS_CMD_RESET 0x01
+
+/* Public types */
+typedef enum {
+    MIDI_STATS_HANDOFF, /* GATT write arrival until the MIDI task picks it up */
+    MIDI_STATS_DECODE,  /* decoding a packet, including the stages below */
+    MIDI_STATS_ROUTE,   /* routing, curves and fan-out of one message */
+    MIDI_STATS_OUTPUT,  /* thinning release and notifications */
+    MIDI_STATS_TOTAL,   /* GATT write arrival until its output was sent */
+    MIDI_STATS_STAGES,
+} midi_stats_stage_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max;
+    uint64_t total;
+    uint32_t buckets[MIDI_STATS_BUCKETS];
+} midi_stats_hist_t;
+
+/*
+ * Encoded stats, little endian, varint is unsigned LEB128:
+ *   u8 version, u8 stages, u8 buckets, u8 bucket shift, u16 CPU MHz
+ *   then per stage:
+ *     varint count, varint max, varint total (all in CPU cycles)
+ *     u8 first non-empty bucket, u8 n, n varint bucket counts
+ */
+
+/* Public function declarations */
+void midi_stats_record(midi_stats_stage_t stage, uint32_t cycles);
+void midi_stats_reset(void);
+void midi_stats_get(midi_stats_stage_t stage, midi_stats_hist_t *hist);
+size_t midi_stats_encode(uint8_t *buf, size_t cap);
+
+#endif // MIDI_STATS_H
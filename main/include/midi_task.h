@@ -0,0 +1,33 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef MIDI_TASK_H
+#define MIDI_TASK_H
+
+/* Includes */
+#include "midi.h"
+#include "midi_merge.h"
+#include "sdkconfig.h"
+
+/* Public types */
+typedef struct {
+    uint32_t rx_dropped; /* writes refused because the queue was full */
+    uint32_t malformed;  /* writes that were not valid BLE-MIDI packets */
+} midi_task_stats_t;
+
+struct os_mbuf;
+
+/* Called in the MIDI task when a central newly subscribes to notifications */
+typedef void (*midi_task_subscribe_cb_t)(uint16_t conn_handle, void *arg);
+
+/* Public function declarations */
+void midi_task_init(midi_event_cb_t local_cb, midi_merge_sysex_cb_t sysex_cb,
+                    midi_task_subscribe_cb_t subscribe_cb, void *arg);
+void midi_task_start(uint16_t chr_val_handle);
+int midi_task_input(uint16_t conn_handle, const struct os_mbuf *om);
+void midi_task_connect(uint16_t conn_handle);
+void midi_task_disconnect(uint16_t conn_handle);
+void midi_task_subscribe(uint16_t conn_handle, bool enabled);
+void midi_task_get_stats(midi_task_stats_t *stats);
+
+#endif // MIDI_TASK_H
@@ -0,0 +1,52 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef MIDI_THIN_H
+#define MIDI_THIN_H
+
+/* Includes */
+#include "midi.h"
+#include "sdkconfig.h"
+
+/* Public types */
+typedef struct {
+    midi_event_t ev; /* latest value held back for this controller */
+    uint32_t emitted_at;
+    bool used;
+    bool pending;
+} midi_thin_slot_t;
+
+typedef struct {
+    uint32_t passed;    /* messages forwarded */
+    uint32_t coalesced; /* values superseded within the window */
+    uint32_t dropped;   /* repeats of the value already sent */
+} midi_thin_stats_t;
+
+/*
+ * Thinning stage for continuous controllers. The first change of a
+ * controller goes out immediately, further changes within the window only
+ * keep the latest value, which is sent when the window closes. Any other
+ * message first releases the held values, so controllers never move across
+ * a note.
+ */
+typedef struct {
+    uint16_t window_ms;
+    bool drop_repeats;
+    midi_event_cb_t emit;
+    void *arg;
+    midi_thin_stats_t stats;
+    midi_thin_slot_t slots[CONFIG_MIDI_THIN_SLOTS];
+    uint16_t last_bend[16];   /* 0xFFFF while unknown */
+    uint8_t last_pressure[16];/* 0xFF while unknown */
+    uint8_t last_cc[16][128]; /* 0xFF while unknown */
+} midi_thin_t;
+
+/* Public function declarations */
+void midi_thin_init(midi_thin_t *thin, uint16_t window_ms, bool drop_repeats,
+                    midi_event_cb_t emit, void *arg);
+void midi_thin_input(midi_thin_t *thin, const midi_event_t *ev,
+                     uint32_t now_ms);
+int32_t midi_thin_poll(midi_thin_t *thin, uint32_t now_ms);
+void midi_thin_flush(midi_thin_t *thin, uint32_t now_ms);
+
+#endif // MIDI_THIN_H
@@ -0,0 +1,60 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef PPG_H
+#define PPG_H
+
+/* Includes */
+/* STD APIs */
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Defines */
+#define PPG_RR_AVERAGE 8 /* RR intervals averaged into the BPM */
+#define PPG_RR_QUEUE 16  /* RR intervals kept until they are read */
+
+/* Public types */
+/*
+ * Streaming heart rate from raw optical (PPG) samples, all integer and
+ * without allocation:
+ *   band-pass 0.5-4 Hz -> peak detection -> RR intervals -> averaged BPM
+ * One task feeds samples, another may read the BPM and pop RR intervals.
+ */
+typedef struct {
+    /* Band-pass biquad, Q30 coefficients, direct form I */
+    int32_t b0, a1, a2;
+    int32_t x1, x2, y1, y2;
+
+    /* Peak detection */
+    uint32_t sample_rate;
+    uint32_t n;          /* samples seen */
+    uint32_t refractory; /* samples after a beat in which no beat is taken */
+    int32_t prev;
+    bool rising;
+    int32_t trough;   /* filtered value at the last local minimum */
+    int32_t envelope; /* decaying peak-to-trough amplitude */
+    uint32_t last_beat;
+    bool have_beat;
+    uint8_t rejected; /* consecutive implausible intervals */
+
+    /* RR intervals in ms, averaged and queued */
+    uint16_t rr[PPG_RR_AVERAGE];
+    uint8_t rr_count;
+    uint8_t rr_pos;
+    uint32_t rr_sum;
+    uint16_t rr_queue[PPG_RR_QUEUE];
+    _Atomic uint8_t rr_head;
+    _Atomic uint8_t rr_tail;
+
+    _Atomic uint16_t bpm;
+} ppg_t;
+
+/* Public function declarations */
+void ppg_init(ppg_t *ppg, uint32_t sample_rate);
+void ppg_process(ppg_t *ppg, const int32_t *samples, size_t count);
+uint16_t ppg_bpm(const ppg_t *ppg);
+bool ppg_pop_rr(ppg_t *ppg, uint16_t *rr_ms);
+
+#endif // PPG_H
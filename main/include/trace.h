@@ -0,0 +1,60 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Includes */
+/* STD APIs */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+/* Defines */
+#define TRACE_RECORD_SIZE 12
+
+/* Commands written to the trace characteristic */
+#define TRACE_CMD_DUMP 0x01   /* stop recording and rewind the dump cursor */
+#define TRACE_CMD_RESUME 0x02 /* clear the buffer and record again */
+
+/* Public types */
+/*
+ * Traced spans and instants. tools/trace_to_chrome.py keeps a copy of
+ * these names, new ids go at the end.
+ */
+typedef enum {
+    TRACE_GAP_EVENT,       /* arg: GAP event type */
+    TRACE_GATT_MIDI_WRITE, /* arg: write length */
+    TRACE_GATT_PROBE,      /* arg: write length */
+    TRACE_MIDI_DECODE,     /* arg: packet length */
+    TRACE_MIDI_OUTPUT,
+    TRACE_MIDI_RX_DROPPED, /* instant, arg: connection handle */
+    TRACE_LED_REFRESH,
+    TRACE_IDS,
+} trace_id_t;
+
+/*
+ * Records are 12 bytes, little endian:
+ *   u32 start (us), u32 duration (us, 0 for instants), u8 id, u8 core,
+ *   u16 arg
+ */
+
+/* Public function declarations */
+#if CONFIG_TRACE_ENTRIES > 0
+uint32_t trace_begin(void);
+void trace_end(trace_id_t id, uint32_t start, uint16_t arg);
+void trace_instant(trace_id_t id, uint16_t arg);
+void trace_command(uint8_t cmd);
+size_t trace_read(uint8_t *buf, size_t cap);
+#else
+/* Tracing compiled out */
+static inline uint32_t trace_begin(void) { return 0; }
+static inline void trace_end(trace_id_t id, uint32_t start, uint16_t arg) {}
+static inline void trace_instant(trace_id_t id, uint16_t arg) {}
+static inline void trace_command(uint8_t cmd) {}
+static inline size_t trace_read(uint8_t *buf, size_t cap) { return 0; }
+#endif
+
+#endif // TRACE_H
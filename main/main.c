@@ -1,14 +1,42 @@
+#define LOG_POLICY_MODULE MIDI
+#include "log_policy.h"
+
 #include "esp_log.h"
 #include "nvs_flash.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "host/ble_hs.h"
 #include "host/ble_uuid.h"
 #include "services/gap/ble_svc_gap.h"
 #include "nimble/nimble_port.h"
 #include "nimble/nimble_port_freertos.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "gap.h"
+#include "gatt_cache.h"
+#include "gatt_svc.h"
+#include "diag.h"
+#include "heart_rate.h"
+#include "led.h"
+#include "midi.h"
+#include "midi_curve.h"
+#include "midi_merge.h"
+#include "midi_pool.h"
+#include "midi_route.h"
+#include "midi_state.h"
+#include "midi_stats.h"
+#include "midi_task.h"
+#include "trace.h"
 
 #define DEVICE_NAME "ESP32 MIDI"
 #define TAG "BLE_MIDI"
 
+// A long read left unfinished this long no longer holds its snapshot
+#define DIAG_SNAPSHOT_MS 1000
+
+#define HEART_RATE_TASK_STACK 3072
+#define HEART_RATE_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+
 // Define MIDI service and characteristic UUIDs
 static const ble_uuid128_t midi_service_uuid = BLE_UUID128_INIT(
     0x00, 0xC7, 0xC4, 0x4E, 0xE3, 0x6C, 0x51, 0xA7,
@@ -20,8 +48,82 @@ static const ble_uuid128_t midi_characteristic_uuid = BLE_UUID128_INIT(
     0x12, 0x41, 0x68, 0x38, 0xDB, 0xE5, 0x72, 0x77
 );
 
+// Diagnostics service, its UUIDs only differ in bytes 12-13
+static const ble_uuid128_t diag_service_uuid = BLE_UUID128_INIT(
+    0xBD, 0x60, 0xD3, 0x64, 0x5C, 0x71, 0xC8, 0x69,
+    0x0A, 0x11, 0x80, 0xC2, 0x00, 0x10, 0xB2, 0xF0
+);
+
+static const ble_uuid128_t stats_characteristic_uuid = BLE_UUID128_INIT(
+    0xBD, 0x60, 0xD3, 0x64, 0x5C, 0x71, 0xC8, 0x69,
+    0x0A, 0x11, 0x80, 0xC2, 0x01, 0x10, 0xB2, 0xF0
+);
+
+static const ble_uuid128_t probe_characteristic_uuid = BLE_UUID128_INIT(
+    0xBD, 0x60, 0xD3, 0x64, 0x5C, 0x71, 0xC8, 0x69,
+    0x0A, 0x11, 0x80, 0xC2, 0x02, 0x10, 0xB2, 0xF0
+);
+
+static const ble_uuid128_t trace_characteristic_uuid = BLE_UUID128_INIT(
+    0xBD, 0x60, 0xD3, 0x64, 0x5C, 0x71, 0xC8, 0x69,
+    0x0A, 0x11, 0x80, 0xC2, 0x03, 0x10, 0xB2, 0xF0
+);
+
+static const ble_uuid128_t counters_characteristic_uuid = BLE_UUID128_INIT(
+    0xBD, 0x60, 0xD3, 0x64, 0x5C, 0x71, 0xC8, 0x69,
+    0x0A, 0x11, 0x80, 0xC2, 0x04, 0x10, 0xB2, 0xF0
+);
+
 static int midi_chr_access(uint16_t conn_handle, uint16_t attr_handle,
                           struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int trace_chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                           struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int probe_chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                           struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int stats_chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                           struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int counters_chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                              struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int ble_app_gap_event(struct ble_gap_event *event, void *arg);
+
+static uint16_t midi_chr_val_handle;
+static uint16_t probe_chr_val_handle;
+
+// Channel state of the incoming stream, replayed to late subscribers
+static midi_state_t midi_state;
+static uint8_t midi_tx_buf[CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU];
+static uint8_t stats_buf[MIDI_STATS_ENCODED_MAX];
+static uint8_t counters_buf[DIAG_ENCODED_MAX];
+static uint8_t probe_buf[CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU];
+static uint8_t trace_buf[CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU];
+
+// Long read of a diagnostics value in progress on a connection
+typedef struct {
+    uint16_t conn_handle;
+    uint16_t next;  // offset of the next Read Blob, 0 when no read is open
+    uint32_t start_ms;
+} diag_reader_t;
+
+// A diagnostics value longer than one read response
+typedef struct {
+    size_t (*encode)(uint8_t *buf, size_t cap);
+    uint8_t *buf;
+    size_t cap;
+    size_t len;  // of the snapshot being read
+    diag_reader_t readers[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+} diag_value_t;
+
+static diag_value_t stats_value = {
+    .encode = midi_stats_encode,
+    .buf = stats_buf,
+    .cap = sizeof(stats_buf),
+};
+
+static diag_value_t counters_value = {
+    .encode = diag_encode,
+    .buf = counters_buf,
+    .cap = sizeof(counters_buf),
+};
 
 // GATT service definitions
 static struct ble_gatt_svc_def gatt_svr_svcs[] = {
@@ -32,7 +134,46 @@ static struct ble_gatt_svc_def gatt_svr_svcs[] = {
             {
                 .uuid = &midi_characteristic_uuid.u,
                 .access_cb = midi_chr_access,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY,
+                // BLE-MIDI centrals write without response, several
+                // packets per connection event
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE |
+                         BLE_GATT_CHR_F_WRITE_NO_RSP | BLE_GATT_CHR_F_NOTIFY,
+                .val_handle = &midi_chr_val_handle,
+            },
+            {
+                0, // No more characteristics
+            }
+        },
+    },
+    {
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = &diag_service_uuid.u,
+        .characteristics = (struct ble_gatt_chr_def[]) {
+            {
+                // Latency histograms, see midi_stats.h for the format
+                .uuid = &stats_characteristic_uuid.u,
+                .access_cb = stats_chr_access,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+            },
+            {
+                // Round-trip probe, every write is echoed by notification
+                .uuid = &probe_characteristic_uuid.u,
+                .access_cb = probe_chr_access,
+                .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP |
+                         BLE_GATT_CHR_F_NOTIFY,
+                .val_handle = &probe_chr_val_handle,
+            },
+            {
+                // Trace dump, write TRACE_CMD_DUMP then read until empty
+                .uuid = &trace_characteristic_uuid.u,
+                .access_cb = trace_chr_access,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+            },
+            {
+                // Event and error counters, see diag.h for the format
+                .uuid = &counters_characteristic_uuid.u,
+                .access_cb = counters_chr_access,
+                .flags = BLE_GATT_CHR_F_READ,
             },
             {
                 0, // No more characteristics
@@ -44,35 +185,100 @@ static struct ble_gatt_svc_def gatt_svr_svcs[] = {
     },
 };
 
-static void ble_app_advertise(void) {
-    struct ble_gap_adv_params adv_params;
-    struct ble_hs_adv_fields fields;
-    struct ble_hs_adv_fields rsp_fields;
-    
-    memset(&fields, 0, sizeof(fields));
-    memset(&rsp_fields, 0, sizeof(rsp_fields));
-    memset(&adv_params, 0, sizeof(adv_params));
+// Bring a newly subscribed central up to date with the current channel state,
+// runs in the MIDI task like everything else that reads midi_state
+static void midi_send_snapshot(uint16_t conn_handle) {
+    midi_state_cursor_t cursor;
+    uint16_t cap = ble_att_mtu(conn_handle) - 3;
+    uint16_t len;
+    int packets = 0;
 
-    fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
-    fields.uuids128 = &midi_service_uuid;
-    fields.num_uuids128 = 1;
-    fields.uuids128_is_complete = 1;
+    if (cap > sizeof(midi_tx_buf)) {
+        cap = sizeof(midi_tx_buf);
+    }
 
-    rsp_fields.name = (uint8_t *)DEVICE_NAME;
-    rsp_fields.name_len = strlen(DEVICE_NAME);
-    rsp_fields.name_is_complete = 1;
+    midi_state_cursor_init(&cursor);
+    while ((len = midi_state_snapshot(&midi_state, &cursor, midi_tx_buf, cap,
+                                      midi_ble_now())) > 0) {
+        struct os_mbuf *om = ble_hs_mbuf_from_flat(midi_tx_buf, len);
+        if (om == NULL ||
+            ble_gatts_notify_custom(conn_handle, midi_chr_val_handle, om) != 0) {
+            ESP_LOGW(TAG, "Snapshot to conn %d cut short after %d packets",
+                     conn_handle, packets);
+            return;
+        }
+        packets++;
+    }
+
+    if (packets > 0) {
+        ESP_LOGI(TAG, "Sent state snapshot to conn %d in %d packets",
+                 conn_handle, packets);
+    }
+}
+
+static int ble_app_gap_dispatch(struct ble_gap_event *event) {
+    switch (event->type) {
+        // Advertising is restarted by gap.c, which logs these too
+        case BLE_GAP_EVENT_CONNECT:
+            if (event->connect.status == 0) {
+                midi_task_connect(event->connect.conn_handle);
+            }
+            return 0;
+
+        case BLE_GAP_EVENT_DISCONNECT:
+            midi_task_disconnect(event->disconnect.conn.conn_handle);
+            return 0;
+
+        case BLE_GAP_EVENT_SUBSCRIBE:
+            if (event->subscribe.attr_handle != midi_chr_val_handle) {
+                return 0;
+            }
+            midi_task_subscribe(event->subscribe.conn_handle,
+                                event->subscribe.cur_notify);
+            return 0;
+
+        default:
+            return 0;
+    }
+}
+
+static int ble_app_gap_event(struct ble_gap_event *event, void *arg) {
+    uint32_t start = trace_begin();
+    int rc = ble_app_gap_dispatch(event);
+    trace_end(TRACE_GAP_EVENT, start, event->type);
+    return rc;
+}
+
+// Runs in the MIDI task for every event, built in at debug level only
+static void midi_log_event(const midi_event_t *ev) {
+    switch (MIDI_STATUS_TYPE(ev->data[0])) {
+        case MIDI_NOTE_ON:
+            ESP_LOGD(TAG, "Note On - Note: %d, Velocity: %d", ev->data[1], ev->data[2]);
+            break;
+        case MIDI_NOTE_OFF:
+            ESP_LOGD(TAG, "Note Off - Note: %d, Velocity: %d", ev->data[1], ev->data[2]);
+            break;
+        case MIDI_CONTROL_CHANGE:
+            ESP_LOGD(TAG, "Control Change - Controller: %d, Value: %d", ev->data[1], ev->data[2]);
+            break;
+        default:
+            ESP_LOGD(TAG, "Other MIDI message - Status: 0x%02x", ev->data[0]);
+            break;
+    }
+}
 
-    adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
-    adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
-    adv_params.itvl_min = BLE_GAP_ADV_FAST_INTERVAL1_MIN;
-    adv_params.itvl_max = BLE_GAP_ADV_FAST_INTERVAL1_MAX;
+static void midi_on_event(const midi_event_t *ev, void *arg) {
+    midi_state_apply(&midi_state, ev);
+    midi_log_event(ev);
+}
 
-    ble_gap_adv_set_fields(&fields);
-    ble_gap_adv_rsp_set_fields(&rsp_fields);
-    ble_gap_adv_start(BLE_OWN_ADDR_PUBLIC, NULL, BLE_HS_FOREVER,
-                      &adv_params, NULL, NULL);
+// Device-addressed SysEx such as curve uploads is consumed here
+static bool midi_on_sysex(const uint8_t *data, size_t len, void *arg) {
+    return midi_curve_handle_sysex(data, len);
+}
 
-    ESP_LOGI(TAG, "Started advertising");
+static void midi_on_subscribe(uint16_t conn_handle, void *arg) {
+    midi_send_snapshot(conn_handle);
 }
 
 static int midi_chr_access(uint16_t conn_handle, uint16_t attr_handle,
@@ -81,45 +287,198 @@ static int midi_chr_access(uint16_t conn_handle, uint16_t attr_handle,
         case BLE_GATT_ACCESS_OP_READ_CHR:
             return 0;
 
-        case BLE_GATT_ACCESS_OP_WRITE_CHR:
-            if (ctxt->om->om_len > 0) {
-                uint8_t *midi_data = OS_MBUF_DATA(ctxt->om, uint8_t *);
-                
-                ESP_LOGI(TAG, "Received MIDI data of length: %d", ctxt->om->om_len);
-                for(int i = 0; i < ctxt->om->om_len; i++) {
-                    ESP_LOGI(TAG, "Byte %d: 0x%02x", i, midi_data[i]);
-                }
-
-                if (ctxt->om->om_len >= 5) {
-                    uint8_t status = midi_data[2];
-                    uint8_t data1 = midi_data[3];
-                    uint8_t data2 = midi_data[4];
-
-                    switch(status & 0xF0) {
-                        case 0x90:
-                            ESP_LOGI(TAG, "Note On - Note: %d, Velocity: %d", data1, data2);
-                            break;
-                        case 0x80:
-                            ESP_LOGI(TAG, "Note Off - Note: %d, Velocity: %d", data1, data2);
-                            break;
-                        case 0xB0:
-                            ESP_LOGI(TAG, "Control Change - Controller: %d, Value: %d", data1, data2);
-                            break;
-                        default:
-                            ESP_LOGI(TAG, "Other MIDI message - Status: 0x%02x", status);
-                            break;
-                    }
-                }
+        case BLE_GATT_ACCESS_OP_WRITE_CHR: {
+            // Decoding happens in the MIDI task, only copy the packet here.
+            // Errors only reach centrals that wrote with response.
+            uint32_t start = trace_begin();
+            gap_link_rx(conn_handle);
+            int rc = midi_task_input(conn_handle, ctxt->om);
+            trace_end(TRACE_GATT_MIDI_WRITE, start, OS_MBUF_PKTLEN(ctxt->om));
+            if (rc == BLE_HS_EMSGSIZE) {
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+            if (rc != 0) {
+                return BLE_ATT_ERR_INSUFFICIENT_RES;
+            }
+            return 0;
+        }
+
+        default:
+            return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+// Reply layout: u32 receive time (us), u32 transmit time (us), then the
+// request echoed back unchanged. Both times are little endian.
+#define PROBE_HDR_LEN 8
+
+static void put_le32(uint8_t *buf, uint32_t v) {
+    buf[0] = v;
+    buf[1] = v >> 8;
+    buf[2] = v >> 16;
+    buf[3] = v >> 24;
+}
+
+// Answered right here on the host task so the reply skips the MIDI pipeline
+static int probe_chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                           struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    uint32_t rx_us = esp_timer_get_time();
+    uint16_t cap = ble_att_mtu(conn_handle) - 3;
+    uint16_t len = 0;
+
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+    if (cap > sizeof(probe_buf)) {
+        cap = sizeof(probe_buf);
+    }
+    if (cap <= PROBE_HDR_LEN ||
+        ble_hs_mbuf_to_flat(ctxt->om, probe_buf + PROBE_HDR_LEN,
+                            cap - PROBE_HDR_LEN, &len) != 0) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    put_le32(probe_buf, rx_us);
+    put_le32(probe_buf + 4, esp_timer_get_time());
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(probe_buf, PROBE_HDR_LEN + len);
+    if (om == NULL) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    ble_gatts_notify_custom(conn_handle, probe_chr_val_handle, om);
+    trace_end(TRACE_GATT_PROBE, rx_us, len);
+    return 0;
+}
+
+static int trace_chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                           struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    switch (ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR: {
+            // Stay below MTU - 1 so clients never continue with a blob read
+            uint16_t cap = ble_att_mtu(conn_handle) - 4;
+            if (cap > sizeof(trace_buf)) {
+                cap = sizeof(trace_buf);
+            }
+            size_t len = trace_read(trace_buf, cap);
+            if (os_mbuf_append(ctxt->om, trace_buf, len) != 0) {
+                return BLE_ATT_ERR_INSUFFICIENT_RES;
+            }
+            return 0;
+        }
+
+        case BLE_GATT_ACCESS_OP_WRITE_CHR: {
+            uint8_t cmd;
+            uint16_t len = 0;
+            if (ble_hs_mbuf_to_flat(ctxt->om, &cmd, sizeof(cmd), &len) != 0 ||
+                len != sizeof(cmd)) {
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+            trace_command(cmd);
+            return 0;
+        }
+
+        default:
+            return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+// The value is longer than one response, so the client follows the Read
+// with Read Blobs that each call back here. All parts of a read come from
+// the snapshot taken when it started, and a new one is only taken while no
+// other connection is mid-read.
+static int diag_value_read(diag_value_t *value, uint16_t conn_handle,
+                           struct os_mbuf *om) {
+    uint32_t now = midi_now_ms();
+    diag_reader_t *reader = NULL;
+    diag_reader_t *idle = NULL;
+    bool busy = false;
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++) {
+        diag_reader_t *r = &value->readers[i];
+        if (r->next != 0 && now - r->start_ms >= DIAG_SNAPSHOT_MS) {
+            r->next = 0;
+        }
+        if (r->next == 0) {
+            idle = idle ? idle : r;
+        } else if (r->conn_handle == conn_handle) {
+            reader = r;
+        } else {
+            busy = true;
+        }
+    }
+    if (reader == NULL) {
+        // Each connection holds at most one entry, so one is idle
+        if (!busy) {
+            value->len = value->encode(value->buf, value->cap);
+        }
+        reader = idle;
+        reader->conn_handle = conn_handle;
+        reader->start_ms = now;
+    }
+    if (os_mbuf_append(om, value->buf, value->len) != 0) {
+        reader->next = 0;
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    reader->next += ble_att_mtu(conn_handle) - 1;
+    if (reader->next >= value->len) {
+        reader->next = 0;
+    }
+    return 0;
+}
+
+static int stats_chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                           struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    switch (ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR:
+            return diag_value_read(&stats_value, conn_handle, ctxt->om);
+
+        case BLE_GATT_ACCESS_OP_WRITE_CHR: {
+            // The only write accepted is the reset command
+            uint8_t cmd;
+            uint16_t len = 0;
+            if (ble_hs_mbuf_to_flat(ctxt->om, &cmd, sizeof(cmd), &len) != 0 ||
+                len != sizeof(cmd)) {
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+            if (cmd != MIDI_STATS_CMD_RESET) {
+                return BLE_ATT_ERR_UNLIKELY;
             }
+            midi_stats_reset();
             return 0;
+        }
 
         default:
             return BLE_ATT_ERR_UNLIKELY;
     }
 }
 
+static int counters_chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                              struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    if (ctxt->op != BLE_GATT_ACCESS_OP_READ_CHR) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+    return diag_value_read(&counters_value, conn_handle, ctxt->om);
+}
+
 static void ble_app_on_sync(void) {
-    ble_app_advertise();
+    struct ble_hs_adv_fields fields = {0};
+    struct ble_hs_adv_fields rsp_fields = {0};
+
+    // Attribute handles are only assigned once the host has synced
+    gatt_cache_start();
+    midi_task_start(midi_chr_val_handle);
+
+    fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
+    fields.uuids128 = &midi_service_uuid;
+    fields.num_uuids128 = 1;
+    fields.uuids128_is_complete = 1;
+
+    rsp_fields.name = (uint8_t *)DEVICE_NAME;
+    rsp_fields.name_len = strlen(DEVICE_NAME);
+    rsp_fields.name_is_complete = 1;
+
+    // Payloads are encoded once here, restarts only re-enable advertising
+    if (adv_init(&fields, &rsp_fields, ble_app_gap_event, NULL) == 0) {
+        adv_start_fast();
+    }
 }
 
 static void host_task(void *param) {
@@ -128,6 +487,16 @@ static void host_task(void *param) {
     nimble_port_freertos_deinit();
 }
 
+// Publish the heart rate once a period and send it to the subscribers
+static void heart_rate_task(void *param) {
+    for (;;) {
+        update_heart_rate();
+        ESP_LOGD(TAG, "Heart rate %d BPM", get_heart_rate());
+        send_heart_rate_indication();
+        vTaskDelay(HEART_RATE_TASK_PERIOD);
+    }
+}
+
 void app_main(void) {
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -138,13 +507,32 @@ void app_main(void) {
 
     ESP_ERROR_CHECK(nimble_port_init());
 
-    int rc = ble_gatts_count_cfg(gatt_svr_svcs);
+    midi_pool_init();
+    midi_state_reset(&midi_state);
+    midi_route_init();
+    midi_curve_init();
+    midi_task_init(midi_on_event, midi_on_sysex, midi_on_subscribe, NULL);
+    led_init();
+
+    int rc = gatt_cache_init();
+    assert(rc == 0);
+    rc = ble_gatts_count_cfg(gatt_svr_svcs);
     assert(rc == 0);
     rc = ble_gatts_add_svcs(gatt_svr_svcs);
     assert(rc == 0);
+    // Heart rate and Automation IO services
+    rc = gatt_svc_init();
+    assert(rc == 0);
 
     ble_svc_gap_device_name_set(DEVICE_NAME);
+    bond_init();
     ble_hs_cfg.sync_cb = ble_app_on_sync;
 
     nimble_port_freertos_init(host_task);
+
+    // Sends wait for the host, values go out once centrals subscribe
+    if (xTaskCreate(heart_rate_task, "heart_rate", HEART_RATE_TASK_STACK, NULL,
+                    HEART_RATE_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start heart rate task");
+    }
 }
\ No newline at end of file
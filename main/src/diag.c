@@ -0,0 +1,148 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "diag.h"
+#include "gap.h"
+#include "gatt_svc.h"
+#include "midi_merge.h"
+#include "midi_out.h"
+#include "midi_pool.h"
+#include "midi_task.h"
+#include "sdkconfig.h"
+
+/* Defines */
+#define DIAG_HDR_LEN 2
+#define DIAG_REC_HDR_LEN 4
+
+/* Private function declarations */
+static size_t put_record(uint8_t *buf, size_t pos, size_t cap,
+                         diag_record_t type, uint16_t conn_handle,
+                         const uint32_t *vals, uint8_t n);
+
+/* Private functions */
+/* Append one record, or flag the value truncated if it does not fit */
+static size_t put_record(uint8_t *buf, size_t pos, size_t cap,
+                         diag_record_t type, uint16_t conn_handle,
+                         const uint32_t *vals, uint8_t n) {
+    if (pos + DIAG_REC_HDR_LEN + n * 4 > cap) {
+        buf[1] |= DIAG_F_TRUNCATED;
+        return pos;
+    }
+    buf[pos++] = type;
+    buf[pos++] = conn_handle & 0xFF;
+    buf[pos++] = conn_handle >> 8;
+    buf[pos++] = n;
+    for (uint8_t i = 0; i < n; i++) {
+        buf[pos++] = vals[i];
+        buf[pos++] = vals[i] >> 8;
+        buf[pos++] = vals[i] >> 16;
+        buf[pos++] = vals[i] >> 24;
+    }
+    return pos;
+}
+
+/* Public functions */
+/*
+ *  Serialize the counters of all modules, returns the encoded length or 0
+ *  if cap is short. Call from the NimBLE host task, which owns the GAP
+ *  link table.
+ */
+size_t diag_encode(uint8_t *buf, size_t cap) {
+    /* Local variables */
+    gap_counters_t gap;
+    gatt_svr_counters_t gatt;
+    midi_task_stats_t task;
+    heart_rate_tx_stats_t hr;
+    midi_pool_stats_t pool;
+    gap_link_t link;
+    midi_merge_src_stats_t merge;
+    midi_out_stats_t out;
+    uint16_t handles[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+    uint32_t vals[3 + GAP_LINK_RX_BUCKETS];
+    uint32_t out_vals[2 * MIDI_OUT_LANES + 2];
+    size_t pos = DIAG_HDR_LEN;
+    int conns, slot;
+
+    if (cap < pos) {
+        return 0;
+    }
+    buf[0] = DIAG_FORMAT_VERSION;
+    buf[1] = 0;
+
+    gap_get_counters(&gap);
+    pos = put_record(buf, pos, cap, DIAG_REC_GAP, DIAG_CONN_NONE,
+                     (uint32_t[]){gap.connects, gap.connect_failures,
+                                  gap.disconnects, gap.conn_updates,
+                                  gap.subscribes, gap.notify_tx_errors,
+                                  gap.mtu_updates},
+                     7);
+
+    gatt_svr_get_counters(&gatt);
+    pos = put_record(buf, pos, cap, DIAG_REC_GATT, DIAG_CONN_NONE,
+                     (uint32_t[]){gatt.hr_reads, gatt.led_writes,
+                                  gatt.led_frames, gatt.led_pixels,
+                                  gatt.led_stream_frames, gatt.subscribes,
+                                  gatt.bad_access},
+                     7);
+
+    midi_task_get_stats(&task);
+    pos = put_record(buf, pos, cap, DIAG_REC_MIDI_TASK, DIAG_CONN_NONE,
+                     (uint32_t[]){task.rx_dropped, task.malformed}, 2);
+
+    get_heart_rate_tx_stats(&hr);
+    pos = put_record(buf, pos, cap, DIAG_REC_HEART_RATE, DIAG_CONN_NONE,
+                     (uint32_t[]){hr.sent, hr.coalesced, hr.failed}, 3);
+
+    midi_pool_get_stats(&pool);
+    pos = put_record(buf, pos, cap, DIAG_REC_POOL, DIAG_CONN_NONE,
+                     (uint32_t[]){pool.size, pool.in_use, pool.high_water,
+                                  pool.alloc_failed},
+                     4);
+
+    /* Writes per connection event, for tuning the central's packet rate */
+    conns = gap_link_handles(handles, CONFIG_BT_NIMBLE_MAX_CONNECTIONS);
+    for (int i = 0; i < conns; i++) {
+        if (gap_link_get(handles[i], &link) != 0) {
+            continue;
+        }
+        vals[0] = link.rx_writes;
+        vals[1] = link.rx_events;
+        vals[2] = link.rx_max_per_event;
+        for (int b = 0; b < GAP_LINK_RX_BUCKETS; b++) {
+            vals[3 + b] = link.rx_per_event[b];
+        }
+        pos = put_record(buf, pos, cap, DIAG_REC_LINK, handles[i], vals,
+                         3 + GAP_LINK_RX_BUCKETS);
+    }
+
+    /* Connections that have not reached the MIDI task yet have no slot */
+    for (int i = 0; i < conns; i++) {
+        slot = midi_merge_slot(handles[i]);
+        if (slot == MIDI_MERGE_NO_SLOT) {
+            continue;
+        }
+        midi_merge_get_stats(slot, &merge);
+        pos = put_record(buf, pos, cap, DIAG_REC_MERGE, handles[i],
+                         (uint32_t[]){merge.events_in, merge.sysex_in,
+                                      merge.sysex_dropped, merge.decode_errors,
+                                      merge.notes_released, merge.thin.passed,
+                                      merge.thin.coalesced, merge.thin.dropped},
+                         8);
+
+        /* Output queues exist while the connection is subscribed */
+        if (!midi_out_is_open(slot)) {
+            continue;
+        }
+        midi_out_get_stats(slot, &out);
+        for (int l = 0; l < MIDI_OUT_LANES; l++) {
+            out_vals[l] = out.depth_max[l];
+            out_vals[MIDI_OUT_LANES + l] = out.dropped[l];
+        }
+        out_vals[2 * MIDI_OUT_LANES] = out.packets_sent;
+        out_vals[2 * MIDI_OUT_LANES + 1] = out.notify_failed;
+        pos = put_record(buf, pos, cap, DIAG_REC_OUT, handles[i], out_vals,
+                         2 * MIDI_OUT_LANES + 2);
+    }
+    return pos;
+}
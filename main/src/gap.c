@@ -4,20 +4,116 @@
  * SPDX-License-Identifier: Unlicense OR CC0-1.0
  */
 /* Includes */
+#define LOG_POLICY_MODULE GAP
+#include "log_policy.h"
+
 #include "gap.h"
 #include "common.h"
 #include "gatt_svc.h"
+#include "esp_timer.h"
+#include <inttypes.h>
+
+/* Defines */
+#define ADV_ITVL BLE_GAP_ADV_ITVL_MS(CONFIG_BLE_ADV_INTERVAL_MS)
+#define ADV_FAST_ITVL BLE_GAP_ADV_ITVL_MS(CONFIG_BLE_ADV_FAST_INTERVAL_MS)
+
+/* Largest LL payload and the air time it takes on the 1M PHY */
+#define LINK_MAX_TX_OCTETS 251
+#define LINK_MAX_TX_TIME 2120
+
+#if CONFIG_BLE_ADV_DIRECTED
+#define ADV_CALL_BACK_BONDED true
+#else
+#define ADV_CALL_BACK_BONDED false
+#endif
+
+/* Private types */
+typedef enum {
+    ADV_SLOW,
+    ADV_FAST,
+    ADV_DIRECTED,
+} adv_mode_t;
+
+/* Library function declarations */
+void ble_store_config_init(void);
 
 /* Private function declarations */
 inline static void format_addr(char *addr_str, uint8_t addr[]);
 static void print_conn_desc(struct ble_gap_conn_desc *desc);
-static void start_advertising(void);
+static int start_advertising(adv_mode_t mode, const ble_addr_t *peer);
+static int bond_cache_find(const ble_addr_t *addr);
+static void bond_cache_load(void);
+static int bond_store_status(struct ble_store_status_event *event, void *arg);
+static gap_link_t *link_find(uint16_t conn_handle, bool add);
+static void link_optimize(uint16_t conn_handle);
 static int gap_event_handler(struct ble_gap_event *event, void *arg);
 
 /* Private variables */
 static uint8_t own_addr_type;
 static uint8_t addr_val[6] = {0};
-static uint8_t esp_uri[] = {BLE_GAP_URI_PREFIX_HTTPS, '/', '/', 'e', 's', 'p', 'r', 'e', 's', 's', 'i', 'f', '.', 'c', 'o', 'm'};
+
+/*
+ * Advertising and scan response payloads are encoded once by adv_init and
+ * stay in the controller, so restarting advertising is a single
+ * ble_gap_adv_start call.
+ */
+static uint8_t adv_data[BLE_HS_ADV_MAX_SZ];
+static uint8_t adv_data_len;
+static uint8_t rsp_data[BLE_HS_ADV_MAX_SZ];
+static uint8_t rsp_data_len;
+static adv_mode_t adv_mode;
+
+/*
+ * Identity addresses of bonded peers. The bonds live in NVS; this copy is
+ * refreshed whenever they change so a disconnect never waits on a store
+ * lookup before advertising.
+ *
+ * A peer that handed over an IRK connects from resolvable private
+ * addresses. Its IRK is not in the controller's resolving list, so it
+ * would ignore advertising directed to its identity address; such peers
+ * get the fast burst instead.
+ */
+static ble_addr_t bond_peers[CONFIG_BT_NIMBLE_MAX_BONDS];
+static bool bond_directed[CONFIG_BT_NIMBLE_MAX_BONDS];
+static int bond_count;
+
+/* PHY and data length negotiated on each connection */
+static gap_link_t links[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+
+/* Event counts, bumped on every event instead of logging */
+static struct {
+    _Atomic uint32_t connects;
+    _Atomic uint32_t connect_failures;
+    _Atomic uint32_t disconnects;
+    _Atomic uint32_t conn_updates;
+    _Atomic uint32_t subscribes;
+    _Atomic uint32_t notify_tx_errors;
+    _Atomic uint32_t mtu_updates;
+} event_counters;
+
+static ble_gap_event_fn *app_event_cb;
+static void *app_event_arg;
+
+static const struct ble_gap_adv_params adv_params = {
+    .conn_mode = BLE_GAP_CONN_MODE_UND,
+    .disc_mode = BLE_GAP_DISC_MODE_GEN,
+    .itvl_min = ADV_ITVL,
+    .itvl_max = ADV_ITVL,
+};
+
+static const struct ble_gap_adv_params adv_fast_params = {
+    .conn_mode = BLE_GAP_CONN_MODE_UND,
+    .disc_mode = BLE_GAP_DISC_MODE_GEN,
+    .itvl_min = ADV_FAST_ITVL,
+    .itvl_max = ADV_FAST_ITVL,
+};
+
+/* The controller picks the interval of high duty cycle directed advertising */
+static const struct ble_gap_adv_params adv_directed_params = {
+    .conn_mode = BLE_GAP_CONN_MODE_DIR,
+    .disc_mode = BLE_GAP_DISC_MODE_NON,
+    .high_duty_cycle = 1,
+};
 
 /* Private functions */
 inline static void format_addr(char *addr_str, uint8_t addr[]) {
@@ -51,89 +147,173 @@ static void print_conn_desc(struct ble_gap_conn_desc *desc) {
              desc->sec_state.bonded);
 }
 
-static void start_advertising(void) {
+/*
+ *  Start advertising with the cached payloads. Directed advertising to a
+ *  bonded peer and fast undirected advertising each replace whatever is
+ *  running; when they time out the next slower mode takes over.
+ */
+static int start_advertising(adv_mode_t mode, const ble_addr_t *peer) {
     /* Local variables */
     int rc = 0;
-    const char *name;
-    struct ble_hs_adv_fields adv_fields = {0};
-    struct ble_hs_adv_fields rsp_fields = {0};
-    struct ble_gap_adv_params adv_params = {0};
-
-    /* Set advertising flags */
-    adv_fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
-
-    /* Set device name */
-    name = ble_svc_gap_device_name();
-    adv_fields.name = (uint8_t *)name;
-    adv_fields.name_len = strlen(name);
-    adv_fields.name_is_complete = 1;
-
-    /* Set device tx power */
-    adv_fields.tx_pwr_lvl = BLE_HS_ADV_TX_PWR_LVL_AUTO;
-    adv_fields.tx_pwr_lvl_is_present = 1;
-
-    /* Set device appearance */
-    adv_fields.appearance = BLE_GAP_APPEARANCE_GENERIC_TAG;
-    adv_fields.appearance_is_present = 1;
-
-    /* Set device LE role */
-    adv_fields.le_role = BLE_GAP_LE_ROLE_PERIPHERAL;
-    adv_fields.le_role_is_present = 1;
-
-    /* Set advertiement fields */
-    rc = ble_gap_adv_set_fields(&adv_fields);
-    if (rc != 0) {
-        ESP_LOGE(TAG, "failed to set advertising data, error code: %d", rc);
-        return;
-    }
+    const struct ble_gap_adv_params *params = &adv_params;
+    int32_t duration = BLE_HS_FOREVER;
 
-    /* Set device address */
-    rsp_fields.device_addr = addr_val;
-    rsp_fields.device_addr_type = own_addr_type;
-    rsp_fields.device_addr_is_present = 1;
+    if (mode == ADV_DIRECTED && !ADV_CALL_BACK_BONDED) {
+        mode = ADV_FAST;
+    }
+    if (mode == ADV_FAST && CONFIG_BLE_ADV_FAST_DURATION_MS == 0) {
+        mode = ADV_SLOW;
+    }
 
-    /* Set URI */
-    rsp_fields.uri = esp_uri;
-    rsp_fields.uri_len = sizeof(esp_uri);
+    if (ble_gap_adv_active()) {
+        if (mode == ADV_SLOW || (mode == ADV_FAST && adv_mode != ADV_SLOW)) {
+            return 0;
+        }
+        ble_gap_adv_stop();
+    }
 
-    /* Set advertising interval */
-    rsp_fields.adv_itvl = BLE_GAP_ADV_ITVL_MS(500);
-    rsp_fields.adv_itvl_is_present = 1;
+    switch (mode) {
+    case ADV_DIRECTED:
+        /* High duty cycle directed advertising stops after 1.28 s */
+        params = &adv_directed_params;
+        duration = 1280;
+        break;
+    case ADV_FAST:
+        params = &adv_fast_params;
+        duration = CONFIG_BLE_ADV_FAST_DURATION_MS;
+        peer = NULL;
+        break;
+    default:
+        peer = NULL;
+        break;
+    }
 
-    /* Set scan response fields */
-    rc = ble_gap_adv_rsp_set_fields(&rsp_fields);
+    rc = ble_gap_adv_start(own_addr_type, peer, duration, params,
+                           gap_event_handler, NULL);
     if (rc != 0) {
-        ESP_LOGE(TAG, "failed to set scan response data, error code: %d", rc);
-        return;
+        /* Also expected while every connection slot is taken */
+        ESP_LOGW(TAG, "advertising not started, error code: %d", rc);
+        if (mode == ADV_DIRECTED) {
+            return start_advertising(ADV_FAST, NULL);
+        }
+        return rc;
     }
+    adv_mode = mode;
+    ESP_LOGI(TAG, "advertising started%s",
+             mode == ADV_DIRECTED ? " (directed)"
+             : mode == ADV_FAST   ? " (fast)"
+                                  : "");
+    return rc;
+}
 
-    /* Set non-connetable and general discoverable mode to be a beacon */
-    adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
-    adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
+/* Index of a bonded peer in the cache, -1 if it is not bonded */
+static int bond_cache_find(const ble_addr_t *addr) {
+    for (int i = 0; i < bond_count; i++) {
+        if (ble_addr_cmp(&bond_peers[i], addr) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-    /* Set advertising interval */
-    adv_params.itvl_min = BLE_GAP_ADV_ITVL_MS(500);
-    adv_params.itvl_max = BLE_GAP_ADV_ITVL_MS(510);
+static void bond_cache_load(void) {
+    /* Local variables */
+    int rc = 0;
+    struct ble_store_key_sec key;
+    struct ble_store_value_sec sec;
 
-    /* Start advertising */
-    rc = ble_gap_adv_start(own_addr_type, NULL, BLE_HS_FOREVER, &adv_params,
-                           gap_event_handler, NULL);
+    rc = ble_store_util_bonded_peers(bond_peers, &bond_count,
+                                     CONFIG_BT_NIMBLE_MAX_BONDS);
     if (rc != 0) {
-        ESP_LOGE(TAG, "failed to start advertising, error code: %d", rc);
+        ESP_LOGE(TAG, "failed to read bonded peers, error code: %d", rc);
+        bond_count = 0;
+    }
+
+    for (int i = 0; i < bond_count; i++) {
+        key = (struct ble_store_key_sec){.peer_addr = bond_peers[i]};
+        bond_directed[i] = ble_store_read_peer_sec(&key, &sec) == 0 &&
+                           !sec.irk_present;
+    }
+}
+
+/* The store drops the oldest bond when it runs full */
+static int bond_store_status(struct ble_store_status_event *event, void *arg) {
+    /* Local variables */
+    int rc = ble_store_util_status_rr(event, arg);
+
+    bond_cache_load();
+    return rc;
+}
+
+static gap_link_t *link_find(uint16_t conn_handle, bool add) {
+    /* Local variables */
+    gap_link_t *free_slot = NULL;
+
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++) {
+        if (links[i].conn_handle == conn_handle) {
+            return &links[i];
+        }
+        if (free_slot == NULL && links[i].conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+            free_slot = &links[i];
+        }
+    }
+    if (!add || free_slot == NULL) {
+        return NULL;
+    }
+    *free_slot = (gap_link_t){
+        .conn_handle = conn_handle,
+        .tx_phy = BLE_GAP_LE_PHY_1M,
+        .rx_phy = BLE_GAP_LE_PHY_1M,
+        .max_tx_octets = 27,
+        .max_rx_octets = 27,
+    };
+    return free_slot;
+}
+
+/*
+ *  Ask for the 2M PHY and the largest LL payload. Either request is simply
+ *  not granted when the central does not support it; the outcome arrives
+ *  as PHY update and data length change events.
+ */
+static void link_optimize(uint16_t conn_handle) {
+    /* Local variables */
+    int rc = 0;
+
+    if (link_find(conn_handle, true) == NULL) {
         return;
     }
-    ESP_LOGI(TAG, "advertising started!");
+
+#if CONFIG_BLE_LINK_2M_PHY
+    rc = ble_gap_set_prefered_le_phy(conn_handle, BLE_GAP_LE_PHY_2M_MASK,
+                                     BLE_GAP_LE_PHY_2M_MASK,
+                                     BLE_GAP_LE_PHY_CODED_ANY);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "failed to request 2M PHY, error code: %d", rc);
+    }
+#endif
+
+#if CONFIG_BLE_LINK_DATA_LEN
+    rc = ble_gap_set_data_len(conn_handle, LINK_MAX_TX_OCTETS,
+                              LINK_MAX_TX_TIME);
+    if (rc != 0) {
+        ESP_LOGW(TAG, "failed to set data length, error code: %d", rc);
+    }
+#endif
+    (void)rc;
 }
 
 /*
  * NimBLE applies an event-driven model to keep GAP service going
  * gap_event_handler is a callback function registered when calling
- * ble_gap_adv_start API and called when a GAP event arrives
+ * ble_gap_adv_start API and called when a GAP event arrives. It keeps
+ * advertising going and then hands every event to the application.
  */
 static int gap_event_handler(struct ble_gap_event *event, void *arg) {
     /* Local variables */
     int rc = 0;
     struct ble_gap_conn_desc desc;
+    gap_link_t *link;
+    int bond;
 
     /* Handle different GAP event */
     switch (event->type) {
@@ -141,96 +321,130 @@ static int gap_event_handler(struct ble_gap_event *event, void *arg) {
     /* Connect event */
     case BLE_GAP_EVENT_CONNECT:
         /* A new connection was established or a connection attempt failed. */
+        if (event->connect.status == 0) {
+            LOG_POLICY_COUNT(event_counters.connects);
+        } else {
+            LOG_POLICY_COUNT(event_counters.connect_failures);
+        }
         ESP_LOGI(TAG, "connection %s; status=%d",
                  event->connect.status == 0 ? "established" : "failed",
                  event->connect.status);
 
-        /* Connection succeeded */
-        if (event->connect.status == 0) {
-            /* Check connection handle */
-            rc = ble_gap_conn_find(event->connect.conn_handle, &desc);
-            if (rc != 0) {
-                ESP_LOGE(TAG,
-                         "failed to find connection by handle, error code: %d",
-                         rc);
-                return rc;
-            }
-
-            /* Print connection descriptor */
+        /* Connection succeeded, print connection descriptor */
+        if (event->connect.status == 0 &&
+            ble_gap_conn_find(event->connect.conn_handle, &desc) == 0) {
             print_conn_desc(&desc);
-
-            /* Try to update connection parameters */
-            struct ble_gap_upd_params params = {.itvl_min = desc.conn_itvl,
-                                                .itvl_max = desc.conn_itvl,
-                                                .latency = 3,
-                                                .supervision_timeout =
-                                                    desc.supervision_timeout};
-            rc = ble_gap_update_params(event->connect.conn_handle, &params);
-            if (rc != 0) {
-                ESP_LOGE(
-                    TAG,
-                    "failed to update connection parameters, error code: %d",
-                    rc);
-                return rc;
+            link_optimize(event->connect.conn_handle);
+            link = link_find(event->connect.conn_handle, false);
+            if (link != NULL) {
+                link->conn_itvl = desc.conn_itvl;
             }
+#if CONFIG_BLE_SECURITY_REQUEST
+            /* Ask for encryption, which bonds new peers */
+            ble_gap_security_initiate(event->connect.conn_handle);
+#endif
         }
-        /* Connection failed, restart advertising */
-        else {
-            start_advertising();
-        }
-        return rc;
+
+        /* Keep advertising so further centrals can connect */
+        adv_mode = ADV_SLOW;
+        start_advertising(ADV_SLOW, NULL);
+        break;
 
     /* Disconnect event */
     case BLE_GAP_EVENT_DISCONNECT:
         /* A connection was terminated, print connection descriptor */
+        LOG_POLICY_COUNT(event_counters.disconnects);
         ESP_LOGI(TAG, "disconnected from peer; reason=%d",
                  event->disconnect.reason);
 
-        /* Restart advertising */
-        start_advertising();
-        return rc;
+        link = link_find(event->disconnect.conn.conn_handle, false);
+        if (link != NULL) {
+            ESP_LOGI(TAG,
+                     "conn_handle=%d received %" PRIu32 " writes in %" PRIu32
+                     " connection events, at most %d per event",
+                     link->conn_handle, link->rx_writes, link->rx_events,
+                     link->rx_max_per_event);
+            link->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+        }
+
+        /* Call a bonded peer back directly, anyone else gets a fast burst */
+        bond = bond_cache_find(&event->disconnect.conn.peer_id_addr);
+        if (bond >= 0 && bond_directed[bond]) {
+            start_advertising(ADV_DIRECTED,
+                              &event->disconnect.conn.peer_id_addr);
+        } else {
+            start_advertising(ADV_FAST, NULL);
+        }
+        break;
 
     /* Connection parameters update event */
     case BLE_GAP_EVENT_CONN_UPDATE:
         /* The central has updated the connection parameters. */
-        ESP_LOGI(TAG, "connection updated; status=%d",
-                 event->conn_update.status);
-
-        /* Print connection descriptor */
-        rc = ble_gap_conn_find(event->conn_update.conn_handle, &desc);
-        if (rc != 0) {
-            ESP_LOGE(TAG, "failed to find connection by handle, error code: %d",
-                     rc);
-            return rc;
+        LOG_POLICY_COUNT(event_counters.conn_updates);
+        ESP_LOGD(TAG, "connection updated; conn_handle=%d status=%d",
+                 event->conn_update.conn_handle, event->conn_update.status);
+
+        link = link_find(event->conn_update.conn_handle, false);
+        if (link != NULL &&
+            ble_gap_conn_find(event->conn_update.conn_handle, &desc) == 0) {
+            link->conn_itvl = desc.conn_itvl;
         }
-        print_conn_desc(&desc);
-        return rc;
+        break;
 
     /* Advertising complete event */
     case BLE_GAP_EVENT_ADV_COMPLETE:
-        /* Advertising completed, restart advertising */
+        /* A burst timed out, step down to the next advertising mode */
         ESP_LOGI(TAG, "advertise complete; reason=%d",
                  event->adv_complete.reason);
-        start_advertising();
-        return rc;
+        start_advertising(adv_mode == ADV_DIRECTED ? ADV_FAST : ADV_SLOW,
+                          NULL);
+        break;
+
+    /* Encryption change event */
+    case BLE_GAP_EVENT_ENC_CHANGE:
+        ESP_LOGI(TAG, "encryption change event; status=%d",
+                 event->enc_change.status);
+
+        /* Remember newly bonded peers */
+        if (event->enc_change.status == 0 &&
+            ble_gap_conn_find(event->enc_change.conn_handle, &desc) == 0 &&
+            desc.sec_state.bonded && bond_cache_find(&desc.peer_id_addr) < 0) {
+            bond_cache_load();
+        }
+        break;
+
+    /* Repeat pairing event */
+    case BLE_GAP_EVENT_REPEAT_PAIRING:
+        /* The peer lost its keys, drop the old bond and pair again */
+        rc = ble_gap_conn_find(event->repeat_pairing.conn_handle, &desc);
+        if (rc == 0) {
+            ble_store_util_delete_peer(&desc.peer_id_addr);
+            bond_cache_load();
+        }
+        return BLE_GAP_REPEAT_PAIRING_RETRY;
 
     /* Notification sent event */
     case BLE_GAP_EVENT_NOTIFY_TX:
         if ((event->notify_tx.status != 0) &&
             (event->notify_tx.status != BLE_HS_EDONE)) {
             /* Print notification info on error */
-            ESP_LOGI(TAG,
+            LOG_POLICY_COUNT(event_counters.notify_tx_errors);
+            ESP_LOGD(TAG,
                      "notify event; conn_handle=%d attr_handle=%d "
                      "status=%d is_indication=%d",
                      event->notify_tx.conn_handle, event->notify_tx.attr_handle,
                      event->notify_tx.status, event->notify_tx.indication);
         }
-        return rc;
+
+        /* GATT notification sent callback */
+        gatt_svr_notify_tx_cb(event);
+        break;
 
     /* Subscribe event */
     case BLE_GAP_EVENT_SUBSCRIBE:
         /* Print subscription info to log */
-        ESP_LOGI(TAG,
+        LOG_POLICY_COUNT(event_counters.subscribes);
+        ESP_LOGD(TAG,
                  "subscribe event; conn_handle=%d attr_handle=%d "
                  "reason=%d prevn=%d curn=%d previ=%d curi=%d",
                  event->subscribe.conn_handle, event->subscribe.attr_handle,
@@ -240,52 +454,234 @@ static int gap_event_handler(struct ble_gap_event *event, void *arg) {
 
         /* GATT subscribe event callback */
         gatt_svr_subscribe_cb(event);
-        return rc;
+        break;
 
     /* MTU update event */
     case BLE_GAP_EVENT_MTU:
         /* Print MTU update info to log */
-        ESP_LOGI(TAG, "mtu update event; conn_handle=%d cid=%d mtu=%d",
+        LOG_POLICY_COUNT(event_counters.mtu_updates);
+        ESP_LOGD(TAG, "mtu update event; conn_handle=%d cid=%d mtu=%d",
                  event->mtu.conn_handle, event->mtu.channel_id,
                  event->mtu.value);
-        return rc;
+        break;
+
+    /* PHY update event */
+    case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+        ESP_LOGD(TAG, "phy update event; conn_handle=%d status=%d tx=%d rx=%d",
+                 event->phy_updated.conn_handle, event->phy_updated.status,
+                 event->phy_updated.tx_phy, event->phy_updated.rx_phy);
+
+        link = link_find(event->phy_updated.conn_handle, false);
+        if (link != NULL && event->phy_updated.status == 0) {
+            link->tx_phy = event->phy_updated.tx_phy;
+            link->rx_phy = event->phy_updated.rx_phy;
+        }
+        break;
+
+    /* Data length change event */
+    case BLE_GAP_EVENT_DATA_LEN_CHG:
+        ESP_LOGD(TAG, "data length event; conn_handle=%d tx=%d rx=%d",
+                 event->data_len_chg.conn_handle,
+                 event->data_len_chg.max_tx_octets,
+                 event->data_len_chg.max_rx_octets);
+
+        link = link_find(event->data_len_chg.conn_handle, false);
+        if (link != NULL) {
+            link->max_tx_octets = event->data_len_chg.max_tx_octets;
+            link->max_rx_octets = event->data_len_chg.max_rx_octets;
+        }
+        break;
     }
 
+    if (app_event_cb != NULL) {
+        rc = app_event_cb(event, app_event_arg);
+    }
     return rc;
 }
 
 
 /* Public functions */
-void adv_init(void) {
+/*
+ *  Pick the advertising address and encode the advertising and scan response
+ *  payloads into the controller. Call from the host sync callback, again
+ *  after a host reset, or whenever the payload content changes. Events for
+ *  connections made through advertising are passed on to cb.
+ */
+int adv_init(const struct ble_hs_adv_fields *adv_fields,
+             const struct ble_hs_adv_fields *rsp_fields, ble_gap_event_fn *cb,
+             void *cb_arg) {
     /* Local variables */
     int rc = 0;
     char addr_str[18] = {0};
 
+    app_event_cb = cb;
+    app_event_arg = cb_arg;
+
+    /* No connection survives a host reset */
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++) {
+        links[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    }
+
     /* Make sure we have proper BT identity address set (random preferred) */
     rc = ble_hs_util_ensure_addr(0);
     if (rc != 0) {
         ESP_LOGE(TAG, "device does not have any available bt address!");
-        return;
+        return rc;
     }
 
     /* Figure out BT address to use while advertising (no privacy for now) */
     rc = ble_hs_id_infer_auto(0, &own_addr_type);
     if (rc != 0) {
         ESP_LOGE(TAG, "failed to infer address type, error code: %d", rc);
-        return;
+        return rc;
     }
 
     /* Printing ADDR */
     rc = ble_hs_id_copy_addr(own_addr_type, addr_val, NULL);
     if (rc != 0) {
         ESP_LOGE(TAG, "failed to copy device address, error code: %d", rc);
-        return;
+        return rc;
     }
     format_addr(addr_str, addr_val);
     ESP_LOGI(TAG, "device address: %s", addr_str);
 
-    /* Start advertising. */
-    start_advertising();
+    /* Encode the payloads once */
+    rc = ble_hs_adv_set_fields(adv_fields, adv_data, &adv_data_len,
+                               sizeof(adv_data));
+    if (rc != 0) {
+        ESP_LOGE(TAG, "failed to encode advertising data, error code: %d", rc);
+        return rc;
+    }
+    rsp_data_len = 0;
+    if (rsp_fields != NULL) {
+        rc = ble_hs_adv_set_fields(rsp_fields, rsp_data, &rsp_data_len,
+                                   sizeof(rsp_data));
+        if (rc != 0) {
+            ESP_LOGE(TAG, "failed to encode scan response data, error code: %d",
+                     rc);
+            return rc;
+        }
+    }
+
+    /* Hand them to the controller, it keeps them across restarts */
+    rc = ble_gap_adv_set_data(adv_data, adv_data_len);
+    if (rc != 0) {
+        ESP_LOGE(TAG, "failed to set advertising data, error code: %d", rc);
+        return rc;
+    }
+    rc = ble_gap_adv_rsp_set_data(rsp_data, rsp_data_len);
+    if (rc != 0) {
+        ESP_LOGE(TAG, "failed to set scan response data, error code: %d", rc);
+        return rc;
+    }
+    return rc;
+}
+
+/* Advertise at the normal interval, no-op if already advertising */
+int adv_start(void) { return start_advertising(ADV_SLOW, NULL); }
+
+/* Advertise at the fast interval for a short burst, then at the normal one */
+int adv_start_fast(void) { return start_advertising(ADV_FAST, NULL); }
+
+/*
+ *  Set up pairing and bond storage in NVS. Call before the host starts.
+ *  Peers bond with Just Works pairing, whether the central starts it or
+ *  CONFIG_BLE_SECURITY_REQUEST asks for it.
+ */
+void bond_init(void) {
+    ble_hs_cfg.store_status_cb = bond_store_status;
+    ble_hs_cfg.sm_io_cap = BLE_HS_IO_NO_INPUT_OUTPUT;
+    ble_hs_cfg.sm_bonding = 1;
+    ble_hs_cfg.sm_sc = 1;
+    ble_hs_cfg.sm_our_key_dist =
+        BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID;
+    ble_hs_cfg.sm_their_key_dist =
+        BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID;
+
+    ble_store_config_init();
+    bond_cache_load();
+    ESP_LOGI(TAG, "%d bonded peer(s)", bond_count);
+}
+
+/* Negotiated link parameters of a connection, call from the host task */
+int gap_link_get(uint16_t conn_handle, gap_link_t *link) {
+    /* Local variables */
+    gap_link_t *found = link_find(conn_handle, false);
+
+    if (found == NULL) {
+        return BLE_HS_ENOTCONN;
+    }
+    *link = *found;
+    return 0;
+}
+
+/* Handles of the open connections, call from the host task */
+int gap_link_handles(uint16_t *handles, int max) {
+    /* Local variables */
+    int n = 0;
+
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS && n < max; i++) {
+        if (links[i].conn_handle != BLE_HS_CONN_HANDLE_NONE) {
+            handles[n++] = links[i].conn_handle;
+        }
+    }
+    return n;
+}
+
+/*
+ *  Count a write received on a connection, for tuning how many packets a
+ *  central gets into one connection event. Call on the NimBLE host task,
+ *  which owns the links table.
+ */
+void gap_link_rx(uint16_t conn_handle) {
+    /* Local variables */
+    gap_link_t *link = link_find(conn_handle, false);
+    int64_t now = esp_timer_get_time();
+    uint16_t bucket;
+
+    if (link == NULL) {
+        return;
+    }
+
+    link->rx_writes++;
+    if (link->rx_in_event == 0 ||
+        now - link->rx_event_us >= link->conn_itvl * 1250 / 2) {
+        /* First write of a new connection event */
+        link->rx_event_us = now;
+        link->rx_in_event = 0;
+        link->rx_events++;
+    } else {
+        /* Move the current event up one bucket */
+        bucket = link->rx_in_event - 1;
+        link->rx_per_event[bucket < GAP_LINK_RX_BUCKETS
+                               ? bucket
+                               : GAP_LINK_RX_BUCKETS - 1]--;
+    }
+
+    bucket = link->rx_in_event++;
+    link->rx_per_event[bucket < GAP_LINK_RX_BUCKETS ? bucket
+                                                    : GAP_LINK_RX_BUCKETS - 1]++;
+    if (link->rx_in_event > link->rx_max_per_event) {
+        link->rx_max_per_event = link->rx_in_event;
+    }
+}
+
+/* Snapshot of the GAP event counters, safe from any task */
+void gap_get_counters(gap_counters_t *counters) {
+    counters->connects =
+        atomic_load_explicit(&event_counters.connects, memory_order_relaxed);
+    counters->connect_failures = atomic_load_explicit(
+        &event_counters.connect_failures, memory_order_relaxed);
+    counters->disconnects =
+        atomic_load_explicit(&event_counters.disconnects, memory_order_relaxed);
+    counters->conn_updates = atomic_load_explicit(&event_counters.conn_updates,
+                                                  memory_order_relaxed);
+    counters->subscribes =
+        atomic_load_explicit(&event_counters.subscribes, memory_order_relaxed);
+    counters->notify_tx_errors = atomic_load_explicit(
+        &event_counters.notify_tx_errors, memory_order_relaxed);
+    counters->mtu_updates =
+        atomic_load_explicit(&event_counters.mtu_updates, memory_order_relaxed);
 }
 
 int gap_init(void) {
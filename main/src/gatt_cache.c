@@ -0,0 +1,293 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "gatt_cache.h"
+#include "common.h"
+#include "mbedtls/cmac.h"
+
+/* Defines */
+#define GATT_SVC_UUID 0x1801
+#define SVC_CHANGED_CHR_UUID 0x2A05
+#define CLIENT_FEATURES_CHR_UUID 0x2B29
+#define DB_HASH_CHR_UUID 0x2B2A
+
+/* Attribute types that take part in the hash */
+#define ATTR_PRIMARY_SERVICE 0x2800
+#define ATTR_SECONDARY_SERVICE 0x2801
+#define ATTR_CHARACTERISTIC 0x2803
+#define ATTR_USER_DESCRIPTION 0x2901
+#define ATTR_CLIENT_CONFIG 0x2902
+#define ATTR_AGGREGATE_FORMAT 0x2905
+
+#define CLIENT_FEAT_ROBUST_CACHING 0x01
+
+#define GATT_CACHE_NVS_NAMESPACE "gatt"
+#define GATT_CACHE_NVS_KEY "db_hash"
+
+/* Private function declarations */
+static int gatt_cache_chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                                 struct ble_gatt_access_ctxt *ctxt, void *arg);
+static void hash_begin(void);
+static void hash_attr(uint16_t handle, uint16_t type, const uint8_t *value,
+                      size_t len);
+static void hash_store(void);
+
+/* Private variables */
+static uint16_t svc_changed_val_handle;
+static uint16_t client_features_val_handle;
+static uint16_t db_hash_val_handle;
+
+/*
+ * The hash is fed attribute by attribute while NimBLE registers the
+ * database, which happens in handle order, and finished at host sync.
+ */
+static mbedtls_cipher_context_t hash_ctx;
+static bool hash_running;
+static bool hash_valid;
+static uint8_t db_hash[GATT_CACHE_HASH_SIZE];
+
+static const struct ble_gatt_svc_def gatt_cache_svcs[] = {
+    {.type = BLE_GATT_SVC_TYPE_PRIMARY,
+     .uuid = BLE_UUID16_DECLARE(GATT_SVC_UUID),
+     .characteristics =
+         (struct ble_gatt_chr_def[]){
+             {.uuid = BLE_UUID16_DECLARE(SVC_CHANGED_CHR_UUID),
+              .access_cb = gatt_cache_chr_access,
+              .flags = BLE_GATT_CHR_F_INDICATE,
+              .val_handle = &svc_changed_val_handle},
+             {.uuid = BLE_UUID16_DECLARE(CLIENT_FEATURES_CHR_UUID),
+              .access_cb = gatt_cache_chr_access,
+              .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+              .val_handle = &client_features_val_handle},
+             {.uuid = BLE_UUID16_DECLARE(DB_HASH_CHR_UUID),
+              .access_cb = gatt_cache_chr_access,
+              .flags = BLE_GATT_CHR_F_READ,
+              .val_handle = &db_hash_val_handle},
+             {
+                 0, /* No more characteristics in this service. */
+             }}},
+
+    {
+        0, /* No more services. */
+    },
+};
+
+/* Private functions */
+static int gatt_cache_chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                                 struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    /* Local variables */
+    static const uint8_t all_handles[4] = {0x01, 0x00, 0xFF, 0xFF};
+    uint8_t features = 0;
+    int rc;
+
+    /* Service Changed is only read by the stack to build its indication */
+    if (attr_handle == svc_changed_val_handle) {
+        rc = os_mbuf_append(ctxt->om, all_handles, sizeof(all_handles));
+        return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    if (attr_handle == db_hash_val_handle) {
+        if (!hash_valid) {
+            return BLE_ATT_ERR_UNLIKELY;
+        }
+        rc = os_mbuf_append(ctxt->om, db_hash, sizeof(db_hash));
+        return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+
+    if (attr_handle != client_features_val_handle) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    /*
+     * Robust caching would need Database Out Of Sync errors on every ATT
+     * request of a change-unaware client, discovery included, which never
+     * reaches an access callback. It is refused, so no client ever has a
+     * feature bit set and clients rely on Service Changed and the hash.
+     */
+    switch (ctxt->op) {
+    case BLE_GATT_ACCESS_OP_READ_CHR:
+        rc = os_mbuf_append(ctxt->om, &features, sizeof(features));
+        return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:
+        if (OS_MBUF_PKTLEN(ctxt->om) < 1) {
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+        os_mbuf_copydata(ctxt->om, 0, 1, &features);
+        if (features & CLIENT_FEAT_ROBUST_CACHING) {
+            return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+        }
+        return 0;
+
+    default:
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+/* Database Hash is AES-CMAC with an all-zero key, Core Vol 3 Part G 7.3 */
+static void hash_begin(void) {
+    /* Local variables */
+    static const uint8_t zero_key[16] = {0};
+
+    mbedtls_cipher_init(&hash_ctx);
+    mbedtls_cipher_setup(
+        &hash_ctx, mbedtls_cipher_info_from_type(MBEDTLS_CIPHER_AES_128_ECB));
+    mbedtls_cipher_cmac_starts(&hash_ctx, zero_key, 128);
+    hash_running = true;
+    hash_valid = false;
+}
+
+static void hash_attr(uint16_t handle, uint16_t type, const uint8_t *value,
+                      size_t len) {
+    /* Local variables */
+    uint8_t hdr[4] = {handle & 0xFF, handle >> 8, type & 0xFF, type >> 8};
+
+    mbedtls_cipher_cmac_update(&hash_ctx, hdr, sizeof(hdr));
+    if (len > 0) {
+        mbedtls_cipher_cmac_update(&hash_ctx, value, len);
+    }
+}
+
+/* Tell bonded centrals to rediscover when the database changed since boot */
+static void hash_store(void) {
+    /* Local variables */
+    esp_err_t err;
+    nvs_handle_t nvs;
+    uint8_t stored[GATT_CACHE_HASH_SIZE];
+    size_t len = sizeof(stored);
+
+    err = nvs_open(GATT_CACHE_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "failed to open NVS for the database hash, error: %d",
+                 err);
+        return;
+    }
+    err = nvs_get_blob(nvs, GATT_CACHE_NVS_KEY, stored, &len);
+    if (err == ESP_OK && len == sizeof(stored) &&
+        memcmp(stored, db_hash, sizeof(db_hash)) == 0) {
+        nvs_close(nvs);
+        return;
+    }
+
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "GATT database changed, indicating service changed");
+        ble_gatts_chr_updated(svc_changed_val_handle);
+    }
+    err = nvs_set_blob(nvs, GATT_CACHE_NVS_KEY, db_hash, sizeof(db_hash));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "failed to store the database hash, error: %d", err);
+    }
+}
+
+/* Public functions */
+/*
+ *  Add the Generic Attribute service and hook the database registration.
+ *  Call before nimble_port_freertos_init. The stack's own ble_svc_gatt
+ *  must not be initialized as well.
+ */
+int gatt_cache_init(void) {
+    /* Local variables */
+    int rc;
+
+    rc = ble_gatts_count_cfg(gatt_cache_svcs);
+    if (rc != 0) {
+        return rc;
+    }
+    rc = ble_gatts_add_svcs(gatt_cache_svcs);
+    if (rc != 0) {
+        return rc;
+    }
+
+    ble_hs_cfg.gatts_register_cb = gatt_cache_register_cb;
+    return 0;
+}
+
+/*
+ *  Registration callback, adds each attribute to the hash. Only types listed
+ *  by the spec count: service and characteristic declarations with their
+ *  values, and the handles and types of the standard descriptors. This
+ *  firmware has no included services.
+ */
+void gatt_cache_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg) {
+    /* Local variables */
+    uint8_t value[3 + 16];
+    const ble_uuid_t *uuid;
+    uint16_t flags;
+
+    if (!hash_running) {
+        hash_begin();
+    }
+
+    switch (ctxt->op) {
+    case BLE_GATT_REGISTER_OP_SVC:
+        uuid = ctxt->svc.svc_def->uuid;
+        ble_uuid_flat(uuid, value);
+        hash_attr(ctxt->svc.handle,
+                  ctxt->svc.svc_def->type == BLE_GATT_SVC_TYPE_PRIMARY
+                      ? ATTR_PRIMARY_SERVICE
+                      : ATTR_SECONDARY_SERVICE,
+                  value, ble_uuid_length(uuid));
+        break;
+
+    case BLE_GATT_REGISTER_OP_CHR:
+        uuid = ctxt->chr.chr_def->uuid;
+        flags = ctxt->chr.chr_def->flags;
+
+        /* The low property bits match the NimBLE flags one to one */
+        value[0] = flags & 0x7F;
+        if (flags & (BLE_GATT_CHR_F_RELIABLE_WRITE | BLE_GATT_CHR_F_AUX_WRITE)) {
+            value[0] |= 0x80;
+        }
+        value[1] = ctxt->chr.val_handle & 0xFF;
+        value[2] = ctxt->chr.val_handle >> 8;
+        ble_uuid_flat(uuid, &value[3]);
+        hash_attr(ctxt->chr.def_handle, ATTR_CHARACTERISTIC, value,
+                  3 + ble_uuid_length(uuid));
+
+        /* NimBLE places the CCCD right after the value */
+        if (flags & (BLE_GATT_CHR_F_NOTIFY | BLE_GATT_CHR_F_INDICATE)) {
+            hash_attr(ctxt->chr.val_handle + 1, ATTR_CLIENT_CONFIG, NULL, 0);
+        }
+        break;
+
+    case BLE_GATT_REGISTER_OP_DSC:
+        uuid = ctxt->dsc.dsc_def->uuid;
+        if (uuid->type == BLE_UUID_TYPE_16 &&
+            BLE_UUID16(uuid)->value >= ATTR_USER_DESCRIPTION &&
+            BLE_UUID16(uuid)->value <= ATTR_AGGREGATE_FORMAT) {
+            hash_attr(ctxt->dsc.handle, BLE_UUID16(uuid)->value, NULL, 0);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* Finish the hash once the database is registered, from the sync callback */
+void gatt_cache_start(void) {
+    /* Local variables */
+    uint8_t mac[GATT_CACHE_HASH_SIZE];
+
+    if (!hash_running) {
+        return;
+    }
+    mbedtls_cipher_cmac_finish(&hash_ctx, mac);
+    mbedtls_cipher_free(&hash_ctx);
+    hash_running = false;
+
+    /* The CMAC comes out most significant byte first, ATT is little endian */
+    for (int i = 0; i < GATT_CACHE_HASH_SIZE; i++) {
+        db_hash[i] = mac[GATT_CACHE_HASH_SIZE - 1 - i];
+    }
+    hash_valid = true;
+
+    ESP_LOGI(TAG, "GATT database hash %02x%02x%02x%02x...", mac[0], mac[1],
+             mac[2], mac[3]);
+    hash_store();
+}
@@ -4,28 +4,71 @@
  * SPDX-License-Identifier: Unlicense OR CC0-1.0
  */
 /* Includes */
+#define LOG_POLICY_MODULE GATT
+#include "log_policy.h"
+
 #include "gatt_svc.h"
 #include "common.h"
 #include "heart_rate.h"
 #include "led.h"
+#include <freertos/semphr.h>
+
+/* Defines */
+#define LED_FRAME_WRITE_MAX 512 /* longest attribute value ATT allows */
+
+/* Private types */
+typedef struct {
+    uint16_t conn_handle;
+    bool notify;
+    bool indicate;
+    bool ind_pending; /* indication sent, confirmation not yet received */
+    bool ind_stale;   /* a newer value is waiting for that confirmation */
+    uint32_t rr_next; /* first RR interval this connection was not sent */
+    uint32_t rr_ind;  /* rr_next once the pending indication is confirmed */
+} hr_subscriber_t;
 
 /* Private function declarations */
+static hr_subscriber_t *hr_subscriber_find(uint16_t conn_handle, bool add);
+static void hr_send(hr_subscriber_t *sub);
 static int heart_rate_chr_access(uint16_t conn_handle, uint16_t attr_handle,
                                  struct ble_gatt_access_ctxt *ctxt, void *arg);
 static int led_chr_access(uint16_t conn_handle, uint16_t attr_handle,
                           struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int led_frame_chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                                struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int led_stream_chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                                 struct ble_gatt_access_ctxt *ctxt, void *arg);
 
 /* Private variables */
 /* Heart rate service */
 static const ble_uuid16_t heart_rate_svc_uuid = BLE_UUID16_INIT(0x180D);
 
-static uint8_t heart_rate_chr_val[2] = {0};
+/* The value itself is encoded and published by heart_rate.c */
 static uint16_t heart_rate_chr_val_handle;
 static const ble_uuid16_t heart_rate_chr_uuid = BLE_UUID16_INIT(0x2A37);
 
-static uint16_t heart_rate_chr_conn_handle = 0;
-static bool heart_rate_chr_conn_handle_inited = false;
-static bool heart_rate_ind_status = false;
+/* One entry per connection subscribed to heart rate notifications */
+static hr_subscriber_t hr_subscribers[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+static heart_rate_tx_stats_t hr_tx_stats;
+
+/* Access and subscription counts, bumped on every event instead of logging */
+static struct {
+    _Atomic uint32_t hr_reads;
+    _Atomic uint32_t led_writes;
+    _Atomic uint32_t led_frames;
+    _Atomic uint32_t led_pixels;
+    _Atomic uint32_t led_stream_frames;
+    _Atomic uint32_t subscribes;
+    _Atomic uint32_t bad_access;
+} access_counters;
+
+/*
+ * The table is shared between the task producing heart rate values and the
+ * NimBLE host task reporting subscriptions and confirmations. It is
+ * recursive because a failed send reports NOTIFY_TX before returning.
+ */
+static StaticSemaphore_t hr_lock_buf;
+static SemaphoreHandle_t hr_lock;
 
 /* Automation IO service */
 static const ble_uuid16_t auto_io_svc_uuid = BLE_UUID16_INIT(0x1815);
@@ -34,6 +77,21 @@ static const ble_uuid128_t led_chr_uuid =
     BLE_UUID128_INIT(0x23, 0xd1, 0xbc, 0xea, 0x5f, 0x78, 0x23, 0x15, 0xde, 0xef,
                      0x12, 0x12, 0x25, 0x15, 0x00, 0x00);
 
+/* Packed multi-pixel updates, see led_frame.h for the format */
+static uint16_t led_frame_chr_val_handle;
+static const ble_uuid128_t led_frame_chr_uuid =
+    BLE_UUID128_INIT(0x23, 0xd1, 0xbc, 0xea, 0x5f, 0x78, 0x23, 0x15, 0xde, 0xef,
+                     0x12, 0x12, 0x27, 0x15, 0x00, 0x00);
+
+/* Streamed animation packets, see led_stream.h for the format */
+static uint16_t led_stream_chr_val_handle;
+static const ble_uuid128_t led_stream_chr_uuid =
+    BLE_UUID128_INIT(0x23, 0xd1, 0xbc, 0xea, 0x5f, 0x78, 0x23, 0x15, 0xde, 0xef,
+                     0x12, 0x12, 0x28, 0x15, 0x00, 0x00);
+
+/* Only the NimBLE host task writes characteristics */
+static uint8_t led_write_buf[LED_FRAME_WRITE_MAX];
+
 /* GATT services table */
 static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
     /* Heart rate service */
@@ -44,7 +102,8 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
              {/* Heart rate characteristic */
               .uuid = &heart_rate_chr_uuid.u,
               .access_cb = heart_rate_chr_access,
-              .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_INDICATE,
+              .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY |
+                       BLE_GATT_CHR_F_INDICATE,
               .val_handle = &heart_rate_chr_val_handle},
              {
                  0, /* No more characteristics in this service. */
@@ -55,12 +114,23 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
         .type = BLE_GATT_SVC_TYPE_PRIMARY,
         .uuid = &auto_io_svc_uuid.u,
         .characteristics =
-            (struct ble_gatt_chr_def[]){/* LED characteristic */
-                                        {.uuid = &led_chr_uuid.u,
-                                         .access_cb = led_chr_access,
-                                         .flags = BLE_GATT_CHR_F_WRITE,
-                                         .val_handle = &led_chr_val_handle},
-                                        {0}},
+            (struct ble_gatt_chr_def[]){
+                {/* LED characteristic */
+                 .uuid = &led_chr_uuid.u,
+                 .access_cb = led_chr_access,
+                 .flags = BLE_GATT_CHR_F_WRITE,
+                 .val_handle = &led_chr_val_handle},
+                {/* LED frame characteristic */
+                 .uuid = &led_frame_chr_uuid.u,
+                 .access_cb = led_frame_chr_access,
+                 .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP,
+                 .val_handle = &led_frame_chr_val_handle},
+                {/* LED stream characteristic */
+                 .uuid = &led_stream_chr_uuid.u,
+                 .access_cb = led_stream_chr_access,
+                 .flags = BLE_GATT_CHR_F_WRITE_NO_RSP,
+                 .val_handle = &led_stream_chr_val_handle},
+                {0}},
     },
 
     {
@@ -69,9 +139,72 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
 };
 
 /* Private functions */
+static hr_subscriber_t *hr_subscriber_find(uint16_t conn_handle, bool add) {
+    /* Local variables */
+    hr_subscriber_t *free_slot = NULL;
+
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++) {
+        if (hr_subscribers[i].conn_handle == conn_handle) {
+            return &hr_subscribers[i];
+        }
+        if (free_slot == NULL &&
+            hr_subscribers[i].conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+            free_slot = &hr_subscribers[i];
+        }
+    }
+    if (!add || free_slot == NULL) {
+        return NULL;
+    }
+    *free_slot = (hr_subscriber_t){.conn_handle = conn_handle,
+                                   .rr_next = heart_rate_rr_end()};
+    return free_slot;
+}
+
+/*
+ *  Send the latest measurement to one subscriber, with the RR intervals it
+ *  has not been sent yet. They only count as sent once NimBLE took the
+ *  notification or the central confirmed the indication, so intervals
+ *  survive coalesced and failed sends.
+ */
+static void hr_send(hr_subscriber_t *sub) {
+    /* Local variables */
+    uint8_t val[HEART_RATE_MEAS_MAX];
+    uint32_t rr_next = sub->rr_next;
+    struct os_mbuf *om;
+    int rc;
+
+    om = ble_hs_mbuf_from_flat(val, heart_rate_read_measurement(val, &rr_next));
+    if (om == NULL) {
+        hr_tx_stats.failed++;
+        return;
+    }
+
+    /* Each send consumes its mbuf */
+    if (sub->indicate) {
+        rc = ble_gatts_indicate_custom(sub->conn_handle,
+                                       heart_rate_chr_val_handle, om);
+        sub->ind_pending = rc == 0;
+        sub->ind_stale = false;
+        sub->rr_ind = rr_next;
+    } else {
+        rc = ble_gatts_notify_custom(sub->conn_handle,
+                                     heart_rate_chr_val_handle, om);
+    }
+
+    if (rc == 0) {
+        if (!sub->indicate) {
+            sub->rr_next = rr_next;
+        }
+        hr_tx_stats.sent++;
+    } else {
+        hr_tx_stats.failed++;
+    }
+}
+
 static int heart_rate_chr_access(uint16_t conn_handle, uint16_t attr_handle,
                                  struct ble_gatt_access_ctxt *ctxt, void *arg) {
     /* Local variables */
+    uint8_t val[HEART_RATE_MEAS_MAX];
     int rc;
 
     /* Handle access events */
@@ -80,21 +213,15 @@ static int heart_rate_chr_access(uint16_t conn_handle, uint16_t attr_handle,
 
     /* Read characteristic event */
     case BLE_GATT_ACCESS_OP_READ_CHR:
-        /* Verify connection handle */
-        if (conn_handle != BLE_HS_CONN_HANDLE_NONE) {
-            ESP_LOGI(TAG, "characteristic read; conn_handle=%d attr_handle=%d",
-                     conn_handle, attr_handle);
-        } else {
-            ESP_LOGI(TAG, "characteristic read by nimble stack; attr_handle=%d",
-                     attr_handle);
-        }
+        LOG_POLICY_COUNT(access_counters.hr_reads);
+        ESP_LOGD(TAG, "characteristic read; conn_handle=%d attr_handle=%d",
+                 conn_handle, attr_handle);
 
         /* Verify attribute handle */
         if (attr_handle == heart_rate_chr_val_handle) {
-            /* Update access buffer value */
-            heart_rate_chr_val[1] = get_heart_rate();
-            rc = os_mbuf_append(ctxt->om, &heart_rate_chr_val,
-                                sizeof(heart_rate_chr_val));
+            /* Reads get the latest rate, RR intervals go to subscribers */
+            rc = os_mbuf_append(ctxt->om, val,
+                                heart_rate_read_measurement(val, NULL));
             return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
         }
         goto error;
@@ -105,6 +232,7 @@ static int heart_rate_chr_access(uint16_t conn_handle, uint16_t attr_handle,
     }
 
 error:
+    LOG_POLICY_COUNT(access_counters.bad_access);
     ESP_LOGE(
         TAG,
         "unexpected access operation to heart rate characteristic, opcode: %d",
@@ -114,24 +242,15 @@ error:
 
 static int led_chr_access(uint16_t conn_handle, uint16_t attr_handle,
                           struct ble_gatt_access_ctxt *ctxt, void *arg) {
-    /* Local variables */
-    int rc;
-
     /* Handle access events */
     /* Note: LED characteristic is write only */
     switch (ctxt->op) {
 
     /* Write characteristic event */
     case BLE_GATT_ACCESS_OP_WRITE_CHR:
-        /* Verify connection handle */
-        if (conn_handle != BLE_HS_CONN_HANDLE_NONE) {
-            ESP_LOGI(TAG, "characteristic write; conn_handle=%d attr_handle=%d",
-                     conn_handle, attr_handle);
-        } else {
-            ESP_LOGI(TAG,
-                     "characteristic write by nimble stack; attr_handle=%d",
-                     attr_handle);
-        }
+        LOG_POLICY_COUNT(access_counters.led_writes);
+        ESP_LOGD(TAG, "characteristic write; conn_handle=%d attr_handle=%d",
+                 conn_handle, attr_handle);
 
         /* Verify attribute handle */
         if (attr_handle == led_chr_val_handle) {
@@ -140,15 +259,15 @@ static int led_chr_access(uint16_t conn_handle, uint16_t attr_handle,
                 /* Turn the LED on or off according to the operation bit */
                 if (ctxt->om->om_data[0]) {
                     led_on();
-                    ESP_LOGI(TAG, "led turned on!");
+                    ESP_LOGD(TAG, "led turned on");
                 } else {
                     led_off();
-                    ESP_LOGI(TAG, "led turned off!");
+                    ESP_LOGD(TAG, "led turned off");
                 }
             } else {
                 goto error;
             }
-            return rc;
+            return 0;
         }
         goto error;
 
@@ -158,19 +277,147 @@ static int led_chr_access(uint16_t conn_handle, uint16_t attr_handle,
     }
 
 error:
+    LOG_POLICY_COUNT(access_counters.bad_access);
     ESP_LOGE(TAG,
              "unexpected access operation to led characteristic, opcode: %d",
              ctxt->op);
     return BLE_ATT_ERR_UNLIKELY;
 }
 
+/*
+ *  A whole frame of pixel updates per write, applied with a single strip
+ *  refresh. A malformed frame is rejected without changing any pixel.
+ */
+static int led_frame_chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                                struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    /* Local variables */
+    uint16_t len;
+    int pixels;
+
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR ||
+        attr_handle != led_frame_chr_val_handle) {
+        LOG_POLICY_COUNT(access_counters.bad_access);
+        ESP_LOGE(TAG,
+                 "unexpected access operation to led frame characteristic, "
+                 "opcode: %d",
+                 ctxt->op);
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    if (ble_hs_mbuf_to_flat(ctxt->om, led_write_buf, sizeof(led_write_buf),
+                            &len) != 0) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    pixels = led_frame_write(led_write_buf, len);
+    if (pixels < 0) {
+        LOG_POLICY_COUNT(access_counters.bad_access);
+        return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+    }
+
+    LOG_POLICY_COUNT(access_counters.led_frames);
+    atomic_fetch_add_explicit(&access_counters.led_pixels, pixels,
+                              memory_order_relaxed);
+    ESP_LOGD(TAG, "led frame; conn_handle=%d len=%d pixels=%d", conn_handle,
+             len, pixels);
+    return 0;
+}
+
+/*
+ *  One packet of a streamed animation per write without response. Frames
+ *  show once their last packet arrives; a rejected packet only drops the
+ *  stream back to waiting for a keyframe, the central is not told.
+ */
+static int led_stream_chr_access(uint16_t conn_handle, uint16_t attr_handle,
+                                 struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    /* Local variables */
+    uint16_t len;
+    int rc;
+
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR ||
+        attr_handle != led_stream_chr_val_handle) {
+        LOG_POLICY_COUNT(access_counters.bad_access);
+        ESP_LOGE(TAG,
+                 "unexpected access operation to led stream characteristic, "
+                 "opcode: %d",
+                 ctxt->op);
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    if (ble_hs_mbuf_to_flat(ctxt->om, led_write_buf, sizeof(led_write_buf),
+                            &len) != 0) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    rc = led_stream_write(led_write_buf, len);
+    if (rc < 0) {
+        LOG_POLICY_COUNT(access_counters.bad_access);
+        return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+    }
+    if (rc > 0) {
+        LOG_POLICY_COUNT(access_counters.led_stream_frames);
+    }
+    return 0;
+}
+
 /* Public functions */
+/*
+ *  Send the latest published measurement to every subscriber, notified or
+ *  indicated as each one asked. The value fits the default ATT MTU; each
+ *  connection gets the rate with the RR intervals it has not been sent yet.
+ *  Each connection has one indication in flight at most; while it waits for
+ *  the confirmation newer values are coalesced and only the latest one is
+ *  indicated when the confirmation arrives, so one slow central does not
+ *  hold up the others. The RR intervals of coalesced values are carried by
+ *  that one.
+ */
 void send_heart_rate_indication(void) {
-    if (heart_rate_ind_status && heart_rate_chr_conn_handle_inited) {
-        ble_gatts_indicate(heart_rate_chr_conn_handle,
-                           heart_rate_chr_val_handle);
-        ESP_LOGI(TAG, "heart rate indication sent!");
+    /* Local variables */
+    hr_subscriber_t *sub;
+
+    xSemaphoreTakeRecursive(hr_lock, portMAX_DELAY);
+
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++) {
+        sub = &hr_subscribers[i];
+        if (sub->conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+            continue;
+        }
+        if (sub->indicate && sub->ind_pending) {
+            if (sub->ind_stale) {
+                hr_tx_stats.coalesced++;
+            }
+            sub->ind_stale = true;
+            continue;
+        }
+        hr_send(sub);
     }
+
+    xSemaphoreGiveRecursive(hr_lock);
+}
+
+/* Heart rate transmit counters, for diagnostics */
+void get_heart_rate_tx_stats(heart_rate_tx_stats_t *stats) {
+    xSemaphoreTakeRecursive(hr_lock, portMAX_DELAY);
+    *stats = hr_tx_stats;
+    xSemaphoreGiveRecursive(hr_lock);
+}
+
+/* Snapshot of the access counters, safe from any task */
+void gatt_svr_get_counters(gatt_svr_counters_t *counters) {
+    counters->hr_reads = atomic_load_explicit(&access_counters.hr_reads,
+                                              memory_order_relaxed);
+    counters->led_writes = atomic_load_explicit(&access_counters.led_writes,
+                                                memory_order_relaxed);
+    counters->led_frames = atomic_load_explicit(&access_counters.led_frames,
+                                                memory_order_relaxed);
+    counters->led_pixels = atomic_load_explicit(&access_counters.led_pixels,
+                                                memory_order_relaxed);
+    counters->led_stream_frames = atomic_load_explicit(
+        &access_counters.led_stream_frames, memory_order_relaxed);
+    counters->subscribes = atomic_load_explicit(&access_counters.subscribes,
+                                                memory_order_relaxed);
+    counters->bad_access = atomic_load_explicit(&access_counters.bad_access,
+                                                memory_order_relaxed);
 }
 
 /*
@@ -218,48 +465,95 @@ void gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg) {
 
 /*
  *  GATT server subscribe event callback
- *      1. Update heart rate subscription status
+ *      1. Update the heart rate subscriber table, an unsubscribe or a
+ *         disconnect frees the connection's entry
  */
 
 void gatt_svr_subscribe_cb(struct ble_gap_event *event) {
-    /* Check connection handle */
-    if (event->subscribe.conn_handle != BLE_HS_CONN_HANDLE_NONE) {
-        ESP_LOGI(TAG, "subscribe event; conn_handle=%d attr_handle=%d",
-                 event->subscribe.conn_handle, event->subscribe.attr_handle);
-    } else {
-        ESP_LOGI(TAG, "subscribe by nimble stack; attr_handle=%d",
-                 event->subscribe.attr_handle);
-    }
+    /* Local variables */
+    hr_subscriber_t *sub;
+
+    LOG_POLICY_COUNT(access_counters.subscribes);
+    ESP_LOGD(TAG, "subscribe event; conn_handle=%d attr_handle=%d",
+             event->subscribe.conn_handle, event->subscribe.attr_handle);
 
     /* Check attribute handle */
     if (event->subscribe.attr_handle == heart_rate_chr_val_handle) {
         /* Update heart rate subscription status */
-        heart_rate_chr_conn_handle = event->subscribe.conn_handle;
-        heart_rate_chr_conn_handle_inited = true;
-        heart_rate_ind_status = event->subscribe.cur_indicate;
+        xSemaphoreTakeRecursive(hr_lock, portMAX_DELAY);
+        sub = hr_subscriber_find(event->subscribe.conn_handle,
+                                 event->subscribe.cur_notify ||
+                                     event->subscribe.cur_indicate);
+        if (sub != NULL) {
+            if (!event->subscribe.cur_notify &&
+                !event->subscribe.cur_indicate) {
+                sub->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+            } else {
+                sub->notify = event->subscribe.cur_notify;
+                sub->indicate = event->subscribe.cur_indicate;
+            }
+        }
+        xSemaphoreGiveRecursive(hr_lock);
     }
 }
 
 /*
- *  GATT server initialization
- *      1. Initialize GATT service
- *      2. Update NimBLE host GATT services counter
- *      3. Add GATT services to server
+ *  GATT server notification sent callback
+ *      1. Return the connection's indication credit once the indication is
+ *         confirmed or has failed, a confirmation delivers its RR intervals
+ *      2. Indicate the latest value if one was coalesced meanwhile
+ */
+void gatt_svr_notify_tx_cb(struct ble_gap_event *event) {
+    /* Local variables */
+    hr_subscriber_t *sub;
+
+    /* Status 0 only reports that the indication went out */
+    if (!event->notify_tx.indication || event->notify_tx.status == 0 ||
+        event->notify_tx.attr_handle != heart_rate_chr_val_handle) {
+        return;
+    }
+
+    xSemaphoreTakeRecursive(hr_lock, portMAX_DELAY);
+    sub = hr_subscriber_find(event->notify_tx.conn_handle, false);
+    if (sub != NULL && sub->ind_pending) {
+        sub->ind_pending = false;
+        if (event->notify_tx.status == BLE_HS_EDONE) {
+            sub->rr_next = sub->rr_ind;
+        } else {
+            hr_tx_stats.failed++;
+        }
+        if (sub->ind_stale && sub->indicate) {
+            hr_send(sub);
+        }
+        sub->ind_stale = false;
+    }
+    xSemaphoreGiveRecursive(hr_lock);
+}
+
+/*
+ *  GATT server initialization, after gatt_cache_init, which provides the
+ *  Generic Attribute service
+ *      1. Update NimBLE host GATT services counter
+ *      2. Add GATT services to server
  */
 int gatt_svc_init(void) {
     /* Local variables */
     int rc;
 
-    /* 1. GATT service initialization */
-    ble_svc_gatt_init();
+    /* Start the heart rate pipeline, no subscribers yet */
+    heart_rate_init();
+    hr_lock = xSemaphoreCreateRecursiveMutexStatic(&hr_lock_buf);
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++) {
+        hr_subscribers[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    }
 
-    /* 2. Update GATT services counter */
+    /* 1. Update GATT services counter */
     rc = ble_gatts_count_cfg(gatt_svr_svcs);
     if (rc != 0) {
         return rc;
     }
 
-    /* 3. Add GATT services */
+    /* 2. Add GATT services */
     rc = ble_gatts_add_svcs(gatt_svr_svcs);
     if (rc != 0) {
         return rc;
@@ -0,0 +1,157 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "common.h"
+#include "heart_rate.h"
+#include "ppg.h"
+#include <stdatomic.h>
+
+/* Private function declarations */
+static bool heart_rate_pop_rr(uint16_t *rr);
+
+/* Private variables */
+static ppg_t ppg;
+static uint8_t heart_rate;
+
+/*
+ * Latest rate and the RR intervals measured so far, published under a
+ * sequence counter. The counter is odd while the value is being rewritten;
+ * readers on either core copy the value and retry if the counter moved
+ * meanwhile, so they never take a lock. The writer does not get preempted
+ * halfway, which would leave a reader on its core spinning.
+ *
+ * RR intervals are numbered from boot; the log keeps the last
+ * HEART_RATE_RR_LOG of them, so each subscriber can pick up from the first
+ * one it has not been sent yet.
+ */
+static struct {
+    _Atomic uint32_t seq;
+    uint8_t bpm;
+    uint32_t rr_end; /* number of the next RR interval */
+    uint16_t rr[HEART_RATE_RR_LOG];
+} measurement;
+static portMUX_TYPE measurement_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Private functions */
+/* Oldest RR interval not yet published, in 1/1024 s */
+static bool heart_rate_pop_rr(uint16_t *rr) {
+    /* Local variables */
+    uint16_t rr_ms;
+
+    if (!ppg_pop_rr(&ppg, &rr_ms)) {
+        return false;
+    }
+    *rr = ((uint32_t)rr_ms * 1024 + 500) / 1000;
+    return true;
+}
+
+/* Public functions */
+void heart_rate_init(void) { ppg_init(&ppg, CONFIG_PPG_SAMPLE_RATE_HZ); }
+
+/*
+ *  Feed a block of raw optical sensor samples, called by the sensor driver
+ *  at CONFIG_PPG_SAMPLE_RATE_HZ. Blocks of a few tens of samples keep the
+ *  per-call overhead low.
+ */
+void heart_rate_push_samples(const int32_t *samples, size_t count) {
+    ppg_process(&ppg, samples, count);
+}
+
+uint8_t get_heart_rate(void) { return heart_rate; }
+
+/*
+ *  Latch the averaged rate, 0 while no pulse is detected, and publish it
+ *  with the RR intervals measured since the last call. Only one task may
+ *  call this.
+ */
+void update_heart_rate(void) {
+    /* Local variables */
+    uint16_t bpm = ppg_bpm(&ppg);
+    uint16_t rr[HEART_RATE_RR_LOG];
+    uint32_t count = 0;
+    uint32_t end;
+    uint32_t seq;
+
+    heart_rate = bpm > UINT8_MAX ? UINT8_MAX : bpm;
+    while (count < HEART_RATE_RR_LOG && heart_rate_pop_rr(&rr[count])) {
+        count++;
+    }
+
+    portENTER_CRITICAL(&measurement_lock);
+    seq = atomic_load_explicit(&measurement.seq, memory_order_relaxed);
+    atomic_store_explicit(&measurement.seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    measurement.bpm = heart_rate;
+    end = measurement.rr_end;
+    for (uint32_t i = 0; i < count; i++) {
+        measurement.rr[end++ % HEART_RATE_RR_LOG] = rr[i];
+    }
+    measurement.rr_end = end;
+    atomic_store_explicit(&measurement.seq, seq + 2, memory_order_release);
+    portEXIT_CRITICAL(&measurement_lock);
+}
+
+/* Number of the next RR interval to be published, where a new reader starts */
+uint32_t heart_rate_rr_end(void) {
+    /* Local variables */
+    uint32_t seq;
+    uint32_t end;
+
+    do {
+        seq = atomic_load_explicit(&measurement.seq, memory_order_acquire);
+        end = measurement.rr_end;
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || atomic_load_explicit(&measurement.seq,
+                                               memory_order_relaxed) != seq);
+    return end;
+}
+
+/*
+ *  Encode the latest Heart Rate Measurement into buf, HEART_RATE_MEAS_MAX
+ *  bytes, with the RR intervals from number *rr_next on, up to
+ *  HEART_RATE_RR_MAX, and return its length. Intervals that already fell out
+ *  of the log are skipped. *rr_next is set past the last one included; the
+ *  caller keeps it only once the value is actually sent, so the rest wait
+ *  for the next measurement. Pass NULL for the rate alone. Safe from any
+ *  task on either core.
+ */
+uint16_t heart_rate_read_measurement(uint8_t *buf, uint32_t *rr_next) {
+    /* Local variables */
+    uint32_t seq;
+    uint32_t from;
+    uint32_t end;
+    uint16_t len;
+
+    for (;;) {
+        seq = atomic_load_explicit(&measurement.seq, memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+        buf[0] = HEART_RATE_FLAG_VALUE_U16;
+        buf[1] = measurement.bpm;
+        buf[2] = 0;
+        len = 3;
+        end = measurement.rr_end;
+        from = rr_next != NULL ? *rr_next : end;
+        if (end - from > HEART_RATE_RR_LOG) {
+            from = end - HEART_RATE_RR_LOG;
+        }
+        for (; from != end && len < HEART_RATE_MEAS_MAX; from++) {
+            buf[0] |= HEART_RATE_FLAG_RR_PRESENT;
+            buf[len++] = measurement.rr[from % HEART_RATE_RR_LOG] & 0xFF;
+            buf[len++] = measurement.rr[from % HEART_RATE_RR_LOG] >> 8;
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&measurement.seq, memory_order_relaxed) ==
+            seq) {
+            break;
+        }
+    }
+    if (rr_next != NULL) {
+        *rr_next = from;
+    }
+    return len;
+}
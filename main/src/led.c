@@ -6,9 +6,19 @@
 /* Includes */
 #include "led.h"
 #include "common.h"
+#include "led_frame.h"
+#include "led_stream.h"
+#include "trace.h"
+
+/* Private function declarations */
+static void led_frame_set(uint16_t index, uint8_t r, uint8_t g, uint8_t b,
+                          void *arg);
 
 /* Private variables */
 static uint8_t led_state;
+static led_frame_t led_frame;
+static led_stream_t led_stream;
+static uint8_t led_stream_pixels[LED_PIXELS][3];
 
 #ifdef CONFIG_BLINK_LED_STRIP
 static led_strip_handle_t led_strip;
@@ -17,14 +27,60 @@ static led_strip_handle_t led_strip;
 /* Public functions */
 uint8_t get_led_state(void) { return led_state; }
 
+/*
+ *  Apply a packed frame, see led_frame.h, and show it. Returns the number of
+ *  pixels set, or -1 for a malformed frame, which changes nothing.
+ */
+int led_frame_write(const uint8_t *buf, size_t len) {
+    /* Local variables */
+    int pixels = led_frame_apply(&led_frame, buf, len);
+
+#ifdef CONFIG_BLINK_LED_STRIP
+    if (pixels > 0) {
+        /* One refresh for the whole frame */
+        uint32_t start = trace_begin();
+        led_strip_refresh(led_strip);
+        trace_end(TRACE_LED_REFRESH, start, pixels);
+    }
+#endif
+    return pixels;
+}
+
+/*
+ *  Decode one packet of a streamed animation, see led_stream.h. A completed
+ *  frame goes to the strip with a single refresh. Returns 1 when a frame
+ *  was shown, 0 when more packets are due and -1 for a rejected packet.
+ */
+int led_stream_write(const uint8_t *buf, size_t len) {
+    /* Local variables */
+    int rc = led_stream_input(&led_stream, buf, len);
+
+#ifdef CONFIG_BLINK_LED_STRIP
+    if (rc > 0) {
+        uint32_t start = trace_begin();
+        led_strip_refresh(led_strip);
+        trace_end(TRACE_LED_REFRESH, start, led_stream.num_pixels);
+    }
+#endif
+    return rc;
+}
+
 #ifdef CONFIG_BLINK_LED_STRIP
 
+/* Frame pixels go straight into the strip driver's pixel buffer */
+static void led_frame_set(uint16_t index, uint8_t r, uint8_t g, uint8_t b,
+                          void *arg) {
+    led_strip_set_pixel(led_strip, index, r, g, b);
+}
+
 void led_on(void) {
     /* Set the LED pixel using RGB from 0 (0%) to 255 (100%) for each color */
     led_strip_set_pixel(led_strip, 0, 16, 16, 16);
 
     /* Refresh the strip to send data */
+    uint32_t start = trace_begin();
     led_strip_refresh(led_strip);
+    trace_end(TRACE_LED_REFRESH, start, 0);
 
     /* Update LED state */
     led_state = true;
@@ -43,7 +99,7 @@ void led_init(void) {
     /* LED strip initialization with the GPIO and pixels number*/
     led_strip_config_t strip_config = {
         .strip_gpio_num = CONFIG_BLINK_GPIO,
-        .max_leds = 1, // at least one LED on board
+        .max_leds = LED_PIXELS, // at least one LED on board
     };
 #if CONFIG_BLINK_LED_STRIP_BACKEND_RMT
     led_strip_rmt_config_t rmt_config = {
@@ -62,6 +118,10 @@ void led_init(void) {
 #else
 #error "unsupported LED strip backend"
 #endif
+    led_frame_init(&led_frame, LED_PIXELS, led_frame_set, NULL);
+    led_stream_init(&led_stream, led_stream_pixels, LED_PIXELS, led_frame_set,
+                    NULL);
+
     /* Set all LED off to clear all pixels */
     led_off();
 }
@@ -72,11 +132,20 @@ void led_on(void) { gpio_set_level(CONFIG_BLINK_GPIO, true); }
 
 void led_off(void) { gpio_set_level(CONFIG_BLINK_GPIO, false); }
 
+/* A single pixel, lit by any color other than black */
+static void led_frame_set(uint16_t index, uint8_t r, uint8_t g, uint8_t b,
+                          void *arg) {
+    gpio_set_level(CONFIG_BLINK_GPIO, (r | g | b) != 0);
+}
+
 void led_init(void) {
     ESP_LOGI(TAG, "example configured to blink gpio led!");
     gpio_reset_pin(CONFIG_BLINK_GPIO);
     /* Set the GPIO as a push/pull output */
     gpio_set_direction(CONFIG_BLINK_GPIO, GPIO_MODE_OUTPUT);
+    led_frame_init(&led_frame, LED_PIXELS, led_frame_set, NULL);
+    led_stream_init(&led_stream, led_stream_pixels, LED_PIXELS, led_frame_set,
+                    NULL);
 }
 
 #else
@@ -0,0 +1,124 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "led_frame.h"
+#include <stdbool.h>
+#include <string.h>
+
+/* Private function declarations */
+static int led_frame_parse(led_frame_t *frame, const uint8_t *buf, size_t len,
+                           bool apply);
+
+/* Private functions */
+static inline uint16_t get_u16(const uint8_t *p) {
+    return p[0] | (uint16_t)p[1] << 8;
+}
+
+/*
+ *  Walk the operations of a frame. Without apply it only checks them, so a
+ *  malformed frame is rejected before any pixel changes. Returns the number
+ *  of pixels set, or -1.
+ */
+static int led_frame_parse(led_frame_t *frame, const uint8_t *buf, size_t len,
+                           bool apply) {
+    /* Local variables */
+    const uint8_t *end = buf + len;
+    const uint8_t *c;
+    uint16_t first;
+    uint16_t n;
+    int pixels = 0;
+
+    while (buf < end) {
+        switch (*buf++) {
+        case LED_FRAME_OP_PALETTE:
+            if (end - buf < 4 || buf[0] >= LED_FRAME_PALETTE_SIZE) {
+                return -1;
+            }
+            if (apply) {
+                memcpy(frame->palette[buf[0]], buf + 1, 3);
+            }
+            buf += 4;
+            break;
+
+        case LED_FRAME_OP_RANGE:
+            if (end - buf < 3) {
+                return -1;
+            }
+            first = get_u16(buf);
+            n = buf[2];
+            buf += 3;
+            if ((size_t)(end - buf) < n * 3u ||
+                first + n > frame->num_pixels) {
+                return -1;
+            }
+            for (uint16_t i = 0; apply && i < n; i++) {
+                c = buf + i * 3;
+                frame->set(first + i, c[0], c[1], c[2], frame->arg);
+            }
+            buf += n * 3;
+            pixels += n;
+            break;
+
+        case LED_FRAME_OP_FILL:
+            if (end - buf < 7) {
+                return -1;
+            }
+            first = get_u16(buf);
+            n = get_u16(buf + 2);
+            if (first + n > frame->num_pixels) {
+                return -1;
+            }
+            for (uint16_t i = 0; apply && i < n; i++) {
+                frame->set(first + i, buf[4], buf[5], buf[6], frame->arg);
+            }
+            buf += 7;
+            pixels += n;
+            break;
+
+        case LED_FRAME_OP_INDEXED:
+            if (end - buf < 4) {
+                return -1;
+            }
+            first = get_u16(buf);
+            n = get_u16(buf + 2);
+            buf += 4;
+            if ((size_t)(end - buf) < (n + 1u) / 2 ||
+                first + n > frame->num_pixels) {
+                return -1;
+            }
+            for (uint16_t i = 0; apply && i < n; i++) {
+                c = frame->palette[(buf[i / 2] >> (i & 1) * 4) & 0x0F];
+                frame->set(first + i, c[0], c[1], c[2], frame->arg);
+            }
+            buf += (n + 1) / 2;
+            pixels += n;
+            break;
+
+        default:
+            return -1;
+        }
+    }
+    return pixels;
+}
+
+/* Public functions */
+void led_frame_init(led_frame_t *frame, uint16_t num_pixels,
+                    led_frame_set_fn *set, void *arg) {
+    memset(frame, 0, sizeof(*frame));
+    frame->num_pixels = num_pixels;
+    frame->set = set;
+    frame->arg = arg;
+}
+
+/*
+ *  Apply one frame through the set callback. A malformed frame, or one that
+ *  reaches past the last pixel, changes nothing and returns -1; otherwise
+ *  the number of pixels set is returned.
+ */
+int led_frame_apply(led_frame_t *frame, const uint8_t *buf, size_t len) {
+    if (led_frame_parse(frame, buf, len, false) < 0) {
+        return -1;
+    }
+    return led_frame_parse(frame, buf, len, true);
+}
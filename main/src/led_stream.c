@@ -0,0 +1,131 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "led_stream.h"
+#include <string.h>
+
+/* Private function declarations */
+static int led_stream_reject(led_stream_t *stream);
+static void led_stream_show(led_stream_t *stream);
+
+/* Private functions */
+/*
+ *  Frames are decoded in place, so a frame abandoned halfway leaves the
+ *  pixels matching neither frame and only a keyframe can follow.
+ */
+static int led_stream_reject(led_stream_t *stream) {
+    if (stream->in_frame) {
+        stream->in_frame = false;
+        stream->synced = false;
+    }
+    stream->rejected++;
+    return -1;
+}
+
+/* Hand the pixels that changed to the strip */
+static void led_stream_show(led_stream_t *stream) {
+    for (uint16_t i = stream->dirty_lo; i < stream->dirty_hi; i++) {
+        stream->set(i, stream->pixels[i][0], stream->pixels[i][1],
+                    stream->pixels[i][2], stream->arg);
+    }
+    stream->in_frame = false;
+    stream->synced = true;
+    stream->frames++;
+}
+
+/* Public functions */
+void led_stream_init(led_stream_t *stream, uint8_t (*pixels)[3],
+                     uint16_t num_pixels, led_frame_set_fn *set, void *arg) {
+    memset(stream, 0, sizeof(*stream));
+    memset(pixels, 0, num_pixels * sizeof(*pixels));
+    stream->num_pixels = num_pixels;
+    stream->pixels = pixels;
+    stream->set = set;
+    stream->arg = arg;
+}
+
+/*
+ *  Decode one packet. Returns 1 when it completed a frame, which was then
+ *  handed to the set callback, 0 when more packets are due and -1 when the
+ *  packet was rejected.
+ */
+int led_stream_input(led_stream_t *stream, const uint8_t *buf, size_t len) {
+    /* Local variables */
+    const uint8_t *end = buf + len;
+    const uint8_t *px;
+    uint8_t *dst;
+    uint8_t flags;
+    uint8_t frame;
+    uint16_t first;
+    uint16_t n;
+    size_t need;
+    bool run;
+
+    if (len < LED_STREAM_HDR_LEN) {
+        return led_stream_reject(stream);
+    }
+    flags = buf[0];
+    frame = buf[1];
+    first = buf[2] | (uint16_t)buf[3] << 8;
+    buf += LED_STREAM_HDR_LEN;
+
+    if (first == 0) {
+        /* A new frame, the one in progress never completed */
+        if (stream->in_frame) {
+            stream->in_frame = false;
+            stream->synced = false;
+        }
+        if (!(flags & LED_STREAM_KEY) &&
+            (!stream->synced || frame != (uint8_t)(stream->frame + 1))) {
+            return led_stream_reject(stream);
+        }
+        stream->in_frame = true;
+        stream->key = flags & LED_STREAM_KEY;
+        stream->frame = frame;
+        stream->pos = 0;
+        stream->dirty_lo = stream->key ? 0 : stream->num_pixels;
+        stream->dirty_hi = stream->key ? stream->num_pixels : 0;
+    } else if (!stream->in_frame || frame != stream->frame ||
+               first != stream->pos ||
+               stream->key != !!(flags & LED_STREAM_KEY)) {
+        return led_stream_reject(stream);
+    }
+
+    while (buf < end) {
+        run = *buf & 0x80;
+        n = (*buf & 0x7F) + 1;
+        need = run ? 3 : n * 3;
+        buf++;
+        if ((size_t)(end - buf) < need ||
+            stream->pos + n > stream->num_pixels) {
+            return led_stream_reject(stream);
+        }
+
+        for (uint16_t i = 0; i < n; i++, stream->pos++) {
+            px = run ? buf : buf + i * 3;
+            dst = stream->pixels[stream->pos];
+            if (stream->key) {
+                memcpy(dst, px, 3);
+            } else if (px[0] | px[1] | px[2]) {
+                dst[0] ^= px[0];
+                dst[1] ^= px[1];
+                dst[2] ^= px[2];
+                if (stream->pos < stream->dirty_lo) {
+                    stream->dirty_lo = stream->pos;
+                }
+                stream->dirty_hi = stream->pos + 1;
+            }
+        }
+        buf += need;
+    }
+
+    if (!(flags & LED_STREAM_END)) {
+        return 0;
+    }
+    if (stream->pos != stream->num_pixels) {
+        return led_stream_reject(stream);
+    }
+    led_stream_show(stream);
+    return 1;
+}
@@ -0,0 +1,128 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "lf_queue.h"
+#include <assert.h>
+
+/* Private function declarations */
+static void waiter_init(lf_waiter_t *w);
+static void waiter_wake(lf_waiter_t *w);
+static void waiter_sleep_begin(lf_waiter_t *w);
+static void waiter_sleep(lf_waiter_t *w, TickType_t timeout);
+
+/* Private functions */
+static void waiter_init(lf_waiter_t *w) {
+    atomic_store(&w->sleeping, false);
+    w->task = NULL;
+}
+
+/* Called by producers after an item has been published */
+static void waiter_wake(lf_waiter_t *w) {
+    /* Pairs with the fence in waiter_sleep_begin: either the consumer sees
+     * the new item or this sees the consumer asleep */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&w->sleeping, memory_order_relaxed) &&
+        atomic_exchange_explicit(&w->sleeping, false, memory_order_acquire)) {
+        xTaskNotifyGive(w->task);
+    }
+}
+
+/* Announce the consumer is about to sleep, the queue must be checked again */
+static void waiter_sleep_begin(lf_waiter_t *w) {
+    w->task = xTaskGetCurrentTaskHandle();
+    atomic_store_explicit(&w->sleeping, true, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+static void waiter_sleep(lf_waiter_t *w, TickType_t timeout) {
+    ulTaskNotifyTake(pdTRUE, timeout);
+    atomic_store_explicit(&w->sleeping, false, memory_order_relaxed);
+}
+
+/* Public functions */
+void lf_spsc_init(lf_spsc_t *q, void **slots, uint32_t len) {
+    assert(len >= 2 && (len & (len - 1)) == 0);
+
+    atomic_store(&q->head, 0);
+    atomic_store(&q->tail, 0);
+    q->tail_cache = 0;
+    q->head_cache = 0;
+    q->mask = len - 1;
+    q->slots = slots;
+    waiter_init(&q->waiter);
+}
+
+/* Producer side, returns false when the ring is full */
+bool lf_spsc_push(lf_spsc_t *q, void *item) {
+    /* Local variables */
+    uint32_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+    if (head - q->tail_cache > q->mask) {
+        q->tail_cache = atomic_load_explicit(&q->tail, memory_order_acquire);
+        if (head - q->tail_cache > q->mask) {
+            return false;
+        }
+    }
+
+    q->slots[head & q->mask] = item;
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    waiter_wake(&q->waiter);
+    return true;
+}
+
+/* Consumer side, returns NULL when the ring is empty */
+void *lf_spsc_pop(lf_spsc_t *q) {
+    /* Local variables */
+    uint32_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    void *item;
+
+    if (tail == q->head_cache) {
+        q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire);
+        if (tail == q->head_cache) {
+            return NULL;
+        }
+    }
+
+    item = q->slots[tail & q->mask];
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return item;
+}
+
+/*
+ *  Consumer side, sleeps on the task notification for up to timeout ticks.
+ *  A producer that saw the consumer asleep just before it found an item
+ *  still notifies it, so a wakeup can be stale and the wait goes on until
+ *  an item arrives or the timeout has passed.
+ */
+void *lf_spsc_pop_wait(lf_spsc_t *q, TickType_t timeout) {
+    /* Local variables */
+    void *item = lf_spsc_pop(q);
+    TickType_t start, waited = 0;
+
+    if (item != NULL) {
+        return item;
+    }
+    start = xTaskGetTickCount();
+
+    while (item == NULL && waited < timeout) {
+        waiter_sleep_begin(&q->waiter);
+        item = lf_spsc_pop(q);
+        if (item != NULL) {
+            atomic_store_explicit(&q->waiter.sleeping, false,
+                                  memory_order_relaxed);
+            break;
+        }
+        waiter_sleep(&q->waiter, timeout - waited);
+        item = lf_spsc_pop(q);
+        if (timeout != portMAX_DELAY) {
+            waited = xTaskGetTickCount() - start;
+        }
+    }
+    return item;
+}
+
+uint32_t lf_spsc_depth(lf_spsc_t *q) {
+    return atomic_load_explicit(&q->head, memory_order_acquire) -
+           atomic_load_explicit(&q->tail, memory_order_acquire);
+}
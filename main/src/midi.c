@@ -0,0 +1,270 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "midi.h"
+#include "esp_timer.h"
+
+/* Private function declarations */
+static size_t sysex_run(const uint8_t *buf, size_t i, size_t len);
+
+/* Private functions */
+/* Index of the first byte at or after i that has the high bit set */
+static size_t sysex_run(const uint8_t *buf, size_t i, size_t len) {
+    while (i < len && !(buf[i] & 0x80)) {
+        i++;
+    }
+    return i;
+}
+
+/* Public functions */
+uint8_t midi_msg_len(uint8_t status) {
+    switch (MIDI_STATUS_TYPE(status)) {
+    case MIDI_PROGRAM_CHANGE:
+    case MIDI_CHANNEL_PRESSURE:
+        return 2;
+    case 0xF0:
+        break;
+    default:
+        return 3;
+    }
+
+    /* System common and realtime messages */
+    switch (status) {
+    case 0xF1: /* MTC quarter frame */
+    case 0xF3: /* Song select */
+        return 2;
+    case 0xF2: /* Song position pointer */
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+uint32_t midi_now_ms(void) { return (uint32_t)(esp_timer_get_time() / 1000); }
+
+/* Current time as a BLE-MIDI timestamp */
+uint16_t midi_ble_now(void) { return midi_now_ms() & MIDI_BLE_TS_MASK; }
+
+void midi_parser_reset(midi_parser_t *parser) {
+    parser->running_status = 0;
+    parser->in_sysex = false;
+}
+
+/*
+ *  Decode one BLE-MIDI packet
+ *      - Packet header carries the upper 6 bits of the timestamp
+ *      - Every status byte is preceded by a timestamp byte
+ *      - Running status may omit the timestamp and/or status byte
+ *      - SysEx may span packets, continuation packets start with raw data
+ */
+int midi_ble_decode(midi_parser_t *parser, const uint8_t *buf, size_t len,
+                    midi_event_cb_t event_cb, midi_sysex_cb_t sysex_cb,
+                    void *arg) {
+    /* Local variables */
+    midi_event_t ev;
+    size_t i = 1;
+    size_t start;
+    uint16_t ts_high;
+    uint16_t ts = 0;
+    uint8_t ts_low = 0;
+    uint8_t prev_low = 0;
+    uint8_t status;
+    uint8_t need;
+    bool have_low = false;
+
+    /* Verify packet header */
+    if (len < 2 || (buf[0] & 0xC0) != 0x80) {
+        return MIDI_ERR_HEADER;
+    }
+    ts_high = (uint16_t)(buf[0] & 0x3F) << 7;
+
+    while (i < len) {
+        if (buf[i] & 0x80) {
+            /* Timestamp byte, the high part wraps when the low part does */
+            ts_low = buf[i] & 0x7F;
+            if (have_low && ts_low < prev_low) {
+                ts_high = (ts_high + 0x80) & MIDI_BLE_TS_MASK;
+            }
+            prev_low = ts_low;
+            have_low = true;
+            ts = ts_high | ts_low;
+
+            if (++i >= len) {
+                return MIDI_ERR_TRUNCATED;
+            }
+            if (!(buf[i] & 0x80)) {
+                goto running;
+            }
+            status = buf[i++];
+
+            /* Inside SysEx only realtime messages and the end marker are
+             * allowed, anything else cancels the transfer */
+            if (parser->in_sysex) {
+                if (status == MIDI_SYSEX_END) {
+                    parser->in_sysex = false;
+                    if (sysex_cb) {
+                        sysex_cb(&buf[i - 1], 1, MIDI_SYSEX_F_END, arg);
+                    }
+                    continue;
+                }
+                if (!MIDI_IS_REALTIME(status)) {
+                    parser->in_sysex = false;
+                    if (sysex_cb) {
+                        sysex_cb(NULL, 0, MIDI_SYSEX_F_ABORT, arg);
+                    }
+                }
+            }
+
+            if (status == MIDI_SYSEX_START) {
+                start = i - 1;
+                i = sysex_run(buf, i, len);
+                parser->in_sysex = true;
+                parser->running_status = 0;
+                if (sysex_cb) {
+                    sysex_cb(&buf[start], i - start, MIDI_SYSEX_F_START, arg);
+                }
+                continue;
+            }
+            if (status == MIDI_SYSEX_END) {
+                /* Stray end marker */
+                continue;
+            }
+            goto message;
+        }
+
+    running:
+        /* Data byte: SysEx payload or a running status message */
+        if (parser->in_sysex) {
+            start = i;
+            i = sysex_run(buf, i, len);
+            if (sysex_cb) {
+                sysex_cb(&buf[start], i - start, 0, arg);
+            }
+            continue;
+        }
+        status = parser->running_status;
+        if (status == 0) {
+            return MIDI_ERR_UNEXPECTED_DATA;
+        }
+
+    message:
+        need = midi_msg_len(status) - 1;
+        if (len - i < need) {
+            return MIDI_ERR_TRUNCATED;
+        }
+        ev.data[0] = status;
+        for (uint8_t k = 0; k < need; k++) {
+            if (buf[i] & 0x80) {
+                return MIDI_ERR_UNEXPECTED_DATA;
+            }
+            ev.data[1 + k] = buf[i++];
+        }
+        ev.len = need + 1;
+        ev.timestamp = ts;
+
+        /* Realtime messages leave running status untouched, system common
+         * messages cancel it */
+        if (MIDI_IS_CHANNEL_MSG(status)) {
+            parser->running_status = status;
+        } else if (!MIDI_IS_REALTIME(status)) {
+            parser->running_status = 0;
+        }
+
+        if (event_cb) {
+            event_cb(&ev, arg);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ *  Outbound packets use a single timestamp for every message they carry,
+ *  which keeps the encoding to one header byte plus one timestamp byte per
+ *  status change.
+ */
+void midi_packet_init(midi_packet_t *pkt, uint8_t *buf, uint16_t cap,
+                      uint16_t timestamp) {
+    pkt->buf = buf;
+    pkt->cap = cap;
+    pkt->buf[0] = 0x80 | ((timestamp >> 7) & 0x3F);
+    pkt->len = 1;
+    pkt->ts_low = 0x80 | (timestamp & 0x7F);
+    pkt->running_status = 0;
+    pkt->in_sysex = false;
+}
+
+bool midi_packet_empty(const midi_packet_t *pkt) { return pkt->len <= 1; }
+
+bool midi_packet_append(midi_packet_t *pkt, const midi_event_t *ev) {
+    /* Local variables */
+    uint8_t status = ev->data[0];
+    bool running;
+    uint16_t need;
+
+    /* Only realtime messages may interleave with an open SysEx */
+    if (pkt->in_sysex && !MIDI_IS_REALTIME(status)) {
+        return false;
+    }
+
+    running = MIDI_IS_CHANNEL_MSG(status) && status == pkt->running_status;
+    need = running ? ev->len - 1 : ev->len + 1;
+    if (pkt->len + need > pkt->cap) {
+        return false;
+    }
+
+    if (!running) {
+        pkt->buf[pkt->len++] = pkt->ts_low;
+        pkt->buf[pkt->len++] = status;
+    }
+    for (uint8_t k = 1; k < ev->len; k++) {
+        pkt->buf[pkt->len++] = ev->data[k];
+    }
+
+    if (MIDI_IS_CHANNEL_MSG(status)) {
+        pkt->running_status = status;
+    } else if (!MIDI_IS_REALTIME(status)) {
+        pkt->running_status = 0;
+    }
+    return true;
+}
+
+/*
+ *  Append as much of a SysEx chunk as fits and return the number of bytes
+ *  consumed. A chunk that does not start with 0xF0 continues a transfer and
+ *  is only accepted at the start of a packet or right after SysEx data.
+ */
+size_t midi_packet_append_sysex(midi_packet_t *pkt, const uint8_t *data,
+                                size_t len) {
+    /* Local variables */
+    size_t n = 0;
+    uint8_t b;
+
+    if (len > 0 && data[0] != MIDI_SYSEX_START && !pkt->in_sysex &&
+        !midi_packet_empty(pkt)) {
+        return 0;
+    }
+
+    while (n < len) {
+        b = data[n];
+        if (b == MIDI_SYSEX_START || b == MIDI_SYSEX_END) {
+            /* Start and end markers need their own timestamp byte */
+            if (pkt->len + 2 > pkt->cap) {
+                break;
+            }
+            pkt->buf[pkt->len++] = pkt->ts_low;
+            pkt->buf[pkt->len++] = b;
+            pkt->in_sysex = (b == MIDI_SYSEX_START);
+            pkt->running_status = 0;
+        } else {
+            if (pkt->len + 1 > pkt->cap) {
+                break;
+            }
+            pkt->buf[pkt->len++] = b;
+            pkt->in_sysex = true;
+        }
+        n++;
+    }
+    return n;
+}
@@ -0,0 +1,368 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "midi_curve.h"
+#include "common.h"
+#include "nvs.h"
+#include <math.h>
+#include <stdatomic.h>
+
+/* Defines */
+#define CURVE_NVS_NAMESPACE "midi"
+#define CURVE_NVS_KEY "curves"
+#define CURVE_TASK_STACK 3072
+#define CURVE_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+#define CURVE_GRACE_POLL_TICKS 1
+
+/* Private types */
+/* Lookup tables of every channel, indexed by the incoming 7-bit value */
+typedef struct {
+    uint8_t velocity[16][128];
+    uint8_t cc[16][128];
+} curve_table_t;
+
+/* Private function declarations */
+static bool spec_valid(const midi_curve_spec_t *spec);
+static float curve_eval(const midi_curve_spec_t *spec, float x);
+static float breakpoints_eval(const midi_curve_spec_t *spec, float x);
+static void curve_build(const midi_curve_spec_t *spec, uint8_t *lut,
+                        bool velocity);
+static void curve_table_build(curve_table_t *table,
+                              midi_curve_spec_t specs[16][MIDI_CURVE_TARGETS]);
+static void curve_load(void);
+static void curve_save(midi_curve_spec_t specs[16][MIDI_CURVE_TARGETS]);
+static void curve_wait_readers(void);
+static void curve_task(void *param);
+
+/* Private variables */
+/*
+ * The event path reads whichever table is published while the rebuild task
+ * fills the other one. The only reader, the MIDI task, makes reader_seq odd
+ * for the duration of each lookup, so before the rebuild task writes into
+ * the retired table it can wait for a lookup that may still hold it.
+ */
+static curve_table_t tables[2];
+static _Atomic(const curve_table_t *) active_table;
+static _Atomic uint32_t reader_seq;
+
+static midi_curve_spec_t curve_specs[16][MIDI_CURVE_TARGETS];
+static portMUX_TYPE curve_specs_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t curve_task_handle;
+
+/* Bank select, data entry and (N)RPN controllers keep their raw values */
+static const uint32_t cc_curved[4] = {
+    0xFFFFFFBE, /* 0-31: all but 0 and 6 */
+    0xFFFFFFBE, /* 32-63: all but 32 and 38 */
+    0xFFFFFFFF, /* 64-95 */
+    0x00FFFFC0, /* 96-127: none of 96-101 and channel mode 120-127 */
+};
+
+/* Private functions */
+static bool spec_valid(const midi_curve_spec_t *spec) {
+    if (spec->type >= MIDI_CURVE_TYPES || spec->amount > 127 ||
+        spec->num_points > MIDI_CURVE_MAX_POINTS) {
+        return false;
+    }
+    for (int i = 0; i < spec->num_points; i++) {
+        if (spec->points[i][0] > 127 || spec->points[i][1] > 127) {
+            return false;
+        }
+        if (i > 0 && spec->points[i][0] <= spec->points[i - 1][0]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Linear interpolation, (0, 0) and (127, 127) close the curve unless given */
+static float breakpoints_eval(const midi_curve_spec_t *spec, float x) {
+    /* Local variables */
+    float x0 = 0, y0 = 0, x1, y1;
+
+    for (int i = 0; i <= spec->num_points; i++) {
+        if (i < spec->num_points) {
+            x1 = spec->points[i][0];
+            y1 = spec->points[i][1];
+        } else {
+            x1 = 127;
+            y1 = 127;
+        }
+        if (x <= x1) {
+            return x1 > x0 ? y0 + (y1 - y0) * (x - x0) / (x1 - x0) : y1;
+        }
+        x0 = x1;
+        y0 = y1;
+    }
+    return y0;
+}
+
+/* Maps an input of 0..127 to an output of 0..127 */
+static float curve_eval(const midi_curve_spec_t *spec, float x) {
+    /* Local variables */
+    float k = spec->amount / 16.0f;
+    float u = x / 127.0f;
+
+    if (spec->type == MIDI_CURVE_BREAKPOINTS) {
+        return breakpoints_eval(spec, x);
+    }
+    if (spec->amount == 0) {
+        return x;
+    }
+
+    switch (spec->type) {
+    case MIDI_CURVE_EXP:
+        return 127.0f * (expf(k * u) - 1.0f) / (expf(k) - 1.0f);
+    case MIDI_CURVE_LOG:
+        return 127.0f * logf(1.0f + (expf(k) - 1.0f) * u) / k;
+    case MIDI_CURVE_S:
+        return 127.0f *
+               (0.5f + 0.5f * tanhf(k * (u - 0.5f)) / tanhf(k * 0.5f));
+    default:
+        return x;
+    }
+}
+
+static void curve_build(const midi_curve_spec_t *spec, uint8_t *lut,
+                        bool velocity) {
+    /* Local variables */
+    int y;
+
+    for (int x = 0; x < 128; x++) {
+        y = (int)lroundf(curve_eval(spec, x));
+        y = y < 0 ? 0 : y > 127 ? 127 : y;
+        /* Velocity 0 is a note-off and no other velocity may become one */
+        if (velocity) {
+            y = x == 0 ? 0 : y < 1 ? 1 : y;
+        }
+        lut[x] = y;
+    }
+}
+
+static void curve_table_build(curve_table_t *table,
+                              midi_curve_spec_t specs[16][MIDI_CURVE_TARGETS]) {
+    for (int ch = 0; ch < 16; ch++) {
+        curve_build(&specs[ch][MIDI_CURVE_VELOCITY], table->velocity[ch], true);
+        curve_build(&specs[ch][MIDI_CURVE_CC], table->cc[ch], false);
+    }
+}
+
+static void curve_load(void) {
+    /* Local variables */
+    static midi_curve_spec_t stored[16][MIDI_CURVE_TARGETS];
+    nvs_handle_t nvs;
+    size_t len = sizeof(stored);
+    esp_err_t err;
+
+    memset(curve_specs, 0, sizeof(curve_specs));
+
+    err = nvs_open(CURVE_NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        return;
+    }
+    err = nvs_get_blob(nvs, CURVE_NVS_KEY, stored, &len);
+    nvs_close(nvs);
+    if (err != ESP_OK || len != sizeof(stored)) {
+        return;
+    }
+
+    for (int ch = 0; ch < 16; ch++) {
+        for (int t = 0; t < MIDI_CURVE_TARGETS; t++) {
+            if (!spec_valid(&stored[ch][t])) {
+                ESP_LOGW(TAG, "ignoring invalid MIDI curves in NVS");
+                return;
+            }
+        }
+    }
+    memcpy(curve_specs, stored, sizeof(curve_specs));
+    ESP_LOGI(TAG, "using MIDI curves from NVS");
+}
+
+static void curve_save(midi_curve_spec_t specs[16][MIDI_CURVE_TARGETS]) {
+    /* Local variables */
+    nvs_handle_t nvs;
+    esp_err_t err;
+
+    err = nvs_open(CURVE_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "failed to open NVS for MIDI curves, error: %d", err);
+        return;
+    }
+    err = nvs_set_blob(nvs, CURVE_NVS_KEY, specs,
+                       sizeof(midi_curve_spec_t) * 16 * MIDI_CURVE_TARGETS);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "failed to store MIDI curves, error: %d", err);
+    }
+}
+
+/*
+ *  Grace period before the retired table is written again. The table was
+ *  retired by the last publish, so only a lookup already running then can
+ *  still use it; once reader_seq moves on, every later lookup loads the
+ *  table published since. Both sides use sequentially consistent accesses
+ *  so the reader cannot miss the publish while this misses the lookup.
+ */
+static void curve_wait_readers(void) {
+    /* Local variables */
+    uint32_t seq = atomic_load(&reader_seq);
+
+    while ((seq & 1) && atomic_load(&reader_seq) == seq) {
+        vTaskDelay(CURVE_GRACE_POLL_TICKS);
+    }
+}
+
+/*
+ *  Rebuilds the tables whenever curves change, away from the BLE host task.
+ *  Requests arriving during a rebuild are folded into one more pass.
+ */
+static void curve_task(void *param) {
+    /* Local variables */
+    static midi_curve_spec_t specs[16][MIDI_CURVE_TARGETS];
+    curve_table_t *next;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        portENTER_CRITICAL(&curve_specs_lock);
+        memcpy(specs, curve_specs, sizeof(specs));
+        portEXIT_CRITICAL(&curve_specs_lock);
+
+        next = atomic_load(&active_table) == &tables[0] ? &tables[1]
+                                                         : &tables[0];
+        curve_wait_readers();
+        curve_table_build(next, specs);
+        atomic_store(&active_table, next);
+
+        curve_save(specs);
+    }
+}
+
+/* Public functions */
+/*
+ *  Curve initialization
+ *      - Load the curves stored in NVS, all channels are linear otherwise
+ *      - Build and publish the first table before any event arrives
+ *      - Start the task that rebuilds tables when curves change
+ */
+void midi_curve_init(void) {
+    curve_load();
+    curve_table_build(&tables[0], curve_specs);
+    atomic_store(&active_table, &tables[0]);
+
+    if (xTaskCreate(curve_task, "midi_curve", CURVE_TASK_STACK, NULL,
+                    CURVE_TASK_PRIORITY, &curve_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "failed to start MIDI curve task");
+        curve_task_handle = NULL;
+    }
+}
+
+/*
+ *  One table lookup per note-on velocity or controller value. Only the MIDI
+ *  task may call this, reader_seq has a single writer.
+ */
+void midi_curve_apply(midi_event_t *ev) {
+    /* Local variables */
+    uint32_t seq = atomic_load_explicit(&reader_seq, memory_order_relaxed);
+    const curve_table_t *table;
+    uint8_t ch = MIDI_STATUS_CHANNEL(ev->data[0]);
+    uint8_t cc;
+
+    atomic_store(&reader_seq, seq + 1);
+    table = atomic_load(&active_table);
+
+    switch (MIDI_STATUS_TYPE(ev->data[0])) {
+    case MIDI_NOTE_ON:
+        ev->data[2] = table->velocity[ch][ev->data[2]];
+        break;
+    case MIDI_CONTROL_CHANGE:
+        cc = ev->data[1];
+        if (cc_curved[cc >> 5] & (1u << (cc & 31))) {
+            ev->data[2] = table->cc[ch][ev->data[2]];
+        }
+        break;
+    default:
+        break;
+    }
+    atomic_store_explicit(&reader_seq, seq + 2, memory_order_release);
+}
+
+/*
+ *  Select the curve of one channel, or of every channel with
+ *  MIDI_CURVE_ALL_CHANNELS. The event path keeps using the current table
+ *  until the rebuilt one is published, which also stores the curves in NVS.
+ */
+int midi_curve_set(uint8_t ch, midi_curve_target_t target,
+                   const midi_curve_spec_t *spec) {
+    if ((ch >= 16 && ch != MIDI_CURVE_ALL_CHANNELS) ||
+        target >= MIDI_CURVE_TARGETS || !spec_valid(spec)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (curve_task_handle == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    portENTER_CRITICAL(&curve_specs_lock);
+    for (int i = 0; i < 16; i++) {
+        if (ch == MIDI_CURVE_ALL_CHANNELS || ch == i) {
+            curve_specs[i][target] = *spec;
+        }
+    }
+    portEXIT_CRITICAL(&curve_specs_lock);
+
+    xTaskNotifyGive(curve_task_handle);
+    return ESP_OK;
+}
+
+/*
+ *  Handle a complete SysEx message, F0 through F7. Returns true when the
+ *  message was a curve command and must not be passed on.
+ */
+bool midi_curve_handle_sysex(const uint8_t *data, size_t len) {
+    /* Local variables */
+    midi_curve_spec_t spec = {0};
+    size_t num_points;
+    int rc;
+
+    if (len < 5 || data[1] != MIDI_CURVE_SYSEX_ID ||
+        data[2] != MIDI_CURVE_SYSEX_DEVICE) {
+        return false;
+    }
+
+    switch (data[3]) {
+    case MIDI_CURVE_SYSEX_SET:
+        /* F0 7D 01 01 ch target type amount (x y)* F7 */
+        if (len < 9 || (len - 9) % 2 != 0) {
+            ESP_LOGW(TAG, "malformed MIDI curve SysEx, len=%d", (int)len);
+            return true;
+        }
+        num_points = (len - 9) / 2;
+        if (num_points > MIDI_CURVE_MAX_POINTS) {
+            ESP_LOGW(TAG, "too many MIDI curve points: %d", (int)num_points);
+            return true;
+        }
+        spec.type = data[6];
+        spec.amount = data[7];
+        spec.num_points = num_points;
+        memcpy(spec.points, &data[8], num_points * 2);
+        rc = midi_curve_set(data[4], data[5], &spec);
+        break;
+    case MIDI_CURVE_SYSEX_RESET:
+        rc = midi_curve_set(MIDI_CURVE_ALL_CHANNELS, MIDI_CURVE_VELOCITY, &spec);
+        if (rc == ESP_OK) {
+            rc = midi_curve_set(MIDI_CURVE_ALL_CHANNELS, MIDI_CURVE_CC, &spec);
+        }
+        break;
+    default:
+        ESP_LOGW(TAG, "unknown MIDI curve command 0x%02x", data[3]);
+        return true;
+    }
+
+    if (rc != ESP_OK) {
+        ESP_LOGW(TAG, "MIDI curve SysEx rejected, error: %d", rc);
+    }
+    return true;
+}
@@ -0,0 +1,339 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "midi_merge.h"
+#include "midi_curve.h"
+#include "midi_route.h"
+#include "midi_stats.h"
+#include "common.h"
+#include "esp_cpu.h"
+
+/* Defines */
+#if CONFIG_MIDI_THIN_DROP_REPEATS
+#define THIN_DROP_REPEATS true
+#else
+#define THIN_DROP_REPEATS false
+#endif
+
+/* Private types */
+/* Every connected central is both a source and a potential destination */
+typedef struct {
+    bool used;
+    uint16_t conn_handle;
+    uint32_t routes; /* destination slot mask */
+    midi_parser_t parser;
+    bool sysex_overflow;
+    uint16_t sysex_len;
+    midi_merge_src_stats_t stats;
+    uint32_t notes[16][4]; /* notes forwarded and not yet released */
+    midi_thin_t thin;
+    uint8_t sysex[CONFIG_MIDI_SYSEX_MAX];
+} merge_peer_t;
+
+/* Private function declarations */
+static uint32_t default_routes(uint8_t slot);
+static void merge_fan_out(const midi_event_t *ev, void *arg);
+static void merge_on_event(const midi_event_t *ev, void *arg);
+static void notes_track(merge_peer_t *peer, const midi_event_t *ev);
+static void notes_release(merge_peer_t *peer);
+static void merge_on_sysex(const uint8_t *data, size_t len, uint8_t flags,
+                           void *arg);
+
+/* Private variables */
+static merge_peer_t peers[MIDI_MAX_PEERS];
+static midi_event_cb_t local_event_cb;
+static midi_merge_sysex_cb_t local_sysex_cb;
+static void *local_event_arg;
+static uint32_t merge_now_ms;
+
+/* Private functions */
+static uint32_t default_routes(uint8_t slot) {
+    /* Local variables */
+    uint32_t all = (1u << MIDI_MAX_PEERS) - 1;
+
+#if CONFIG_MIDI_THRU_ECHO
+    return all;
+#else
+    return all & ~(1u << slot);
+#endif
+}
+
+/* Output of a peer's thinning stage */
+static void merge_fan_out(const midi_event_t *ev, void *arg) {
+    /* Local variables */
+    merge_peer_t *peer = arg;
+    uint32_t routes = peer->routes;
+
+    while (routes) {
+        uint8_t slot = __builtin_ctz(routes);
+        routes &= routes - 1;
+        midi_out_push(slot, ev);
+    }
+}
+
+/* Keep the held notes of a source up to date with what it forwarded */
+static void notes_track(merge_peer_t *peer, const midi_event_t *ev) {
+    /* Local variables */
+    uint8_t status = ev->data[0];
+    uint8_t ch = MIDI_STATUS_CHANNEL(status);
+    uint32_t bit = 1u << (ev->data[1] & 31);
+    uint32_t *word = &peer->notes[ch][ev->data[1] >> 5];
+
+    if (status == MIDI_SYSTEM_RESET) {
+        memset(peer->notes, 0, sizeof(peer->notes));
+        return;
+    }
+    switch (MIDI_STATUS_TYPE(status)) {
+    case MIDI_NOTE_ON:
+        if (ev->data[2] != 0) {
+            *word |= bit;
+        } else {
+            *word &= ~bit;
+        }
+        break;
+    case MIDI_NOTE_OFF:
+        *word &= ~bit;
+        break;
+    case MIDI_CONTROL_CHANGE:
+        /* All sound off, all notes off and the mode messages */
+        if (ev->data[1] == 120 || ev->data[1] >= 123) {
+            memset(peer->notes[ch], 0, sizeof(peer->notes[ch]));
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ *  Send a note off for every note a source left held, so its destinations
+ *  and the local consumer are not left with hung notes when it goes away.
+ *  Single note offs leave the notes other sources hold on the channel.
+ */
+static void notes_release(merge_peer_t *peer) {
+    /* Local variables */
+    midi_event_t off = {.len = 3, .data[2] = 64, .timestamp = midi_ble_now()};
+    uint32_t bits;
+
+    merge_now_ms = midi_now_ms();
+    for (uint8_t ch = 0; ch < 16; ch++) {
+        for (uint8_t w = 0; w < 4; w++) {
+            for (bits = peer->notes[ch][w]; bits; bits &= bits - 1) {
+                off.data[0] = MIDI_NOTE_OFF | ch;
+                off.data[1] = (w << 5) + __builtin_ctz(bits);
+                if (local_event_cb) {
+                    local_event_cb(&off, local_event_arg);
+                }
+                midi_thin_input(&peer->thin, &off, merge_now_ms);
+                peer->stats.notes_released++;
+            }
+        }
+    }
+    memset(peer->notes, 0, sizeof(peer->notes));
+}
+
+static void merge_on_event(const midi_event_t *ev, void *arg) {
+    /* Local variables */
+    merge_peer_t *peer = arg;
+    midi_event_t routed = *ev;
+    uint32_t start = esp_cpu_get_cycle_count();
+
+    peer->stats.events_in++;
+    if (!midi_route_apply(&routed)) {
+        return;
+    }
+    midi_curve_apply(&routed);
+    notes_track(peer, &routed);
+    if (local_event_cb) {
+        local_event_cb(&routed, local_event_arg);
+    }
+    midi_thin_input(&peer->thin, &routed, merge_now_ms);
+    midi_stats_record(MIDI_STATS_ROUTE, esp_cpu_get_cycle_count() - start);
+}
+
+/*
+ *  SysEx is collected per source and only forwarded once complete, so two
+ *  centrals sending SysEx at the same time can never interleave.
+ */
+static void merge_on_sysex(const uint8_t *data, size_t len, uint8_t flags,
+                           void *arg) {
+    /* Local variables */
+    merge_peer_t *peer = arg;
+    uint32_t routes;
+
+    if (flags & MIDI_SYSEX_F_START) {
+        peer->sysex_len = 0;
+        peer->sysex_overflow = false;
+    }
+    if (flags & MIDI_SYSEX_F_ABORT) {
+        peer->sysex_len = 0;
+        peer->stats.sysex_dropped++;
+        return;
+    }
+
+    if (!peer->sysex_overflow) {
+        if (peer->sysex_len + len > sizeof(peer->sysex)) {
+            peer->sysex_overflow = true;
+        } else {
+            memcpy(&peer->sysex[peer->sysex_len], data, len);
+            peer->sysex_len += len;
+        }
+    }
+
+    if (!(flags & MIDI_SYSEX_F_END)) {
+        return;
+    }
+    if (peer->sysex_overflow) {
+        peer->stats.sysex_dropped++;
+        return;
+    }
+
+    peer->stats.sysex_in++;
+    if (local_sysex_cb &&
+        local_sysex_cb(peer->sysex, peer->sysex_len, local_event_arg)) {
+        return;
+    }
+    if (!midi_route_pass_sysex()) {
+        return;
+    }
+    routes = peer->routes;
+    while (routes) {
+        uint8_t slot = __builtin_ctz(routes);
+        routes &= routes - 1;
+        midi_out_push_sysex(slot, peer->sysex, peer->sysex_len);
+    }
+}
+
+/* Public functions */
+void midi_merge_init(uint16_t chr_val_handle, midi_event_cb_t local_cb,
+                     midi_merge_sysex_cb_t sysex_cb, void *arg) {
+    memset(peers, 0, sizeof(peers));
+    local_event_cb = local_cb;
+    local_sysex_cb = sysex_cb;
+    local_event_arg = arg;
+    midi_out_init(chr_val_handle);
+}
+
+int midi_merge_slot(uint16_t conn_handle) {
+    for (int i = 0; i < MIDI_MAX_PEERS; i++) {
+        if (peers[i].used && peers[i].conn_handle == conn_handle) {
+            return i;
+        }
+    }
+    return MIDI_MERGE_NO_SLOT;
+}
+
+int midi_merge_connect(uint16_t conn_handle) {
+    /* Local variables */
+    int slot = midi_merge_slot(conn_handle);
+
+    if (slot != MIDI_MERGE_NO_SLOT) {
+        return slot;
+    }
+
+    for (int i = 0; i < MIDI_MAX_PEERS; i++) {
+        if (!peers[i].used) {
+            memset(&peers[i], 0, sizeof(peers[i]));
+            peers[i].used = true;
+            peers[i].conn_handle = conn_handle;
+            peers[i].routes = default_routes(i);
+            midi_parser_reset(&peers[i].parser);
+            midi_thin_init(&peers[i].thin, CONFIG_MIDI_THIN_WINDOW_MS,
+                           THIN_DROP_REPEATS,
+                           merge_fan_out, &peers[i]);
+            return i;
+        }
+    }
+
+    ESP_LOGE(TAG, "no free MIDI peer slot for conn_handle=%d", conn_handle);
+    return MIDI_MERGE_NO_SLOT;
+}
+
+void midi_merge_disconnect(uint16_t conn_handle) {
+    /* Local variables */
+    int slot = midi_merge_slot(conn_handle);
+
+    if (slot == MIDI_MERGE_NO_SLOT) {
+        return;
+    }
+    midi_out_close(slot);
+    /* Queued for the other destinations, sent on the next poll */
+    notes_release(&peers[slot]);
+    peers[slot].used = false;
+}
+
+void midi_merge_subscribe(uint16_t conn_handle, bool enabled) {
+    /* Local variables */
+    int slot = midi_merge_connect(conn_handle);
+
+    if (slot == MIDI_MERGE_NO_SLOT) {
+        return;
+    }
+    if (enabled && !midi_out_is_open(slot)) {
+        midi_out_open(slot, conn_handle);
+    } else if (!enabled) {
+        midi_out_close(slot);
+    }
+}
+
+/*
+ *  Decode a BLE-MIDI packet written by a central, hand every message to the
+ *  local consumer and queue it for the routed destinations. Nothing is sent
+ *  until the next midi_merge_poll().
+ */
+int midi_merge_input(uint16_t conn_handle, const uint8_t *buf, size_t len) {
+    /* Local variables */
+    int slot = midi_merge_connect(conn_handle);
+    merge_peer_t *peer;
+    int rc;
+
+    if (slot == MIDI_MERGE_NO_SLOT) {
+        return BLE_HS_ENOMEM;
+    }
+    peer = &peers[slot];
+
+    merge_now_ms = midi_now_ms();
+    rc = midi_ble_decode(&peer->parser, buf, len, merge_on_event,
+                         merge_on_sysex, peer);
+    if (rc != 0) {
+        peer->stats.decode_errors++;
+    }
+    return rc;
+}
+
+/*
+ *  Release controller values whose thinning window has closed and push the
+ *  queued traffic out. Returns the milliseconds until the next held value is
+ *  due or a refused notification is retried, or -1 when nothing waits.
+ */
+int32_t midi_merge_poll(void) {
+    /* Local variables */
+    int32_t next = -1;
+    int32_t due;
+
+    merge_now_ms = midi_now_ms();
+    for (int i = 0; i < MIDI_MAX_PEERS; i++) {
+        if (!peers[i].used) {
+            continue;
+        }
+        due = midi_thin_poll(&peers[i].thin, merge_now_ms);
+        if (due >= 0 && (next < 0 || due < next)) {
+            next = due;
+        }
+    }
+
+    if (midi_out_flush() && (next < 0 || next > MIDI_OUT_RETRY_MS)) {
+        next = MIDI_OUT_RETRY_MS;
+    }
+    return next;
+}
+
+/*
+ *  Counters of a source. Only the MIDI task writes them; other tasks may
+ *  read them for diagnostics, each 32-bit counter is read whole.
+ */
+void midi_merge_get_stats(uint8_t slot, midi_merge_src_stats_t *stats) {
+    *stats = peers[slot].stats;
+    stats->thin = peers[slot].thin.stats;
+}
@@ -0,0 +1,418 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "midi_out.h"
+#include "common.h"
+#include <stdatomic.h>
+
+/* Defines */
+#define QUEUE_LEN CONFIG_MIDI_OUT_QUEUE_LEN
+#define QUEUE_MASK (QUEUE_LEN - 1)
+#define SYSEX_BUF CONFIG_MIDI_OUT_SYSEX_BUF
+#define SYSEX_MASK (SYSEX_BUF - 1)
+#define SYSEX_QUEUE_LEN 8
+#define SYSEX_QUEUE_MASK (SYSEX_QUEUE_LEN - 1)
+
+_Static_assert((QUEUE_LEN & QUEUE_MASK) == 0,
+               "MIDI_OUT_QUEUE_LEN must be a power of two");
+_Static_assert((SYSEX_BUF & SYSEX_MASK) == 0,
+               "MIDI_OUT_SYSEX_BUF must be a power of two");
+_Static_assert(SYSEX_BUF >= CONFIG_MIDI_SYSEX_MAX,
+               "MIDI_OUT_SYSEX_BUF must hold a full SysEx message");
+
+/* Private types */
+/*
+ * Every lane is a single-producer single-consumer queue. head is only
+ * written by the producer and tail only by the consumer, so neither side
+ * needs a lock.
+ */
+typedef struct {
+    _Atomic uint32_t head;
+    _Atomic uint32_t tail;
+    uint32_t depth_max;
+    uint32_t dropped;
+    midi_event_t items[QUEUE_LEN];
+} out_lane_t;
+
+/* SysEx entries reference a contiguous range of the destination byte ring */
+typedef struct {
+    uint32_t pos;
+    uint16_t len;
+} sysex_ref_t;
+
+typedef struct {
+    _Atomic uint32_t head;
+    _Atomic uint32_t tail;
+    _Atomic uint32_t byte_tail;
+    uint32_t byte_head;
+    uint32_t depth_max;
+    uint32_t dropped;
+    uint16_t sent; /* bytes of the head SysEx already sent */
+    sysex_ref_t refs[SYSEX_QUEUE_LEN];
+    uint8_t bytes[SYSEX_BUF];
+} out_sysex_lane_t;
+
+typedef struct {
+    uint16_t conn_handle;
+    bool open;
+    uint32_t packets_sent;
+    uint32_t notify_failed;
+    out_lane_t lanes[MIDI_OUT_LANE_SYSEX];
+    out_sysex_lane_t sysex;
+    /* Control lane head each queued note waits for, set with the note */
+    uint32_t note_after[QUEUE_LEN];
+    /* Producer only: control lane head after the last message per channel */
+    uint32_t ctl_last[16];
+} out_dest_t;
+
+/* Private function declarations */
+static midi_out_lane_t lane_of(uint8_t status);
+static bool lane_push(out_lane_t *lane, const midi_event_t *ev);
+static bool lane_fill(out_lane_t *lane, midi_packet_t *pkt, uint32_t *tail,
+                      uint32_t head);
+static bool note_fill(out_dest_t *dest, midi_packet_t *pkt, uint32_t *tails);
+static bool sysex_fill(out_sysex_lane_t *lane, midi_packet_t *pkt,
+                       uint32_t *tail, uint32_t *byte_tail, uint16_t *sent);
+static void out_flush_dest(out_dest_t *dest);
+static bool out_pending(out_dest_t *dest);
+
+/* Private variables */
+static out_dest_t dests[MIDI_MAX_PEERS];
+static uint16_t midi_val_handle;
+static uint8_t tx_buf[CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU];
+
+/* Private functions */
+/*
+ *  Lane assignment
+ *      - System realtime carries timing and may be sent out of order
+ *      - Note on and off only wait for their own channel
+ *      - Everything else keeps the order it was queued in
+ */
+static midi_out_lane_t lane_of(uint8_t status) {
+    if (MIDI_IS_REALTIME(status)) {
+        return MIDI_OUT_LANE_REALTIME;
+    }
+    if (MIDI_IS_CHANNEL_MSG(status) &&
+        (MIDI_STATUS_TYPE(status) == MIDI_NOTE_ON ||
+         MIDI_STATUS_TYPE(status) == MIDI_NOTE_OFF)) {
+        return MIDI_OUT_LANE_NOTE;
+    }
+    return MIDI_OUT_LANE_CONTROL;
+}
+
+static bool lane_push(out_lane_t *lane, const midi_event_t *ev) {
+    /* Local variables */
+    uint32_t head, tail;
+
+    head = atomic_load_explicit(&lane->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&lane->tail, memory_order_acquire);
+    if (head - tail >= QUEUE_LEN) {
+        lane->dropped++;
+        return false;
+    }
+
+    lane->items[head & QUEUE_MASK] = *ev;
+    atomic_store_explicit(&lane->head, head + 1, memory_order_release);
+    if (head + 1 - tail > lane->depth_max) {
+        lane->depth_max = head + 1 - tail;
+    }
+    return true;
+}
+
+/*
+ *  Append messages queued before head to pkt, returns false once the
+ *  packet is full. tail may already be past head.
+ */
+static bool lane_fill(out_lane_t *lane, midi_packet_t *pkt, uint32_t *tail,
+                      uint32_t head) {
+    while ((int32_t)(head - *tail) > 0) {
+        if (!midi_packet_append(pkt, &lane->items[*tail & QUEUE_MASK])) {
+            return false;
+        }
+        (*tail)++;
+    }
+    return true;
+}
+
+/*
+ *  Append queued notes, each preceded by whatever the control lane still
+ *  holds from before it was queued, returns false once the packet is full.
+ *  Only a note whose channel has such messages waits for the control lane.
+ */
+static bool note_fill(out_dest_t *dest, midi_packet_t *pkt, uint32_t *tails) {
+    /* Local variables */
+    out_lane_t *notes = &dest->lanes[MIDI_OUT_LANE_NOTE];
+    out_lane_t *ctl = &dest->lanes[MIDI_OUT_LANE_CONTROL];
+    uint32_t head = atomic_load_explicit(&notes->head, memory_order_acquire);
+    uint32_t ctl_head = atomic_load_explicit(&ctl->head, memory_order_acquire);
+    uint32_t *tail = &tails[MIDI_OUT_LANE_NOTE];
+    uint32_t after;
+
+    while (*tail != head) {
+        /* A barrier past the head is stale, left by a channel that was
+         * idle while the index went all the way around */
+        after = dest->note_after[*tail & QUEUE_MASK];
+        if ((int32_t)(ctl_head - after) >= 0 &&
+            !lane_fill(ctl, pkt, &tails[MIDI_OUT_LANE_CONTROL], after)) {
+            return false;
+        }
+        if (!midi_packet_append(pkt, &notes->items[*tail & QUEUE_MASK])) {
+            return false;
+        }
+        (*tail)++;
+    }
+    return true;
+}
+
+static bool sysex_fill(out_sysex_lane_t *lane, midi_packet_t *pkt,
+                       uint32_t *tail, uint32_t *byte_tail, uint16_t *sent) {
+    /* Local variables */
+    uint32_t head = atomic_load_explicit(&lane->head, memory_order_acquire);
+    const sysex_ref_t *ref;
+
+    while (*tail != head) {
+        ref = &lane->refs[*tail & SYSEX_QUEUE_MASK];
+        *sent += midi_packet_append_sysex(
+            pkt, &lane->bytes[(ref->pos & SYSEX_MASK) + *sent],
+            ref->len - *sent);
+        if (*sent < ref->len) {
+            return false;
+        }
+        *sent = 0;
+        *byte_tail = ref->pos + ref->len;
+        (*tail)++;
+    }
+    return true;
+}
+
+/*
+ *  Drain one destination into as few notifications as possible. Each
+ *  packet is filled in lane priority order, so realtime messages always
+ *  take the first bytes, whatever flood is queued behind them.
+ *  Realtime messages may also cut into a SysEx that spans packets. The
+ *  control lane head is read before the notes, so no control message
+ *  queued after a note can go out ahead of it. The consumer indices are
+ *  only committed once a notification has been handed to the stack, so a
+ *  failed send is retried on the next flush.
+ */
+static void out_flush_dest(out_dest_t *dest) {
+    /* Local variables */
+    midi_packet_t pkt;
+    struct os_mbuf *om;
+    uint32_t tails[MIDI_OUT_LANE_SYSEX];
+    uint32_t sysex_tail, byte_tail, ctl_head;
+    uint16_t sent, cap;
+    int i;
+
+    cap = ble_att_mtu(dest->conn_handle);
+    if (cap <= 3) {
+        return;
+    }
+    cap -= 3;
+    if (cap > sizeof(tx_buf)) {
+        cap = sizeof(tx_buf);
+    }
+
+    for (;;) {
+        for (i = 0; i < MIDI_OUT_LANE_SYSEX; i++) {
+            tails[i] = atomic_load_explicit(&dest->lanes[i].tail,
+                                            memory_order_relaxed);
+        }
+        sysex_tail =
+            atomic_load_explicit(&dest->sysex.tail, memory_order_relaxed);
+        byte_tail =
+            atomic_load_explicit(&dest->sysex.byte_tail, memory_order_relaxed);
+        sent = dest->sysex.sent;
+        ctl_head = atomic_load_explicit(
+            &dest->lanes[MIDI_OUT_LANE_CONTROL].head, memory_order_acquire);
+
+        midi_packet_init(&pkt, tx_buf, cap, midi_ble_now());
+        /* A SysEx cut at the previous packet boundary must be finished
+         * before any non-realtime message */
+        pkt.in_sysex = sent > 0;
+
+        if (lane_fill(&dest->lanes[MIDI_OUT_LANE_REALTIME], &pkt,
+                      &tails[MIDI_OUT_LANE_REALTIME],
+                      atomic_load_explicit(
+                          &dest->lanes[MIDI_OUT_LANE_REALTIME].head,
+                          memory_order_acquire)) &&
+            (sent == 0 ||
+             sysex_fill(&dest->sysex, &pkt, &sysex_tail, &byte_tail, &sent)) &&
+            note_fill(dest, &pkt, tails) &&
+            lane_fill(&dest->lanes[MIDI_OUT_LANE_CONTROL], &pkt,
+                      &tails[MIDI_OUT_LANE_CONTROL], ctl_head)) {
+            sysex_fill(&dest->sysex, &pkt, &sysex_tail, &byte_tail, &sent);
+        }
+        if (midi_packet_empty(&pkt)) {
+            return;
+        }
+
+        om = ble_hs_mbuf_from_flat(pkt.buf, pkt.len);
+        if (om == NULL ||
+            ble_gatts_notify_custom(dest->conn_handle, midi_val_handle, om) !=
+                0) {
+            dest->notify_failed++;
+            return;
+        }
+        dest->packets_sent++;
+
+        for (i = 0; i < MIDI_OUT_LANE_SYSEX; i++) {
+            atomic_store_explicit(&dest->lanes[i].tail, tails[i],
+                                  memory_order_release);
+        }
+        dest->sysex.sent = sent;
+        atomic_store_explicit(&dest->sysex.byte_tail, byte_tail,
+                              memory_order_release);
+        atomic_store_explicit(&dest->sysex.tail, sysex_tail,
+                              memory_order_release);
+    }
+}
+
+/* Anything still queued, read by the consumer side */
+static bool out_pending(out_dest_t *dest) {
+    for (int i = 0; i < MIDI_OUT_LANE_SYSEX; i++) {
+        if (atomic_load_explicit(&dest->lanes[i].head, memory_order_acquire) !=
+            atomic_load_explicit(&dest->lanes[i].tail, memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return atomic_load_explicit(&dest->sysex.head, memory_order_acquire) !=
+           atomic_load_explicit(&dest->sysex.tail, memory_order_relaxed);
+}
+
+/* Public functions */
+void midi_out_init(uint16_t chr_val_handle) {
+    midi_val_handle = chr_val_handle;
+    memset(dests, 0, sizeof(dests));
+}
+
+void midi_out_open(uint8_t slot, uint16_t conn_handle) {
+    /* Local variables */
+    out_dest_t *dest = &dests[slot];
+
+    memset(dest, 0, sizeof(*dest));
+    dest->conn_handle = conn_handle;
+    dest->open = true;
+}
+
+void midi_out_close(uint8_t slot) { dests[slot].open = false; }
+
+bool midi_out_is_open(uint8_t slot) { return dests[slot].open; }
+
+bool midi_out_push(uint8_t slot, const midi_event_t *ev) {
+    /* Local variables */
+    out_dest_t *dest = &dests[slot];
+    midi_out_lane_t lane = lane_of(ev->data[0]);
+    out_lane_t *ctl = &dest->lanes[MIDI_OUT_LANE_CONTROL];
+    uint32_t head;
+
+    if (!dest->open) {
+        return false;
+    }
+
+    switch (lane) {
+    case MIDI_OUT_LANE_NOTE:
+        /* Published together with the note by lane_push */
+        head = atomic_load_explicit(&dest->lanes[lane].head,
+                                    memory_order_relaxed);
+        dest->note_after[head & QUEUE_MASK] =
+            dest->ctl_last[MIDI_STATUS_CHANNEL(ev->data[0])];
+        return lane_push(&dest->lanes[lane], ev);
+
+    case MIDI_OUT_LANE_CONTROL:
+        if (!lane_push(ctl, ev)) {
+            return false;
+        }
+        head = atomic_load_explicit(&ctl->head, memory_order_relaxed);
+        if (MIDI_IS_CHANNEL_MSG(ev->data[0])) {
+            dest->ctl_last[MIDI_STATUS_CHANNEL(ev->data[0])] = head;
+        } else {
+            /* System common applies to every channel */
+            for (int ch = 0; ch < 16; ch++) {
+                dest->ctl_last[ch] = head;
+            }
+        }
+        return true;
+
+    default:
+        return lane_push(&dest->lanes[lane], ev);
+    }
+}
+
+/*
+ *  Queue a complete SysEx message as a single item. The bytes are stored
+ *  contiguously, skipping the end of the ring when they would wrap, so the
+ *  packetizer can copy them in one go and never interleaves them.
+ */
+bool midi_out_push_sysex(uint8_t slot, const uint8_t *data, uint16_t len) {
+    /* Local variables */
+    out_sysex_lane_t *lane = &dests[slot].sysex;
+    sysex_ref_t *ref;
+    uint32_t head, tail, pos, byte_tail;
+
+    if (!dests[slot].open || len == 0 || len > SYSEX_BUF) {
+        return false;
+    }
+
+    head = atomic_load_explicit(&lane->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&lane->tail, memory_order_acquire);
+    byte_tail = atomic_load_explicit(&lane->byte_tail, memory_order_acquire);
+
+    pos = lane->byte_head;
+    if ((pos & SYSEX_MASK) + len > SYSEX_BUF) {
+        pos += SYSEX_BUF - (pos & SYSEX_MASK);
+    }
+    if (head - tail >= SYSEX_QUEUE_LEN || pos + len - byte_tail > SYSEX_BUF) {
+        lane->dropped++;
+        return false;
+    }
+
+    memcpy(&lane->bytes[pos & SYSEX_MASK], data, len);
+    ref = &lane->refs[head & SYSEX_QUEUE_MASK];
+    ref->pos = pos;
+    ref->len = len;
+    lane->byte_head = pos + len;
+    atomic_store_explicit(&lane->head, head + 1, memory_order_release);
+    if (head + 1 - tail > lane->depth_max) {
+        lane->depth_max = head + 1 - tail;
+    }
+    return true;
+}
+
+/*
+ *  Send what is queued for every destination. Returns true when output was
+ *  left behind because the stack refused a notification; the caller must
+ *  flush again after MIDI_OUT_RETRY_MS, or note offs could hang.
+ */
+bool midi_out_flush(void) {
+    /* Local variables */
+    bool pending = false;
+
+    for (int i = 0; i < MIDI_MAX_PEERS; i++) {
+        if (dests[i].open) {
+            out_flush_dest(&dests[i]);
+            pending |= out_pending(&dests[i]);
+        }
+    }
+    return pending;
+}
+
+void midi_out_get_stats(uint8_t slot, midi_out_stats_t *stats) {
+    /* Local variables */
+    const out_dest_t *dest = &dests[slot];
+    const out_lane_t *lane;
+
+    for (int i = 0; i < MIDI_OUT_LANE_SYSEX; i++) {
+        lane = &dest->lanes[i];
+        stats->depth[i] = atomic_load(&lane->head) - atomic_load(&lane->tail);
+        stats->depth_max[i] = lane->depth_max;
+        stats->dropped[i] = lane->dropped;
+    }
+    stats->depth[MIDI_OUT_LANE_SYSEX] =
+        atomic_load(&dest->sysex.head) - atomic_load(&dest->sysex.tail);
+    stats->depth_max[MIDI_OUT_LANE_SYSEX] = dest->sysex.depth_max;
+    stats->dropped[MIDI_OUT_LANE_SYSEX] = dest->sysex.dropped;
+    stats->packets_sent = dest->packets_sent;
+    stats->notify_failed = dest->notify_failed;
+}
@@ -0,0 +1,193 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "midi_pool.h"
+#include "common.h"
+#include "esp_cpu.h"
+#include <assert.h>
+#include <stdatomic.h>
+
+/* Defines */
+#define POOL_NIL 0xFFFF
+#define POOL_CACHE CONFIG_MIDI_POOL_CACHE
+
+/* The shared free list head packs a change counter above the block index */
+#define HEAD_INDEX(h) ((h) & 0xFFFF)
+#define HEAD_TAG(h) ((h) >> 16)
+#define HEAD_MAKE(tag, idx) ((uint32_t)((tag) & 0xFFFF) << 16 | (idx))
+
+_Static_assert(CONFIG_MIDI_POOL_SIZE < POOL_NIL,
+               "MIDI_POOL_SIZE must fit a 16-bit block index");
+
+/* Private types */
+typedef struct {
+    uint16_t count;
+    uint16_t items[POOL_CACHE > 0 ? POOL_CACHE : 1];
+} pool_cache_t;
+
+/* Private function declarations */
+static uint16_t list_pop(void);
+static void list_push(uint16_t idx);
+static uint16_t cache_get(pool_cache_t *cache);
+static void cache_put(pool_cache_t *cache, uint16_t idx);
+
+/* Private variables */
+static uint8_t blocks[CONFIG_MIDI_POOL_SIZE][MIDI_POOL_BLOCK_SIZE]
+    __attribute__((aligned(4)));
+static _Atomic uint16_t next_free[CONFIG_MIDI_POOL_SIZE];
+static _Atomic uint32_t free_head;
+static pool_cache_t caches[portNUM_PROCESSORS];
+
+static _Atomic uint16_t in_use;
+static _Atomic uint16_t high_water;
+static _Atomic uint32_t alloc_failed;
+
+/* Private functions */
+/*
+ *  Treiber stack over block indices. The counter in the upper half of the
+ *  head changes on every update, so a pop racing with a pop and push of the
+ *  same block fails its compare-and-swap instead of corrupting the list.
+ */
+static uint16_t list_pop(void) {
+    /* Local variables */
+    uint32_t head = atomic_load_explicit(&free_head, memory_order_acquire);
+    uint16_t idx, next;
+
+    do {
+        idx = HEAD_INDEX(head);
+        if (idx == POOL_NIL) {
+            return POOL_NIL;
+        }
+        next = atomic_load_explicit(&next_free[idx], memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(
+        &free_head, &head, HEAD_MAKE(HEAD_TAG(head) + 1, next),
+        memory_order_acquire, memory_order_acquire));
+
+    return idx;
+}
+
+static void list_push(uint16_t idx) {
+    /* Local variables */
+    uint32_t head = atomic_load_explicit(&free_head, memory_order_relaxed);
+
+    do {
+        atomic_store_explicit(&next_free[idx], HEAD_INDEX(head),
+                              memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(
+        &free_head, &head, HEAD_MAKE(HEAD_TAG(head) + 1, idx),
+        memory_order_release, memory_order_relaxed));
+}
+
+/* An empty cache is refilled with half its capacity from the shared list */
+static uint16_t cache_get(pool_cache_t *cache) {
+    /* Local variables */
+    uint16_t idx;
+
+    if (POOL_CACHE == 0) {
+        return list_pop();
+    }
+    if (cache->count == 0) {
+        while (cache->count < (POOL_CACHE + 1) / 2) {
+            idx = list_pop();
+            if (idx == POOL_NIL) {
+                break;
+            }
+            cache->items[cache->count++] = idx;
+        }
+        if (cache->count == 0) {
+            return POOL_NIL;
+        }
+    }
+    return cache->items[--cache->count];
+}
+
+/* A full cache hands half its blocks back so other cores can use them */
+static void cache_put(pool_cache_t *cache, uint16_t idx) {
+    if (POOL_CACHE == 0) {
+        list_push(idx);
+        return;
+    }
+    if (cache->count == POOL_CACHE) {
+        while (cache->count > POOL_CACHE / 2) {
+            list_push(cache->items[--cache->count]);
+        }
+    }
+    cache->items[cache->count++] = idx;
+}
+
+/* Public functions */
+void midi_pool_init(void) {
+    for (int i = 0; i < CONFIG_MIDI_POOL_SIZE; i++) {
+        atomic_store(&next_free[i],
+                     i + 1 < CONFIG_MIDI_POOL_SIZE ? i + 1 : POOL_NIL);
+    }
+    atomic_store(&free_head, HEAD_MAKE(0, 0));
+    memset(caches, 0, sizeof(caches));
+    atomic_store(&in_use, 0);
+    atomic_store(&high_water, 0);
+    atomic_store(&alloc_failed, 0);
+}
+
+/*
+ *  Take a block from the pool, NULL when all are in use. Interrupts are
+ *  masked on this core while its cache is touched, which also keeps the
+ *  task from migrating to the other core half way through.
+ */
+void *midi_pool_alloc(void) {
+    /* Local variables */
+    UBaseType_t irq = portSET_INTERRUPT_MASK_FROM_ISR();
+    uint16_t idx = cache_get(&caches[esp_cpu_get_core_id()]);
+    uint16_t used, peak;
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(irq);
+
+    if (idx == POOL_NIL) {
+        atomic_fetch_add_explicit(&alloc_failed, 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    used = atomic_fetch_add_explicit(&in_use, 1, memory_order_relaxed) + 1;
+    peak = atomic_load_explicit(&high_water, memory_order_relaxed);
+    while (used > peak &&
+           !atomic_compare_exchange_weak_explicit(
+               &high_water, &peak, used, memory_order_relaxed,
+               memory_order_relaxed)) {
+    }
+    return blocks[idx];
+}
+
+void midi_pool_free(void *block) {
+    /* Local variables */
+    UBaseType_t irq;
+    uint16_t idx;
+
+    if (block == NULL) {
+        return;
+    }
+    idx = ((uint8_t *)block - blocks[0]) / MIDI_POOL_BLOCK_SIZE;
+    assert(idx < CONFIG_MIDI_POOL_SIZE && block == blocks[idx]);
+
+    /* Counted free first, so a quick reuse never pushes it past the size */
+    atomic_fetch_sub_explicit(&in_use, 1, memory_order_relaxed);
+
+    irq = portSET_INTERRUPT_MASK_FROM_ISR();
+    cache_put(&caches[esp_cpu_get_core_id()], idx);
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(irq);
+}
+
+/*
+ *  Blocks not allocated. Up to CONFIG_MIDI_POOL_CACHE of them may sit in
+ *  the cache of another core, out of reach of this one.
+ */
+uint16_t midi_pool_available(void) {
+    return CONFIG_MIDI_POOL_SIZE -
+           atomic_load_explicit(&in_use, memory_order_relaxed);
+}
+
+void midi_pool_get_stats(midi_pool_stats_t *stats) {
+    stats->size = CONFIG_MIDI_POOL_SIZE;
+    stats->in_use = atomic_load(&in_use);
+    stats->high_water = atomic_load(&high_water);
+    stats->alloc_failed = atomic_load(&alloc_failed);
+}
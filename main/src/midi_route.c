@@ -0,0 +1,246 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "midi_route.h"
+#include "common.h"
+#include "esp_attr.h"
+#include "nvs.h"
+
+/* Defines */
+#define ROUTE_NVS_NAMESPACE "midi"
+#define ROUTE_NVS_KEY "route"
+
+/* Message types passed by the compile-time route */
+#ifdef CONFIG_MIDI_ROUTE_PASS_NOTES
+#define FIXED_PASS_NOTES MIDI_ROUTE_NOTE
+#else
+#define FIXED_PASS_NOTES 0
+#endif
+#ifdef CONFIG_MIDI_ROUTE_PASS_POLY_PRESSURE
+#define FIXED_PASS_POLY_PRESSURE MIDI_ROUTE_POLY_PRESSURE
+#else
+#define FIXED_PASS_POLY_PRESSURE 0
+#endif
+#ifdef CONFIG_MIDI_ROUTE_PASS_CONTROL_CHANGE
+#define FIXED_PASS_CONTROL_CHANGE MIDI_ROUTE_CONTROL_CHANGE
+#else
+#define FIXED_PASS_CONTROL_CHANGE 0
+#endif
+#ifdef CONFIG_MIDI_ROUTE_PASS_PROGRAM_CHANGE
+#define FIXED_PASS_PROGRAM_CHANGE MIDI_ROUTE_PROGRAM_CHANGE
+#else
+#define FIXED_PASS_PROGRAM_CHANGE 0
+#endif
+#ifdef CONFIG_MIDI_ROUTE_PASS_CHANNEL_PRESSURE
+#define FIXED_PASS_CHANNEL_PRESSURE MIDI_ROUTE_CHANNEL_PRESSURE
+#else
+#define FIXED_PASS_CHANNEL_PRESSURE 0
+#endif
+#ifdef CONFIG_MIDI_ROUTE_PASS_PITCH_BEND
+#define FIXED_PASS_PITCH_BEND MIDI_ROUTE_PITCH_BEND
+#else
+#define FIXED_PASS_PITCH_BEND 0
+#endif
+#ifdef CONFIG_MIDI_ROUTE_PASS_SYSTEM_COMMON
+#define FIXED_PASS_SYSTEM_COMMON MIDI_ROUTE_SYSTEM_COMMON
+#else
+#define FIXED_PASS_SYSTEM_COMMON 0
+#endif
+#ifdef CONFIG_MIDI_ROUTE_PASS_REALTIME
+#define FIXED_PASS_REALTIME MIDI_ROUTE_REALTIME
+#else
+#define FIXED_PASS_REALTIME 0
+#endif
+#ifdef CONFIG_MIDI_ROUTE_PASS_SYSEX
+#define FIXED_PASS_SYSEX MIDI_ROUTE_SYSEX
+#else
+#define FIXED_PASS_SYSEX 0
+#endif
+
+#define FIXED_TYPE_MASK                                                        \
+    (FIXED_PASS_NOTES | FIXED_PASS_POLY_PRESSURE | FIXED_PASS_CONTROL_CHANGE | \
+     FIXED_PASS_PROGRAM_CHANGE | FIXED_PASS_CHANNEL_PRESSURE |                 \
+     FIXED_PASS_PITCH_BEND | FIXED_PASS_SYSTEM_COMMON | FIXED_PASS_REALTIME |  \
+     FIXED_PASS_SYSEX)
+
+/* MIDI_ROUTE_* bit of a status byte */
+#define TYPE_BIT(s)                                                            \
+    ((s) < 0xA0   ? MIDI_ROUTE_NOTE                                            \
+     : (s) < 0xB0 ? MIDI_ROUTE_POLY_PRESSURE                                   \
+     : (s) < 0xC0 ? MIDI_ROUTE_CONTROL_CHANGE                                  \
+     : (s) < 0xD0 ? MIDI_ROUTE_PROGRAM_CHANGE                                  \
+     : (s) < 0xE0 ? MIDI_ROUTE_CHANNEL_PRESSURE                                \
+     : (s) < 0xF0 ? MIDI_ROUTE_PITCH_BEND                                      \
+     : (s) >= 0xF8                 ? MIDI_ROUTE_REALTIME                       \
+     : (s) == 0xF0 || (s) == 0xF7 ? MIDI_ROUTE_SYSEX                           \
+                                   : MIDI_ROUTE_SYSTEM_COMMON)
+
+/*
+ * Table generators for the compile-time route. Every entry is a constant
+ * expression of its index, so the whole route folds into lookup tables.
+ */
+#define FIXED_CHANNEL(ch)                                                      \
+    (CONFIG_MIDI_ROUTE_OUT_CHANNEL ? CONFIG_MIDI_ROUTE_OUT_CHANNEL - 1 : (ch))
+#define FIXED_STATUS(s)                                                        \
+    ((s) < 0x80 || !(FIXED_TYPE_MASK & TYPE_BIT(s)) ? 0                        \
+     : (s) >= 0xF0                                  ? (s)                      \
+                   : (((s) & 0xF0) | FIXED_CHANNEL((s) & 0x0F)))
+#define FIXED_NOTE(n)                                                          \
+    ((n) + CONFIG_MIDI_ROUTE_TRANSPOSE >= 0 &&                                 \
+             (n) + CONFIG_MIDI_ROUTE_TRANSPOSE < 128                           \
+         ? (n) + CONFIG_MIDI_ROUTE_TRANSPOSE                                   \
+         : 0xFF)
+#define CLAMP_VELOCITY(v) ((v) < 1 ? 1 : (v) > 127 ? 127 : (v))
+#define FIXED_VELOCITY(v)                                                      \
+    ((v) == 0 ? 0                                                              \
+              : CLAMP_VELOCITY((v) * CONFIG_MIDI_ROUTE_VELOCITY_GAIN /         \
+                                   MIDI_ROUTE_VELOCITY_UNITY +                 \
+                               CONFIG_MIDI_ROUTE_VELOCITY_OFFSET))
+
+#define REP4(m, i) m(i), m((i) + 1), m((i) + 2), m((i) + 3)
+#define REP16(m, i)                                                            \
+    REP4(m, i), REP4(m, (i) + 4), REP4(m, (i) + 8), REP4(m, (i) + 12)
+#define REP64(m, i)                                                            \
+    REP16(m, i), REP16(m, (i) + 16), REP16(m, (i) + 32), REP16(m, (i) + 48)
+#define REP128(m, i) REP64(m, i), REP64(m, (i) + 64)
+#define REP256(m, i) REP128(m, i), REP128(m, (i) + 128)
+
+/* Private types */
+typedef struct {
+    uint8_t status[256];  /* output status byte, 0 drops the message */
+    uint8_t note[128];    /* transposed note, 0xFF drops the message */
+    uint8_t velocity[128];
+} route_table_t;
+
+/* Private function declarations */
+static inline bool route_fixed(midi_event_t *ev);
+static bool route_interpret(const midi_route_config_t *cfg, midi_event_t *ev);
+static uint16_t type_bit(uint8_t status);
+static bool config_valid(const midi_route_config_t *cfg);
+
+/* Private variables */
+/* Kept in internal RAM so the event path never waits on a flash cache miss */
+static DRAM_ATTR const route_table_t fixed_route = {
+    .status = {REP256(FIXED_STATUS, 0)},
+    .note = {REP128(FIXED_NOTE, 0)},
+    .velocity = {REP128(FIXED_VELOCITY, 0)},
+};
+
+static midi_route_config_t nvs_route;
+static bool nvs_route_active;
+
+/* Private functions */
+/* Compile-time route: two table lookups, one more for note-on velocity */
+static inline bool route_fixed(midi_event_t *ev) {
+    /* Local variables */
+    uint8_t status = fixed_route.status[ev->data[0]];
+    uint8_t note;
+
+    if (status == 0) {
+        return false;
+    }
+    if (status < MIDI_CONTROL_CHANGE) {
+        /* Notes and poly pressure carry a note number */
+        note = fixed_route.note[ev->data[1]];
+        if (note & 0x80) {
+            return false;
+        }
+        ev->data[1] = note;
+        if (MIDI_STATUS_TYPE(status) == MIDI_NOTE_ON) {
+            ev->data[2] = fixed_route.velocity[ev->data[2]];
+        }
+    }
+    ev->data[0] = status;
+    return true;
+}
+
+static uint16_t type_bit(uint8_t status) { return TYPE_BIT(status); }
+
+/* Interpreter for routes loaded at runtime */
+static bool route_interpret(const midi_route_config_t *cfg, midi_event_t *ev) {
+    /* Local variables */
+    uint8_t status = ev->data[0];
+    uint8_t ch = MIDI_STATUS_CHANNEL(status);
+    int note, velocity;
+
+    if (!(cfg->type_mask & type_bit(status))) {
+        return false;
+    }
+    if (!MIDI_IS_CHANNEL_MSG(status)) {
+        return true;
+    }
+    if (cfg->channel_map[ch] >= 16) {
+        return false;
+    }
+
+    switch (MIDI_STATUS_TYPE(status)) {
+    case MIDI_NOTE_ON:
+        if (ev->data[2] != 0) {
+            velocity = ev->data[2] * cfg->velocity_gain /
+                           MIDI_ROUTE_VELOCITY_UNITY +
+                       cfg->velocity_offset;
+            ev->data[2] = CLAMP_VELOCITY(velocity);
+        }
+        /* fall through */
+    case MIDI_NOTE_OFF:
+    case MIDI_POLY_PRESSURE:
+        note = ev->data[1] + cfg->transpose[ch];
+        if (note < 0 || note > 127) {
+            return false;
+        }
+        ev->data[1] = note;
+        break;
+    default:
+        break;
+    }
+
+    ev->data[0] = MIDI_STATUS_TYPE(status) | cfg->channel_map[ch];
+    return true;
+}
+
+static bool config_valid(const midi_route_config_t *cfg) {
+    return cfg->version == MIDI_ROUTE_CONFIG_VERSION &&
+           cfg->velocity_gain != 0;
+}
+
+/* Public functions */
+/*
+ *  Route initialization
+ *      - A route stored in NVS is run by the interpreter
+ *      - Otherwise the compile-time route from Kconfig is used
+ */
+void midi_route_init(void) {
+    /* Local variables */
+    nvs_handle_t nvs;
+    size_t len = sizeof(nvs_route);
+    esp_err_t err;
+
+    nvs_route_active = false;
+
+    err = nvs_open(ROUTE_NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        return;
+    }
+    err = nvs_get_blob(nvs, ROUTE_NVS_KEY, &nvs_route, &len);
+    nvs_close(nvs);
+
+    if (err == ESP_OK && len == sizeof(nvs_route) && config_valid(&nvs_route)) {
+        nvs_route_active = true;
+        ESP_LOGI(TAG, "using MIDI route from NVS");
+    }
+}
+
+bool midi_route_apply(midi_event_t *ev) {
+    if (nvs_route_active) {
+        return route_interpret(&nvs_route, ev);
+    }
+    return route_fixed(ev);
+}
+
+bool midi_route_pass_sysex(void) {
+    /* Local variables */
+    uint16_t mask = nvs_route_active ? nvs_route.type_mask : FIXED_TYPE_MASK;
+
+    return mask & MIDI_ROUTE_SYSEX;
+}
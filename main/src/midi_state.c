@@ -0,0 +1,316 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "midi_state.h"
+#include <string.h>
+
+/* Private types */
+/* Snapshot phases, walked in order for every active channel */
+enum {
+    SNAP_BANK,
+    SNAP_PROGRAM,
+    SNAP_PARAM_SELECT,
+    SNAP_CC,
+    SNAP_PITCH_BEND,
+    SNAP_NOTES,
+    SNAP_DONE,
+};
+
+/* Private function declarations */
+static inline void bit_set(uint32_t set[4], uint8_t bit);
+static inline void bit_clear(uint32_t set[4], uint8_t bit);
+static inline bool bit_test(const uint32_t set[4], uint8_t bit);
+static unsigned next_bit(const uint32_t set[4], unsigned from);
+static bool is_param_select(uint8_t cc);
+static bool is_bank_select(uint8_t cc);
+
+/* Private variables */
+/* (N)RPN selectors are replayed before any data entry controller, the pair
+ * selected last goes last so that data entry lands on that parameter */
+static const uint8_t param_select_ccs[2][4] = {
+    {99, 98, 101, 100}, /* RPN selected last */
+    {101, 100, 99, 98}, /* NRPN selected last */
+};
+
+/* Bank select MSB and LSB, replayed before the program they apply to */
+static const uint8_t bank_select_ccs[2] = {0, 32};
+
+/*
+ * Controllers Reset All Controllers leaves alone, as RP-015 lists them:
+ * bank select, volume, pan, sound controllers 70-79 and effects depths
+ * 91-95. Channel mode messages are not kept in cc_set anyway.
+ */
+static const uint32_t reset_keep[4] = {
+    (1u << 0) | (1u << 7) | (1u << 10),
+    1u << (32 - 32),
+    (0x3FFu << (70 - 64)) | (0x1Fu << (91 - 64)),
+    0,
+};
+
+/* Private functions */
+static inline void bit_set(uint32_t set[4], uint8_t bit) {
+    set[bit >> 5] |= 1u << (bit & 31);
+}
+
+static inline void bit_clear(uint32_t set[4], uint8_t bit) {
+    set[bit >> 5] &= ~(1u << (bit & 31));
+}
+
+static inline bool bit_test(const uint32_t set[4], uint8_t bit) {
+    return set[bit >> 5] & (1u << (bit & 31));
+}
+
+/* Index of the first set bit at or after from, 128 if there is none */
+static unsigned next_bit(const uint32_t set[4], unsigned from) {
+    /* Local variables */
+    unsigned word = from >> 5;
+    uint32_t bits;
+
+    if (from >= 128) {
+        return 128;
+    }
+    bits = set[word] & (~0u << (from & 31));
+    while (bits == 0) {
+        if (++word == 4) {
+            return 128;
+        }
+        bits = set[word];
+    }
+    return (word << 5) + __builtin_ctz(bits);
+}
+
+static bool is_param_select(uint8_t cc) {
+    return cc == 98 || cc == 99 || cc == 100 || cc == 101;
+}
+
+static bool is_bank_select(uint8_t cc) { return cc == 0 || cc == 32; }
+
+/* Public functions */
+void midi_state_reset(midi_state_t *state) {
+    memset(state, 0, sizeof(*state));
+    for (int ch = 0; ch < MIDI_CHANNELS; ch++) {
+        state->pitch_bend[ch] = MIDI_STATE_PITCH_BEND_CENTER;
+    }
+}
+
+void midi_state_apply(midi_state_t *state, const midi_event_t *ev) {
+    /* Local variables */
+    uint8_t status = ev->data[0];
+    uint8_t ch = MIDI_STATUS_CHANNEL(status);
+    uint16_t bend;
+
+    if (status == MIDI_SYSTEM_RESET) {
+        midi_state_reset(state);
+        return;
+    }
+    if (!MIDI_IS_CHANNEL_MSG(status)) {
+        return;
+    }
+
+    switch (MIDI_STATUS_TYPE(status)) {
+    case MIDI_NOTE_ON:
+        if (ev->data[2] != 0) {
+            bit_set(state->notes[ch], ev->data[1]);
+            state->active |= 1u << ch;
+            break;
+        }
+        /* Note on with zero velocity is a note off */
+        /* fall through */
+    case MIDI_NOTE_OFF:
+        bit_clear(state->notes[ch], ev->data[1]);
+        break;
+
+    case MIDI_CONTROL_CHANGE:
+        if (ev->data[1] == 96 || ev->data[1] == 97) {
+            /* Data increment and decrement are relative, not state */
+            break;
+        }
+        if (ev->data[1] == 98 || ev->data[1] == 99) {
+            state->nrpn_last |= 1u << ch;
+        } else if (ev->data[1] == 100 || ev->data[1] == 101) {
+            state->nrpn_last &= ~(1u << ch);
+        }
+        if (ev->data[1] < 120) {
+            state->cc[ch][ev->data[1]] = ev->data[2];
+            bit_set(state->cc_set[ch], ev->data[1]);
+            state->active |= 1u << ch;
+        } else if (ev->data[1] == 121) {
+            /* Reset all controllers, except those RP-015 keeps */
+            for (int i = 0; i < 4; i++) {
+                state->cc_set[ch][i] &= reset_keep[i];
+            }
+            state->pitch_bend[ch] = MIDI_STATE_PITCH_BEND_CENTER;
+            state->bend_set &= ~(1u << ch);
+        } else if (ev->data[1] != 122) {
+            /* All sound off, all notes off and the mode messages */
+            memset(state->notes[ch], 0, sizeof(state->notes[ch]));
+        }
+        break;
+
+    case MIDI_PROGRAM_CHANGE:
+        state->program[ch] = ev->data[1];
+        state->program_set |= 1u << ch;
+        state->active |= 1u << ch;
+        break;
+
+    case MIDI_PITCH_BEND:
+        bend = ev->data[1] | ((uint16_t)ev->data[2] << 7);
+        state->pitch_bend[ch] = bend;
+        if (bend != MIDI_STATE_PITCH_BEND_CENTER) {
+            state->bend_set |= 1u << ch;
+            state->active |= 1u << ch;
+        } else {
+            state->bend_set &= ~(1u << ch);
+        }
+        break;
+
+    default:
+        /* Pressure messages are transient and not tracked */
+        break;
+    }
+}
+
+void midi_state_cursor_init(midi_state_cursor_t *cursor) {
+    memset(cursor, 0, sizeof(*cursor));
+}
+
+/*
+ *  Serialize the next part of the state as one BLE-MIDI packet
+ *      - Returns the packet length, 0 once the whole state has been sent
+ *      - Per channel: bank select, program, (N)RPN selectors, the other
+ *        controllers, pitch bend and finally held notes. The bank goes
+ *        first so the program is loaded from it, and running status packs
+ *        controllers and notes at two bytes each
+ */
+uint16_t midi_state_snapshot(const midi_state_t *state,
+                             midi_state_cursor_t *cursor, uint8_t *buf,
+                             uint16_t cap, uint16_t timestamp) {
+    /* Local variables */
+    midi_packet_t pkt;
+    midi_event_t ev = {.timestamp = timestamp};
+    unsigned idx;
+    const uint8_t *selects;
+    uint8_t ch;
+
+    midi_packet_init(&pkt, buf, cap, timestamp);
+
+    for (; cursor->channel < MIDI_CHANNELS;
+         cursor->channel++, cursor->phase = SNAP_BANK, cursor->index = 0) {
+        ch = cursor->channel;
+        if (!(state->active & (1u << ch))) {
+            continue;
+        }
+
+        while (cursor->phase != SNAP_DONE) {
+            switch (cursor->phase) {
+            case SNAP_BANK:
+                for (; cursor->index < sizeof(bank_select_ccs);
+                     cursor->index++) {
+                    idx = bank_select_ccs[cursor->index];
+                    if (!bit_test(state->cc_set[ch], idx)) {
+                        continue;
+                    }
+                    ev.data[0] = MIDI_CONTROL_CHANGE | ch;
+                    ev.data[1] = idx;
+                    ev.data[2] = state->cc[ch][idx];
+                    ev.len = 3;
+                    if (!midi_packet_append(&pkt, &ev)) {
+                        goto full;
+                    }
+                }
+                cursor->phase = SNAP_PROGRAM;
+                cursor->index = 0;
+                break;
+
+            case SNAP_PROGRAM:
+                if (state->program_set & (1u << ch)) {
+                    ev.data[0] = MIDI_PROGRAM_CHANGE | ch;
+                    ev.data[1] = state->program[ch];
+                    ev.len = 2;
+                    if (!midi_packet_append(&pkt, &ev)) {
+                        goto full;
+                    }
+                }
+                cursor->phase = SNAP_PARAM_SELECT;
+                cursor->index = 0;
+                break;
+
+            case SNAP_PARAM_SELECT:
+                selects = param_select_ccs[(state->nrpn_last >> ch) & 1];
+                for (; cursor->index < sizeof(param_select_ccs[0]);
+                     cursor->index++) {
+                    idx = selects[cursor->index];
+                    if (!bit_test(state->cc_set[ch], idx)) {
+                        continue;
+                    }
+                    ev.data[0] = MIDI_CONTROL_CHANGE | ch;
+                    ev.data[1] = idx;
+                    ev.data[2] = state->cc[ch][idx];
+                    ev.len = 3;
+                    if (!midi_packet_append(&pkt, &ev)) {
+                        goto full;
+                    }
+                }
+                cursor->phase = SNAP_CC;
+                cursor->index = 0;
+                break;
+
+            case SNAP_CC:
+                for (idx = next_bit(state->cc_set[ch], cursor->index);
+                     idx < 128; idx = next_bit(state->cc_set[ch], idx + 1)) {
+                    cursor->index = idx;
+                    if (is_param_select(idx) || is_bank_select(idx)) {
+                        continue;
+                    }
+                    ev.data[0] = MIDI_CONTROL_CHANGE | ch;
+                    ev.data[1] = idx;
+                    ev.data[2] = state->cc[ch][idx];
+                    ev.len = 3;
+                    if (!midi_packet_append(&pkt, &ev)) {
+                        goto full;
+                    }
+                }
+                cursor->phase = SNAP_PITCH_BEND;
+                cursor->index = 0;
+                break;
+
+            case SNAP_PITCH_BEND:
+                if (state->bend_set & (1u << ch)) {
+                    ev.data[0] = MIDI_PITCH_BEND | ch;
+                    ev.data[1] = state->pitch_bend[ch] & 0x7F;
+                    ev.data[2] = (state->pitch_bend[ch] >> 7) & 0x7F;
+                    ev.len = 3;
+                    if (!midi_packet_append(&pkt, &ev)) {
+                        goto full;
+                    }
+                }
+                cursor->phase = SNAP_NOTES;
+                cursor->index = 0;
+                break;
+
+            case SNAP_NOTES:
+                for (idx = next_bit(state->notes[ch], cursor->index);
+                     idx < 128; idx = next_bit(state->notes[ch], idx + 1)) {
+                    cursor->index = idx;
+                    ev.data[0] = MIDI_NOTE_ON | ch;
+                    ev.data[1] = idx;
+                    ev.data[2] = MIDI_STATE_SNAPSHOT_VELOCITY;
+                    ev.len = 3;
+                    if (!midi_packet_append(&pkt, &ev)) {
+                        goto full;
+                    }
+                }
+                cursor->phase = SNAP_DONE;
+                break;
+
+            default:
+                cursor->phase = SNAP_DONE;
+                break;
+            }
+        }
+    }
+
+full:
+    return midi_packet_empty(&pkt) ? 0 : pkt.len;
+}
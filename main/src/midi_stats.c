@@ -0,0 +1,121 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "midi_stats.h"
+#include "common.h"
+#include <stdatomic.h>
+
+/* Defines */
+/* Longest attribute value ATT allows, the stats are read as one value */
+#define ATT_VALUE_MAX 512
+
+_Static_assert(MIDI_STATS_ENCODED_MAX <= ATT_VALUE_MAX,
+               "encoded stats must fit one attribute value");
+
+/* Private function declarations */
+static void hist_clear(void);
+static size_t put_varint(uint8_t *buf, size_t pos, size_t cap, uint64_t v);
+
+/* Private variables */
+/*
+ * Only the MIDI task records samples. Readers on other tasks may see a
+ * histogram mid-update, which is harmless for monitoring. A reset is only
+ * flagged and carried out by the recording task itself.
+ */
+static midi_stats_hist_t hists[MIDI_STATS_STAGES];
+static _Atomic bool reset_pending;
+
+/* Private functions */
+static void hist_clear(void) { memset(hists, 0, sizeof(hists)); }
+
+/* Returns the new position, or cap + 1 once the buffer is too short */
+static size_t put_varint(uint8_t *buf, size_t pos, size_t cap, uint64_t v) {
+    do {
+        if (pos >= cap) {
+            return cap + 1;
+        }
+        buf[pos++] = (v & 0x7F) | (v > 0x7F ? 0x80 : 0);
+        v >>= 7;
+    } while (v);
+    return pos;
+}
+
+/* Public functions */
+void midi_stats_record(midi_stats_stage_t stage, uint32_t cycles) {
+    /* Local variables */
+    midi_stats_hist_t *h = &hists[stage];
+    int bucket;
+
+    if (atomic_load_explicit(&reset_pending, memory_order_relaxed)) {
+        atomic_store_explicit(&reset_pending, false, memory_order_relaxed);
+        hist_clear();
+    }
+
+    bucket = 31 - __builtin_clz(cycles | 1) - MIDI_STATS_BUCKET_SHIFT;
+    if (bucket < 0) {
+        bucket = 0;
+    } else if (bucket >= MIDI_STATS_BUCKETS) {
+        bucket = MIDI_STATS_BUCKETS - 1;
+    }
+    h->buckets[bucket]++;
+    h->count++;
+    h->total += cycles;
+    if (cycles > h->max) {
+        h->max = cycles;
+    }
+}
+
+void midi_stats_reset(void) { atomic_store(&reset_pending, true); }
+
+void midi_stats_get(midi_stats_stage_t stage, midi_stats_hist_t *hist) {
+    *hist = hists[stage];
+}
+
+/* Serialize all histograms, returns the encoded length or 0 if cap is short */
+size_t midi_stats_encode(uint8_t *buf, size_t cap) {
+    /* Local variables */
+    const midi_stats_hist_t *h;
+    size_t pos = 6;
+    int first, last;
+
+    if (cap < pos) {
+        return 0;
+    }
+    buf[0] = MIDI_STATS_FORMAT_VERSION;
+    buf[1] = MIDI_STATS_STAGES;
+    buf[2] = MIDI_STATS_BUCKETS;
+    buf[3] = MIDI_STATS_BUCKET_SHIFT;
+    buf[4] = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ & 0xFF;
+    buf[5] = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ >> 8;
+
+    for (int s = 0; s < MIDI_STATS_STAGES; s++) {
+        h = &hists[s];
+        pos = put_varint(buf, pos, cap, h->count);
+        pos = put_varint(buf, pos, cap, h->max);
+        pos = put_varint(buf, pos, cap, h->total);
+
+        first = 0;
+        last = -1;
+        for (int b = 0; b < MIDI_STATS_BUCKETS; b++) {
+            if (h->buckets[b] != 0) {
+                if (last < 0) {
+                    first = b;
+                }
+                last = b;
+            }
+        }
+        if (pos + 2 > cap) {
+            return 0;
+        }
+        buf[pos++] = first;
+        buf[pos++] = last - first + 1;
+        for (int b = first; b <= last; b++) {
+            pos = put_varint(buf, pos, cap, h->buckets[b]);
+        }
+        if (pos > cap) {
+            return 0;
+        }
+    }
+    return pos;
+}
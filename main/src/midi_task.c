@@ -0,0 +1,287 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "midi_task.h"
+#include "common.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "lf_queue.h"
+#include "midi_pool.h"
+#include "midi_stats.h"
+#include "trace.h"
+
+/* Defines */
+#define TASK_QUEUE_LEN CONFIG_MIDI_TASK_QUEUE_LEN
+#define TASK_STACK_SIZE 4096
+#define CYCLES_PER_US CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+
+/* Blocks kept back from writes so connection changes are never lost. Those
+ * cached by the MIDI core are out of the host task's reach, so they do not
+ * count towards the reserve. */
+#define CONTROL_RESERVE (4 + CONFIG_MIDI_POOL_CACHE)
+
+_Static_assert((TASK_QUEUE_LEN & (TASK_QUEUE_LEN - 1)) == 0,
+               "MIDI_TASK_QUEUE_LEN must be a power of two");
+_Static_assert(TASK_QUEUE_LEN >= CONFIG_MIDI_POOL_SIZE,
+               "MIDI_TASK_QUEUE_LEN must hold every MIDI pool block");
+_Static_assert(CONFIG_MIDI_POOL_SIZE > CONTROL_RESERVE,
+               "MIDI_POOL_SIZE must leave room for writes");
+
+/* Private types */
+typedef enum {
+    MSG_START,
+    MSG_CONNECT,
+    MSG_DISCONNECT,
+    MSG_SUBSCRIBE,
+    MSG_WRITE,
+} msg_type_t;
+
+/*
+ * Everything the host task hands over travels through one queue, so
+ * connection changes stay in order with the writes around them and the
+ * MIDI state is only ever touched by the MIDI task. Messages are blocks of
+ * the MIDI pool, freed by the MIDI task once handled.
+ */
+typedef struct {
+    uint8_t type;
+    bool enabled;
+    uint16_t handle; /* connection, or characteristic for MSG_START */
+    uint16_t len;
+    uint32_t rx_us;
+    uint8_t data[CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU];
+} task_msg_t;
+
+_Static_assert(sizeof(task_msg_t) <= MIDI_POOL_BLOCK_SIZE,
+               "a MIDI task message must fit a MIDI pool block");
+
+/* Private function declarations */
+static task_msg_t *msg_get(bool control);
+static void msg_post(task_msg_t *msg);
+static void post_control(msg_type_t type, uint16_t handle, bool enabled);
+static void task_handle(task_msg_t *msg);
+static void midi_task(void *param);
+
+/* Private variables */
+/* host task -> MIDI task */
+static lf_spsc_t rx_queue;
+static void *rx_slots[TASK_QUEUE_LEN];
+
+static midi_event_cb_t task_local_cb;
+static midi_merge_sysex_cb_t task_sysex_cb;
+static midi_task_subscribe_cb_t task_subscribe_cb;
+static void *task_cb_arg;
+static bool task_started;
+static midi_task_stats_t task_stats;
+
+/* Private functions */
+static task_msg_t *msg_get(bool control) {
+    if (!control && midi_pool_available() <= CONTROL_RESERVE) {
+        return NULL;
+    }
+    return midi_pool_alloc();
+}
+
+static void msg_post(task_msg_t *msg) {
+    msg->rx_us = esp_timer_get_time();
+    lf_spsc_push(&rx_queue, msg);
+}
+
+static void post_control(msg_type_t type, uint16_t handle, bool enabled) {
+    /* Local variables */
+    task_msg_t *msg = msg_get(true);
+
+    if (msg == NULL) {
+        ESP_LOGE(TAG, "MIDI task queue exhausted, lost event %d for %d", type,
+                 handle);
+        return;
+    }
+    msg->type = type;
+    msg->handle = handle;
+    msg->enabled = enabled;
+    msg->len = 0;
+    msg_post(msg);
+}
+
+static void task_handle(task_msg_t *msg) {
+    /* Local variables */
+    uint32_t start, trace_start;
+    int slot, rc;
+
+    if (msg->type == MSG_START) {
+        midi_merge_init(msg->handle, task_local_cb, task_sysex_cb,
+                        task_cb_arg);
+        task_started = true;
+        return;
+    }
+    if (!task_started) {
+        return;
+    }
+
+    switch (msg->type) {
+    case MSG_CONNECT:
+        midi_merge_connect(msg->handle);
+        break;
+    case MSG_DISCONNECT:
+        midi_merge_disconnect(msg->handle);
+        break;
+    case MSG_SUBSCRIBE:
+        slot = midi_merge_slot(msg->handle);
+        if (msg->enabled && task_subscribe_cb &&
+            (slot == MIDI_MERGE_NO_SLOT || !midi_out_is_open(slot))) {
+            task_subscribe_cb(msg->handle, task_cb_arg);
+        }
+        midi_merge_subscribe(msg->handle, msg->enabled);
+        break;
+    case MSG_WRITE:
+        /* The write arrived on the other core, whose cycle counter is not
+         * comparable, so the hand-off is timed with esp_timer */
+        midi_stats_record(MIDI_STATS_HANDOFF,
+                          ((uint32_t)esp_timer_get_time() - msg->rx_us) *
+                              CYCLES_PER_US);
+        trace_start = trace_begin();
+        start = esp_cpu_get_cycle_count();
+        rc = midi_merge_input(msg->handle, msg->data, msg->len);
+        midi_stats_record(MIDI_STATS_DECODE, esp_cpu_get_cycle_count() - start);
+        trace_end(TRACE_MIDI_DECODE, trace_start, msg->len);
+        if (rc != 0) {
+            task_stats.malformed++;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ *  Drain everything the host task queued, then send the result in one flush
+ *  per destination. Sleeps until the next write, until a thinned
+ *  controller value is due or until refused output is retried.
+ */
+static void midi_task(void *param) {
+    /* Local variables */
+    TickType_t timeout = portMAX_DELAY;
+    task_msg_t *msg;
+    uint32_t start, trace_start, oldest_us;
+    bool wrote;
+    int32_t next;
+
+    for (;;) {
+        msg = lf_spsc_pop_wait(&rx_queue, timeout);
+        wrote = false;
+        oldest_us = 0;
+        while (msg != NULL) {
+            if (msg->type == MSG_WRITE && !wrote) {
+                wrote = true;
+                oldest_us = msg->rx_us;
+            }
+            task_handle(msg);
+            midi_pool_free(msg);
+            msg = lf_spsc_pop(&rx_queue);
+        }
+        if (!task_started) {
+            continue;
+        }
+
+        trace_start = trace_begin();
+        start = esp_cpu_get_cycle_count();
+        next = midi_merge_poll();
+        midi_stats_record(MIDI_STATS_OUTPUT, esp_cpu_get_cycle_count() - start);
+        trace_end(TRACE_MIDI_OUTPUT, trace_start, 0);
+        /* Worst case of the batch: its oldest write */
+        if (wrote) {
+            midi_stats_record(MIDI_STATS_TOTAL,
+                              ((uint32_t)esp_timer_get_time() - oldest_us) *
+                                  CYCLES_PER_US);
+        }
+
+        if (next < 0) {
+            timeout = portMAX_DELAY;
+        } else {
+            timeout = (next + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+            if (timeout == 0) {
+                timeout = 1;
+            }
+        }
+    }
+}
+
+/* Public functions */
+/*
+ *  MIDI task initialization
+ *      - Set up the hand-off queue, messages come from the MIDI pool, so
+ *        midi_pool_init() must have run
+ *      - Start the MIDI task, pinned away from the NimBLE host on dual-core
+ *        targets
+ */
+void midi_task_init(midi_event_cb_t local_cb, midi_merge_sysex_cb_t sysex_cb,
+                    midi_task_subscribe_cb_t subscribe_cb, void *arg) {
+    /* Local variables */
+    BaseType_t rc;
+
+    task_local_cb = local_cb;
+    task_sysex_cb = sysex_cb;
+    task_subscribe_cb = subscribe_cb;
+    task_cb_arg = arg;
+    task_started = false;
+    memset(&task_stats, 0, sizeof(task_stats));
+
+    lf_spsc_init(&rx_queue, rx_slots, TASK_QUEUE_LEN);
+
+#if CONFIG_FREERTOS_UNICORE
+    rc = xTaskCreate(midi_task, "midi", TASK_STACK_SIZE, NULL,
+                     CONFIG_MIDI_TASK_PRIORITY, NULL);
+#else
+    rc = xTaskCreatePinnedToCore(midi_task, "midi", TASK_STACK_SIZE, NULL,
+                                 CONFIG_MIDI_TASK_PRIORITY, NULL,
+                                 CONFIG_MIDI_TASK_CORE);
+#endif
+    if (rc != pdPASS) {
+        ESP_LOGE(TAG, "failed to start MIDI task");
+    }
+}
+
+/* Attribute handles are only known once the host has synced */
+void midi_task_start(uint16_t chr_val_handle) {
+    post_control(MSG_START, chr_val_handle, false);
+}
+
+/*
+ *  Called from the GATT access callback: copy the write into a free buffer
+ *  and hand it to the MIDI task, nothing else happens on the host task
+ */
+int midi_task_input(uint16_t conn_handle, const struct os_mbuf *om) {
+    /* Local variables */
+    task_msg_t *msg = msg_get(false);
+    uint16_t len = 0;
+
+    if (msg == NULL) {
+        task_stats.rx_dropped++;
+        trace_instant(TRACE_MIDI_RX_DROPPED, conn_handle);
+        return BLE_HS_ENOMEM;
+    }
+    if (ble_hs_mbuf_to_flat(om, msg->data, sizeof(msg->data), &len) != 0) {
+        midi_pool_free(msg);
+        return BLE_HS_EMSGSIZE;
+    }
+
+    msg->type = MSG_WRITE;
+    msg->handle = conn_handle;
+    msg->len = len;
+    msg_post(msg);
+    return 0;
+}
+
+void midi_task_connect(uint16_t conn_handle) {
+    post_control(MSG_CONNECT, conn_handle, false);
+}
+
+void midi_task_disconnect(uint16_t conn_handle) {
+    post_control(MSG_DISCONNECT, conn_handle, false);
+}
+
+void midi_task_subscribe(uint16_t conn_handle, bool enabled) {
+    post_control(MSG_SUBSCRIBE, conn_handle, enabled);
+}
+
+void midi_task_get_stats(midi_task_stats_t *stats) { *stats = task_stats; }
@@ -0,0 +1,251 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "midi_thin.h"
+#include <string.h>
+
+/* Private function declarations */
+static bool is_thinnable(const midi_event_t *ev);
+static bool same_key(const midi_event_t *a, const midi_event_t *b);
+static bool repeats_last(const midi_thin_t *thin, const midi_event_t *ev);
+static void forget_channel(midi_thin_t *thin, uint8_t ch);
+static void thin_emit(midi_thin_t *thin, const midi_event_t *ev);
+static midi_thin_slot_t *find_slot(midi_thin_t *thin, const midi_event_t *ev);
+
+/* Private functions */
+static bool is_thinnable(const midi_event_t *ev) {
+    switch (MIDI_STATUS_TYPE(ev->data[0])) {
+    case MIDI_CONTROL_CHANGE:
+        switch (ev->data[1]) {
+        case 0:   /* Bank select */
+        case 32:
+        case 6:   /* Data entry */
+        case 38:
+        case 96:  /* Data increment/decrement */
+        case 97:
+        case 98:  /* (N)RPN select */
+        case 99:
+        case 100:
+        case 101:
+            /* Parameter protocols depend on every message and its order */
+            return false;
+        default:
+            /* Channel mode messages are commands, not continuous values */
+            return ev->data[1] < 120;
+        }
+    case MIDI_PITCH_BEND:
+    case MIDI_CHANNEL_PRESSURE:
+    case MIDI_POLY_PRESSURE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool same_key(const midi_event_t *a, const midi_event_t *b) {
+    if (a->data[0] != b->data[0]) {
+        return false;
+    }
+    switch (MIDI_STATUS_TYPE(a->data[0])) {
+    case MIDI_CONTROL_CHANGE:
+    case MIDI_POLY_PRESSURE:
+        return a->data[1] == b->data[1];
+    default:
+        return true;
+    }
+}
+
+static bool repeats_last(const midi_thin_t *thin, const midi_event_t *ev) {
+    /* Local variables */
+    uint8_t ch = MIDI_STATUS_CHANNEL(ev->data[0]);
+
+    if (!thin->drop_repeats) {
+        return false;
+    }
+    switch (MIDI_STATUS_TYPE(ev->data[0])) {
+    case MIDI_CONTROL_CHANGE:
+        return thin->last_cc[ch][ev->data[1]] == ev->data[2];
+    case MIDI_PITCH_BEND:
+        return thin->last_bend[ch] ==
+               (ev->data[1] | ((uint16_t)ev->data[2] << 7));
+    case MIDI_CHANNEL_PRESSURE:
+        return thin->last_pressure[ch] == ev->data[1];
+    default:
+        return false;
+    }
+}
+
+static void forget_channel(midi_thin_t *thin, uint8_t ch) {
+    memset(thin->last_cc[ch], 0xFF, sizeof(thin->last_cc[ch]));
+    thin->last_bend[ch] = 0xFFFF;
+    thin->last_pressure[ch] = 0xFF;
+}
+
+static void thin_emit(midi_thin_t *thin, const midi_event_t *ev) {
+    /* Local variables */
+    uint8_t ch = MIDI_STATUS_CHANNEL(ev->data[0]);
+
+    switch (MIDI_STATUS_TYPE(ev->data[0])) {
+    case MIDI_CONTROL_CHANGE:
+        if (ev->data[1] < 120) {
+            thin->last_cc[ch][ev->data[1]] = ev->data[2];
+        } else if (ev->data[1] == 121) {
+            /* Receivers reset their controllers, our view is stale */
+            forget_channel(thin, ch);
+        }
+        break;
+    case MIDI_PITCH_BEND:
+        thin->last_bend[ch] = ev->data[1] | ((uint16_t)ev->data[2] << 7);
+        break;
+    case MIDI_CHANNEL_PRESSURE:
+        thin->last_pressure[ch] = ev->data[1];
+        break;
+    default:
+        if (ev->data[0] == MIDI_SYSTEM_RESET) {
+            for (ch = 0; ch < 16; ch++) {
+                forget_channel(thin, ch);
+            }
+        }
+        break;
+    }
+
+    thin->stats.passed++;
+    thin->emit(ev, thin->arg);
+}
+
+static midi_thin_slot_t *find_slot(midi_thin_t *thin, const midi_event_t *ev) {
+    for (int i = 0; i < CONFIG_MIDI_THIN_SLOTS; i++) {
+        if (thin->slots[i].used && same_key(&thin->slots[i].ev, ev)) {
+            return &thin->slots[i];
+        }
+    }
+    return NULL;
+}
+
+/* Public functions */
+void midi_thin_init(midi_thin_t *thin, uint16_t window_ms, bool drop_repeats,
+                    midi_event_cb_t emit, void *arg) {
+    memset(thin, 0, sizeof(*thin));
+    thin->window_ms = window_ms;
+    thin->drop_repeats = drop_repeats;
+    thin->emit = emit;
+    thin->arg = arg;
+    for (uint8_t ch = 0; ch < 16; ch++) {
+        forget_channel(thin, ch);
+    }
+}
+
+void midi_thin_input(midi_thin_t *thin, const midi_event_t *ev,
+                     uint32_t now_ms) {
+    /* Local variables */
+    midi_thin_slot_t *slot;
+
+    if (MIDI_IS_REALTIME(ev->data[0]) && ev->data[0] != MIDI_SYSTEM_RESET) {
+        /* Clock and active sensing are not ordered against controllers and
+         * would otherwise flush every few milliseconds */
+        thin_emit(thin, ev);
+        return;
+    }
+    if (!is_thinnable(ev)) {
+        /* Release held values first so nothing moves across this message */
+        midi_thin_flush(thin, now_ms);
+        thin_emit(thin, ev);
+        return;
+    }
+
+    slot = thin->window_ms ? find_slot(thin, ev) : NULL;
+    if (slot != NULL && now_ms - slot->emitted_at < thin->window_ms) {
+        /* Window still open, keep only the latest value */
+        if (slot->pending) {
+            thin->stats.coalesced++;
+        } else if (repeats_last(thin, ev)) {
+            thin->stats.dropped++;
+            return;
+        }
+        slot->ev = *ev;
+        slot->pending = !repeats_last(thin, ev);
+        return;
+    }
+
+    if (slot != NULL && slot->pending) {
+        /* Window expired before it was polled, the new value wins */
+        slot->pending = false;
+        thin->stats.coalesced++;
+    }
+    if (repeats_last(thin, ev)) {
+        thin->stats.dropped++;
+        return;
+    }
+    thin_emit(thin, ev);
+    if (thin->window_ms == 0) {
+        return;
+    }
+
+    /* Open a window for this controller, without a free slot it simply
+     * passes unthinned */
+    if (slot == NULL) {
+        for (int i = 0; i < CONFIG_MIDI_THIN_SLOTS; i++) {
+            if (!thin->slots[i].used) {
+                slot = &thin->slots[i];
+                slot->used = true;
+                break;
+            }
+        }
+    }
+    if (slot != NULL) {
+        slot->ev = *ev;
+        slot->emitted_at = now_ms;
+        slot->pending = false;
+    }
+}
+
+/*
+ *  Close expired windows, sending their held value. Returns the time in ms
+ *  until the next held value is due, or -1 if nothing is held.
+ */
+int32_t midi_thin_poll(midi_thin_t *thin, uint32_t now_ms) {
+    /* Local variables */
+    midi_thin_slot_t *slot;
+    int32_t next = -1;
+    uint32_t age;
+
+    for (int i = 0; i < CONFIG_MIDI_THIN_SLOTS; i++) {
+        slot = &thin->slots[i];
+        if (!slot->used) {
+            continue;
+        }
+        age = now_ms - slot->emitted_at;
+        if (age < thin->window_ms) {
+            if (slot->pending &&
+                (next < 0 || (int32_t)(thin->window_ms - age) < next)) {
+                next = thin->window_ms - age;
+            }
+            continue;
+        }
+        if (slot->pending) {
+            /* Restart the window with the value just sent */
+            slot->pending = false;
+            slot->emitted_at = now_ms;
+            thin_emit(thin, &slot->ev);
+        } else {
+            slot->used = false;
+        }
+    }
+    return next;
+}
+
+/* Send every held value now */
+void midi_thin_flush(midi_thin_t *thin, uint32_t now_ms) {
+    /* Local variables */
+    midi_thin_slot_t *slot;
+
+    for (int i = 0; i < CONFIG_MIDI_THIN_SLOTS; i++) {
+        slot = &thin->slots[i];
+        if (slot->used && slot->pending) {
+            slot->pending = false;
+            slot->emitted_at = now_ms;
+            thin_emit(thin, &slot->ev);
+        }
+    }
+}
@@ -0,0 +1,198 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "ppg.h"
+#include <math.h>
+#include <string.h>
+
+/* Defines */
+#define PPG_Q 30
+#define PPG_IN_SHIFT 6 /* fractional bits carried through the filter */
+
+#define PPG_LOW_HZ 0.5f
+#define PPG_HIGH_HZ 4.0f
+
+/* Plausible RR intervals, 30-200 BPM */
+#define PPG_RR_MIN_MS 300
+#define PPG_RR_MAX_MS 2000
+#define PPG_RR_MAX_REJECTS 3
+#define PPG_LOST_MS 3000
+
+/* Private function declarations */
+static int32_t ppg_filter(ppg_t *ppg, int32_t x);
+static void ppg_beat(ppg_t *ppg, uint32_t t);
+static void ppg_rr_reset(ppg_t *ppg);
+
+/* Private functions */
+/* Input magnitudes up to 2^24 keep the scaled sample within int32 */
+static int32_t ppg_filter(ppg_t *ppg, int32_t x) {
+    /* Local variables */
+    int64_t acc;
+    int32_t y;
+
+    x <<= PPG_IN_SHIFT;
+    /* b1 is zero and b2 is -b0 for this band-pass */
+    acc = (int64_t)ppg->b0 * (x - ppg->x2) - (int64_t)ppg->a1 * ppg->y1 -
+          (int64_t)ppg->a2 * ppg->y2;
+    y = (int32_t)(acc >> PPG_Q);
+
+    ppg->x2 = ppg->x1;
+    ppg->x1 = x;
+    ppg->y2 = ppg->y1;
+    ppg->y1 = y;
+    return y;
+}
+
+static void ppg_rr_reset(ppg_t *ppg) {
+    ppg->rr_count = 0;
+    ppg->rr_pos = 0;
+    ppg->rr_sum = 0;
+    ppg->rejected = 0;
+}
+
+/* A beat at sample t, turn it into an RR interval if it is plausible */
+static void ppg_beat(ppg_t *ppg, uint32_t t) {
+    /* Local variables */
+    uint32_t rr;
+    uint32_t mean;
+    uint8_t head;
+
+    if (!ppg->have_beat) {
+        ppg->have_beat = true;
+        ppg->last_beat = t;
+        return;
+    }
+
+    rr = (t - ppg->last_beat) * 1000 / ppg->sample_rate;
+    ppg->last_beat = t;
+    if (rr < PPG_RR_MIN_MS || rr > PPG_RR_MAX_MS) {
+        return;
+    }
+
+    /* Drop intervals far off the average unless they keep coming */
+    if (ppg->rr_count > 0) {
+        mean = ppg->rr_sum / ppg->rr_count;
+        if (rr * 3 < mean * 2 || rr * 2 > mean * 3) {
+            if (++ppg->rejected < PPG_RR_MAX_REJECTS) {
+                return;
+            }
+            ppg_rr_reset(ppg);
+        }
+    }
+    ppg->rejected = 0;
+
+    if (ppg->rr_count == PPG_RR_AVERAGE) {
+        ppg->rr_sum -= ppg->rr[ppg->rr_pos];
+    } else {
+        ppg->rr_count++;
+    }
+    ppg->rr[ppg->rr_pos] = rr;
+    ppg->rr_pos = (ppg->rr_pos + 1) % PPG_RR_AVERAGE;
+    ppg->rr_sum += rr;
+
+    mean = ppg->rr_sum / ppg->rr_count;
+    atomic_store_explicit(&ppg->bpm, (60000 + mean / 2) / mean,
+                          memory_order_relaxed);
+
+    /* Queue the interval, the oldest one goes if nobody reads them */
+    head = atomic_load_explicit(&ppg->rr_head, memory_order_relaxed);
+    ppg->rr_queue[head % PPG_RR_QUEUE] = rr;
+    atomic_store_explicit(&ppg->rr_head, head + 1, memory_order_release);
+}
+
+/* Public functions */
+/*
+ *  Set up the pipeline for a sample rate. Only the filter design uses
+ *  floating point, once here.
+ */
+void ppg_init(ppg_t *ppg, uint32_t sample_rate) {
+    /* Local variables */
+    float f0 = sqrtf(PPG_LOW_HZ * PPG_HIGH_HZ);
+    float q = f0 / (PPG_HIGH_HZ - PPG_LOW_HZ);
+    float w0 = 2.0f * (float)M_PI * f0 / sample_rate;
+    float alpha = sinf(w0) / (2.0f * q);
+    float a0 = 1.0f + alpha;
+
+    memset(ppg, 0, sizeof(*ppg));
+
+    /* RBJ band-pass with 0 dB peak gain, normalized by a0 */
+    ppg->b0 = (int32_t)lroundf(alpha / a0 * (1 << PPG_Q));
+    ppg->a1 = (int32_t)lroundf(-2.0f * cosf(w0) / a0 * (1 << PPG_Q));
+    ppg->a2 = (int32_t)lroundf((1.0f - alpha) / a0 * (1 << PPG_Q));
+
+    ppg->sample_rate = sample_rate;
+    ppg->refractory = sample_rate * PPG_RR_MIN_MS / 1000;
+}
+
+/*
+ *  Run a block of raw samples through the pipeline. Beats are taken at
+ *  local maxima of the filtered signal whose rise from the preceding local
+ *  minimum reaches half of a decaying envelope of recent rises, outside the
+ *  refractory time after the last beat. Measuring the upstroke rather than
+ *  the level keeps respiratory baseline wander, which the band-pass only
+ *  partly removes, from hiding whole pulses.
+ */
+void ppg_process(ppg_t *ppg, const int32_t *samples, size_t count) {
+    /* Local variables */
+    int32_t y, rise;
+    uint32_t decay = ppg->sample_rate * 3 / 2;
+
+    for (size_t i = 0; i < count; i++, ppg->n++) {
+        y = ppg_filter(ppg, samples[i]);
+
+        ppg->envelope -= ppg->envelope / (int32_t)decay;
+
+        if (y > ppg->prev) {
+            if (!ppg->rising) {
+                /* The previous sample was a local minimum */
+                ppg->trough = ppg->prev;
+            }
+            ppg->rising = true;
+        } else if (y < ppg->prev && ppg->rising) {
+            /* The previous sample was a local maximum */
+            ppg->rising = false;
+            rise = ppg->prev - ppg->trough;
+            if (rise > ppg->envelope) {
+                ppg->envelope = rise;
+            }
+            if (rise > ppg->envelope / 2 &&
+                (!ppg->have_beat ||
+                 ppg->n - 1 - ppg->last_beat >= ppg->refractory)) {
+                ppg_beat(ppg, ppg->n - 1);
+            }
+        }
+        ppg->prev = y;
+
+        /* Signal lost, forget the rate */
+        if (ppg->have_beat && ppg->n - ppg->last_beat >
+                                  ppg->sample_rate * PPG_LOST_MS / 1000) {
+            ppg->have_beat = false;
+            ppg_rr_reset(ppg);
+            atomic_store_explicit(&ppg->bpm, 0, memory_order_relaxed);
+        }
+    }
+}
+
+/* Averaged heart rate, 0 until enough beats were seen */
+uint16_t ppg_bpm(const ppg_t *ppg) {
+    return atomic_load_explicit(&ppg->bpm, memory_order_relaxed);
+}
+
+/* Pop the oldest queued RR interval in ms, false if there is none */
+bool ppg_pop_rr(ppg_t *ppg, uint16_t *rr_ms) {
+    /* Local variables */
+    uint8_t head = atomic_load_explicit(&ppg->rr_head, memory_order_acquire);
+    uint8_t tail = atomic_load_explicit(&ppg->rr_tail, memory_order_relaxed);
+
+    if (head == tail) {
+        return false;
+    }
+    /* Skip what the producer has overwritten meanwhile */
+    if ((uint8_t)(head - tail) > PPG_RR_QUEUE) {
+        tail = head - PPG_RR_QUEUE;
+    }
+    *rr_ms = ppg->rr_queue[tail % PPG_RR_QUEUE];
+    atomic_store_explicit(&ppg->rr_tail, tail + 1, memory_order_relaxed);
+    return true;
+}
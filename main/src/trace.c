@@ -0,0 +1,119 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "trace.h"
+
+#if CONFIG_TRACE_ENTRIES > 0
+
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include <stdatomic.h>
+#include <string.h>
+
+/* Defines */
+#define TRACE_MASK (CONFIG_TRACE_ENTRIES - 1)
+
+_Static_assert((CONFIG_TRACE_ENTRIES & TRACE_MASK) == 0,
+               "TRACE_ENTRIES must be a power of two");
+
+/* Private types */
+typedef struct {
+    uint32_t start_us;
+    uint32_t dur_us;
+    uint8_t id;
+    uint8_t core;
+    uint16_t arg;
+} trace_record_t;
+
+_Static_assert(sizeof(trace_record_t) == TRACE_RECORD_SIZE,
+               "trace records must match the documented layout");
+
+/* Private function declarations */
+static void trace_put(trace_id_t id, uint32_t start, uint32_t dur,
+                      uint16_t arg);
+
+/* Private variables */
+/*
+ * Writers on either core claim a record with one atomic increment and
+ * overwrite the oldest entry once the ring wraps. Dumping stops recording,
+ * so the ring holds still while it is read out.
+ */
+static trace_record_t records[CONFIG_TRACE_ENTRIES];
+static _Atomic uint32_t trace_head;
+static _Atomic bool trace_enabled = true;
+static uint32_t dump_pos;
+static uint32_t dump_end;
+
+/* Private functions */
+static void trace_put(trace_id_t id, uint32_t start, uint32_t dur,
+                      uint16_t arg) {
+    /* Local variables */
+    trace_record_t *rec;
+
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+        return;
+    }
+    rec = &records[atomic_fetch_add_explicit(&trace_head, 1,
+                                             memory_order_relaxed) &
+                   TRACE_MASK];
+    rec->start_us = start;
+    rec->dur_us = dur;
+    rec->id = id;
+    rec->core = esp_cpu_get_core_id();
+    rec->arg = arg;
+}
+
+/* Public functions */
+uint32_t trace_begin(void) { return esp_timer_get_time(); }
+
+void trace_end(trace_id_t id, uint32_t start, uint16_t arg) {
+    trace_put(id, start, (uint32_t)esp_timer_get_time() - start, arg);
+}
+
+void trace_instant(trace_id_t id, uint16_t arg) {
+    trace_put(id, esp_timer_get_time(), 0, arg);
+}
+
+void trace_command(uint8_t cmd) {
+    /* Local variables */
+    uint32_t head;
+
+    switch (cmd) {
+    case TRACE_CMD_DUMP:
+        atomic_store(&trace_enabled, false);
+        head = atomic_load(&trace_head);
+        dump_end = head;
+        dump_pos = head > CONFIG_TRACE_ENTRIES ? head - CONFIG_TRACE_ENTRIES
+                                               : 0;
+        break;
+    case TRACE_CMD_RESUME:
+        atomic_store(&trace_head, 0);
+        dump_pos = dump_end = 0;
+        atomic_store(&trace_enabled, true);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ *  Copy the next whole records of a dump into buf, oldest first. Returns 0
+ *  once the dump is complete or when no dump was requested.
+ */
+size_t trace_read(uint8_t *buf, size_t cap) {
+    /* Local variables */
+    size_t len = 0;
+
+    if (atomic_load(&trace_enabled)) {
+        return 0;
+    }
+    while (dump_pos != dump_end && len + TRACE_RECORD_SIZE <= cap) {
+        memcpy(&buf[len], &records[dump_pos & TRACE_MASK], TRACE_RECORD_SIZE);
+        len += TRACE_RECORD_SIZE;
+        dump_pos++;
+    }
+    return len;
+}
+
+#endif // CONFIG_TRACE_ENTRIES > 0
@@ -0,0 +1,292 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/*
+ * Pixels set per write of the LED frame characteristic, see led_frame.h,
+ * and the cost of applying them with the firmware's led_frame.c.
+ *
+ * Each workload is a full strip image, packed into writes of at most
+ * ATT MTU - 3 bytes as a central would send them, applied to a host
+ * framebuffer and checked against the image. "pixel" is the baseline of
+ * one pixel per write, as with the single on/off LED characteristic.
+ *
+ *   led_bench [pixels [ATT MTU]]
+ */
+/* Includes */
+#include "esp_timer.h"
+#include "led_frame.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#else
+#define HAVE_CYCLES 0
+#endif
+
+/* Defines */
+#define DEFAULT_PIXELS 300
+#define MAX_PIXELS 4096
+#define WRITE_MAX 512 /* longest attribute value ATT allows */
+#define FRAMES 200    /* repetitions of each workload for timing */
+#define SEGMENTS 10   /* solid stretches of the "runs" image */
+
+/* Private types */
+typedef enum {
+    WORK_PIXEL,
+    WORK_RANGE,
+    WORK_FILL,
+    WORK_RUNS,
+    WORK_INDEXED,
+    WORK_COUNT,
+} work_t;
+
+typedef struct {
+    uint8_t buf[WRITE_MAX];
+    size_t len;
+    size_t max;
+    led_frame_t *frame;
+    uint64_t cycles;
+    uint32_t writes;
+    uint32_t bytes;
+    uint32_t pixels;
+} writer_t;
+
+/* Private function declarations */
+static void fb_set(uint16_t index, uint8_t r, uint8_t g, uint8_t b, void *arg);
+static uint64_t now_cycles(void);
+static void flush(writer_t *w);
+static uint8_t *reserve(writer_t *w, size_t len);
+static void put_u16(uint8_t *p, uint16_t v);
+static void encode(writer_t *w, work_t work, uint16_t num_pixels);
+static void build_image(work_t work, uint16_t num_pixels);
+
+/* Private variables */
+static const char *work_names[WORK_COUNT] = {"pixel", "range", "fill", "runs",
+                                             "indexed"};
+static uint8_t fb[MAX_PIXELS][3];
+static uint8_t image[MAX_PIXELS][3];
+static uint8_t image_index[MAX_PIXELS];
+static uint8_t palette[LED_FRAME_PALETTE_SIZE][3];
+
+/* Private functions */
+static void fb_set(uint16_t index, uint8_t r, uint8_t g, uint8_t b,
+                   void *arg) {
+    fb[index][0] = r;
+    fb[index][1] = g;
+    fb[index][2] = b;
+}
+
+static uint64_t now_cycles(void) {
+#if HAVE_CYCLES
+    return __rdtsc();
+#else
+    return esp_timer_get_time() * 1000;
+#endif
+}
+
+/* Send the pending operations as one write */
+static void flush(writer_t *w) {
+    /* Local variables */
+    uint64_t start;
+    int pixels;
+
+    if (w->len == 0) {
+        return;
+    }
+    start = now_cycles();
+    pixels = led_frame_apply(w->frame, w->buf, w->len);
+    w->cycles += now_cycles() - start;
+    if (pixels < 0) {
+        fprintf(stderr, "frame rejected\n");
+        exit(1);
+    }
+    w->writes++;
+    w->bytes += w->len;
+    w->pixels += pixels;
+    w->len = 0;
+}
+
+/* Room for len more bytes in the current write, starting a new one if full */
+static uint8_t *reserve(writer_t *w, size_t len) {
+    /* Local variables */
+    uint8_t *p;
+
+    if (w->len + len > w->max) {
+        flush(w);
+    }
+    p = w->buf + w->len;
+    w->len += len;
+    return p;
+}
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+/* Pack the image the way the workload calls for */
+static void encode(writer_t *w, work_t work, uint16_t num_pixels) {
+    /* Local variables */
+    uint16_t i = 0, n;
+    size_t room;
+    uint8_t *p;
+
+    switch (work) {
+    case WORK_PIXEL:
+        for (i = 0; i < num_pixels; i++) {
+            p = reserve(w, 1 + 3 + 3);
+            p[0] = LED_FRAME_OP_RANGE;
+            put_u16(p + 1, i);
+            p[3] = 1;
+            memcpy(p + 4, image[i], 3);
+            flush(w);
+        }
+        break;
+
+    case WORK_RANGE:
+        while (i < num_pixels) {
+            room = w->max - w->len;
+            if (room < 1 + 3 + 3) {
+                flush(w);
+                continue;
+            }
+            n = (room - 4) / 3;
+            n = n > 255 ? 255 : n;
+            n = n > num_pixels - i ? num_pixels - i : n;
+            p = reserve(w, 4 + n * 3);
+            p[0] = LED_FRAME_OP_RANGE;
+            put_u16(p + 1, i);
+            p[3] = n;
+            memcpy(p + 4, image[i], n * 3);
+            i += n;
+        }
+        break;
+
+    case WORK_FILL:
+    case WORK_RUNS:
+        while (i < num_pixels) {
+            n = 1;
+            while (i + n < num_pixels &&
+                   memcmp(image[i + n], image[i], 3) == 0) {
+                n++;
+            }
+            p = reserve(w, 8);
+            p[0] = LED_FRAME_OP_FILL;
+            put_u16(p + 1, i);
+            put_u16(p + 3, n);
+            memcpy(p + 5, image[i], 3);
+            i += n;
+        }
+        break;
+
+    case WORK_INDEXED:
+        for (int c = 0; c < LED_FRAME_PALETTE_SIZE; c++) {
+            p = reserve(w, 5);
+            p[0] = LED_FRAME_OP_PALETTE;
+            p[1] = c;
+            memcpy(p + 2, palette[c], 3);
+        }
+        while (i < num_pixels) {
+            room = w->max - w->len;
+            if (room < 5 + 1) {
+                flush(w);
+                continue;
+            }
+            n = (room - 5) * 2;
+            n = n > num_pixels - i ? num_pixels - i : n;
+            p = reserve(w, 5 + (n + 1) / 2);
+            p[0] = LED_FRAME_OP_INDEXED;
+            put_u16(p + 1, i);
+            put_u16(p + 3, n);
+            memset(p + 5, 0, (n + 1) / 2);
+            for (uint16_t k = 0; k < n; k++) {
+                p[5 + k / 2] |= image_index[i + k] << (k & 1) * 4;
+            }
+            i += n;
+        }
+        break;
+
+    default:
+        break;
+    }
+    flush(w);
+}
+
+static void build_image(work_t work, uint16_t num_pixels) {
+    for (uint16_t i = 0; i < num_pixels; i++) {
+        switch (work) {
+        case WORK_FILL:
+            image[i][0] = 0x20;
+            image[i][1] = 0x10;
+            image[i][2] = 0x40;
+            break;
+        case WORK_RUNS:
+            image[i][0] = (i * SEGMENTS / num_pixels) * 25;
+            image[i][1] = 0x80;
+            image[i][2] = 255 - image[i][0];
+            break;
+        case WORK_INDEXED:
+            image_index[i] = (i / 4 + i * 7) % LED_FRAME_PALETTE_SIZE;
+            memcpy(image[i], palette[image_index[i]], 3);
+            break;
+        default:
+            image[i][0] = rand();
+            image[i][1] = rand();
+            image[i][2] = rand();
+            break;
+        }
+    }
+}
+
+/* Public functions */
+int main(int argc, char **argv) {
+    /* Local variables */
+    static led_frame_t frame;
+    long num_pixels = argc > 1 ? strtol(argv[1], NULL, 0) : DEFAULT_PIXELS;
+    long mtu = argc > 2 ? strtol(argv[2], NULL, 0)
+                        : CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU;
+    writer_t w;
+
+    if (num_pixels < 1 || num_pixels > MAX_PIXELS || mtu < 23 ||
+        mtu - 3 > WRITE_MAX) {
+        fprintf(stderr, "usage: %s [pixels 1-%d [ATT MTU 23-%d]]\n", argv[0],
+                MAX_PIXELS, WRITE_MAX + 3);
+        return 2;
+    }
+
+    srand(1);
+    for (int c = 0; c < LED_FRAME_PALETTE_SIZE; c++) {
+        palette[c][0] = c * 16;
+        palette[c][1] = 255 - c * 16;
+        palette[c][2] = c * 5;
+    }
+
+    printf("%ld pixels, ATT MTU %ld, writes of up to %ld bytes\n", num_pixels,
+           mtu, mtu - 3);
+    printf("%-8s %12s %12s %12s %10s\n", "image", "writes/frame",
+           "pixels/write", "bytes/write", HAVE_CYCLES ? "cycles/px" : "ns/px");
+    for (int work = 0; work < WORK_COUNT; work++) {
+        build_image(work, num_pixels);
+        led_frame_init(&frame, num_pixels, fb_set, NULL);
+        memset(&w, 0, sizeof(w));
+        w.max = mtu - 3;
+        w.frame = &frame;
+
+        for (int f = 0; f < FRAMES; f++) {
+            memset(fb, 0, sizeof(fb));
+            encode(&w, work, num_pixels);
+            if (memcmp(fb, image, num_pixels * 3) != 0) {
+                fprintf(stderr, "%s: framebuffer differs from the image\n",
+                        work_names[work]);
+                return 1;
+            }
+        }
+        printf("%-8s %12.1f %12.1f %12.1f %10.2f\n", work_names[work],
+               (double)w.writes / FRAMES, (double)w.pixels / w.writes,
+               (double)w.bytes / w.writes, (double)w.cycles / w.pixels);
+    }
+    return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/*
+ * Air-time model of MIDI notifications on the 1M and 2M PHYs, with the
+ * default 27 byte and the extended 251 byte link-layer payload.
+ *
+ * Notifications are built with the firmware's BLE-MIDI packet code at the
+ * preferred ATT MTU, split into LL PDUs and sent in connection events: each
+ * data PDU is answered by an empty one from the central, 150 us apart, until
+ * the next PDU would run past the connection interval or the per-event limit
+ * of the central is reached. Unencrypted links, no retransmissions.
+ *
+ *   link_bench [interval ms] [PDUs per event, 0 = no limit]
+ */
+/* Includes */
+#include "midi.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Defines */
+#define DEFAULT_INTERVAL_US 7500
+#define MTU CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU
+#define NOTIFY_PAYLOAD (MTU - 3)
+#define L2CAP_HDR 4
+#define ATT_NOTIFY_HDR 3
+#define T_IFS_US 150
+/* Preamble, access address, header and CRC around each LL payload */
+#define LL_OVERHEAD(phy) ((phy) == 2 ? 2 + 4 + 2 + 3 : 1 + 4 + 2 + 3)
+
+#define SYSEX_LEN 4096
+#define NOTE_BURSTS 200
+#define NOTES_PER_BURST 10
+#define MAX_NOTIFIES 1024
+
+/* Private types */
+typedef struct {
+    const char *name;
+    uint16_t lens[MAX_NOTIFIES]; /* ATT value length of each notification */
+    int count;
+    size_t midi_bytes;
+} workload_t;
+
+/* Private function declarations */
+static void add_packet(workload_t *w, midi_packet_t *pkt, uint8_t *buf);
+static void build_sysex(workload_t *w);
+static void build_notes(workload_t *w);
+static uint32_t pdu_us(int phy, int payload);
+static uint32_t run(const workload_t *w, int phy, int max_octets,
+                    uint32_t interval_us, int per_event, int *pdus);
+
+/* Private functions */
+static void add_packet(workload_t *w, midi_packet_t *pkt, uint8_t *buf) {
+    if (!midi_packet_empty(pkt) && w->count < MAX_NOTIFIES) {
+        w->lens[w->count++] = pkt->len;
+    }
+    midi_packet_init(pkt, buf, NOTIFY_PAYLOAD, 0);
+}
+
+/* One SysEx dump, as a patch librarian sends */
+static void build_sysex(workload_t *w) {
+    /* Local variables */
+    static uint8_t sysex[SYSEX_LEN];
+    uint8_t buf[NOTIFY_PAYLOAD];
+    midi_packet_t pkt;
+    size_t done = 0;
+
+    sysex[0] = MIDI_SYSEX_START;
+    for (int i = 1; i < SYSEX_LEN - 1; i++) {
+        sysex[i] = i & 0x7F;
+    }
+    sysex[SYSEX_LEN - 1] = MIDI_SYSEX_END;
+
+    w->name = "sysex 4 KiB";
+    w->midi_bytes = SYSEX_LEN;
+    midi_packet_init(&pkt, buf, NOTIFY_PAYLOAD, 0);
+    while (done < SYSEX_LEN) {
+        done += midi_packet_append_sysex(&pkt, sysex + done, SYSEX_LEN - done);
+        add_packet(w, &pkt, buf);
+    }
+}
+
+/* Ten-note chords struck and released, each change one batch */
+static void build_notes(workload_t *w) {
+    /* Local variables */
+    uint8_t buf[NOTIFY_PAYLOAD];
+    midi_packet_t pkt;
+    midi_event_t ev;
+
+    w->name = "chords";
+    midi_packet_init(&pkt, buf, NOTIFY_PAYLOAD, 0);
+    for (int b = 0; b < NOTE_BURSTS; b++) {
+        for (int n = 0; n < NOTES_PER_BURST; n++) {
+            ev = (midi_event_t){
+                {b & 1 ? MIDI_NOTE_OFF : MIDI_NOTE_ON, 48 + n * 3, 100}, 3, 0};
+            if (!midi_packet_append(&pkt, &ev)) {
+                add_packet(w, &pkt, buf);
+                midi_packet_append(&pkt, &ev);
+            }
+            w->midi_bytes += 3;
+        }
+        add_packet(w, &pkt, buf);
+    }
+}
+
+static uint32_t pdu_us(int phy, int payload) {
+    return (LL_OVERHEAD(phy) + payload) * 8 / phy;
+}
+
+/* Time to deliver the workload in microseconds, counting connection events
+ * from the first one */
+static uint32_t run(const workload_t *w, int phy, int max_octets,
+                    uint32_t interval_us, int per_event, int *pdus) {
+    /* Local variables */
+    uint32_t events = 0, used = 0, exchange;
+    int sent = 0, left, payload;
+
+    *pdus = 0;
+    for (int i = 0; i < w->count; i++) {
+        left = L2CAP_HDR + ATT_NOTIFY_HDR + w->lens[i];
+        while (left > 0) {
+            payload = left < max_octets ? left : max_octets;
+            exchange = pdu_us(phy, payload) + T_IFS_US + pdu_us(phy, 0);
+            if (used + exchange > interval_us ||
+                (per_event > 0 && sent == per_event)) {
+                events++;
+                used = 0;
+                sent = 0;
+            }
+            used += exchange + T_IFS_US;
+            sent++;
+            left -= payload;
+            (*pdus)++;
+        }
+    }
+    return events * interval_us + used;
+}
+
+/* Public functions */
+int main(int argc, char **argv) {
+    /* Local variables */
+    static workload_t workloads[2];
+    uint32_t interval_us = argc > 1 ? atof(argv[1]) * 1000 : DEFAULT_INTERVAL_US;
+    int per_event = argc > 2 ? atoi(argv[2]) : 0;
+    static const int phys[] = {1, 2};
+    static const int octets[] = {27, 251};
+    uint32_t us, base_us;
+    int pdus;
+
+    if (interval_us < 7500) {
+        fprintf(stderr, "usage: %s [interval ms >= 7.5] [PDUs per event]\n",
+                argv[0]);
+        return 2;
+    }
+    build_sysex(&workloads[0]);
+    build_notes(&workloads[1]);
+
+    printf("MTU %d, interval %.2f ms, %s PDUs per event\n", MTU,
+           interval_us / 1000.0, per_event ? argv[2] : "unlimited");
+    printf("%-12s %4s %4s %7s %6s %9s %8s %6s\n", "workload", "PHY", "LL",
+           "notify", "PDUs", "time ms", "kB/s", "gain");
+    for (int i = 0; i < 2; i++) {
+        base_us = 0;
+        for (int p = 0; p < 2; p++) {
+            for (int o = 0; o < 2; o++) {
+                us = run(&workloads[i], phys[p], octets[o], interval_us,
+                         per_event, &pdus);
+                base_us = base_us ? base_us : us;
+                printf("%-12s %3dM %4d %7d %6d %9.1f %8.1f %5.1fx\n",
+                       workloads[i].name, phys[p], octets[o],
+                       workloads[i].count, pdus, us / 1000.0,
+                       workloads[i].midi_bytes * 1000.0 / us,
+                       (double)base_us / us);
+            }
+        }
+    }
+    return 0;
+}
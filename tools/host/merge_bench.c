@@ -0,0 +1,254 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/*
+ * Throughput of the MIDI merge with three simulated centrals.
+ *
+ * Each central writes BLE-MIDI packets of notes and a modulation wheel
+ * sweep on its own channel, as midi_task hands them to midi_merge, and is
+ * subscribed to the merged output. After every round of writes the output
+ * is flushed; notifications go to a stub that decodes them again, so every
+ * destination can be checked to get every note of the other centrals.
+ *
+ * Then one central disconnects while holding notes; the others must get a
+ * note off for each of them. The program fails if any check does not hold.
+ *
+ *   merge_bench [rounds]
+ */
+/* Includes */
+#include "esp_timer.h"
+#include "host/ble_hs.h"
+#include "midi_curve.h"
+#include "midi_merge.h"
+#include "midi_route.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Defines */
+#define PEERS 3
+#define DEFAULT_ROUNDS 200000
+#define CHR_VAL_HANDLE 0x20
+#define CCS_PER_WRITE 4 /* mod wheel values per write, most get thinned */
+#define HELD_NOTES 5    /* held by the central that disconnects */
+
+/* Private types */
+typedef struct {
+    uint16_t conn_handle;
+    midi_parser_t parser;
+    uint32_t notifications;
+    uint32_t bytes;
+    uint32_t note_on;
+    uint32_t note_off;
+    uint32_t cc;
+    uint32_t held[16][4]; /* notes on at this destination */
+} peer_t;
+
+/* Private function declarations */
+static peer_t *peer_find(uint16_t conn_handle);
+static int on_notify(uint16_t conn_handle, uint16_t attr_handle,
+                     const uint8_t *data, uint16_t len);
+static void on_event(const midi_event_t *ev, void *arg);
+static uint16_t build_write(uint8_t *buf, uint16_t cap, uint8_t ch,
+                            uint32_t round, uint32_t *notes);
+static int held_notes(const peer_t *peer);
+
+/* Private variables */
+static peer_t peers[PEERS];
+
+/* Private functions */
+static peer_t *peer_find(uint16_t conn_handle) {
+    for (int i = 0; i < PEERS; i++) {
+        if (peers[i].conn_handle == conn_handle) {
+            return &peers[i];
+        }
+    }
+    return NULL;
+}
+
+/* Every notification the merge sends, decoded as the central would */
+static int on_notify(uint16_t conn_handle, uint16_t attr_handle,
+                     const uint8_t *data, uint16_t len) {
+    /* Local variables */
+    peer_t *peer = peer_find(conn_handle);
+
+    if (peer == NULL || attr_handle != CHR_VAL_HANDLE) {
+        fprintf(stderr, "notification to unknown conn %d\n", conn_handle);
+        exit(1);
+    }
+    peer->notifications++;
+    peer->bytes += len;
+    if (midi_ble_decode(&peer->parser, data, len, on_event, NULL, peer) != 0) {
+        fprintf(stderr, "conn %d: malformed notification\n", conn_handle);
+        exit(1);
+    }
+    return 0;
+}
+
+static void on_event(const midi_event_t *ev, void *arg) {
+    /* Local variables */
+    peer_t *peer = arg;
+    uint8_t ch = MIDI_STATUS_CHANNEL(ev->data[0]);
+    uint32_t bit = 1u << (ev->data[1] & 31);
+
+    switch (MIDI_STATUS_TYPE(ev->data[0])) {
+    case MIDI_NOTE_ON:
+        if (ev->data[2] != 0) {
+            peer->note_on++;
+            peer->held[ch][ev->data[1] >> 5] |= bit;
+            break;
+        }
+        /* fall through */
+    case MIDI_NOTE_OFF:
+        peer->note_off++;
+        peer->held[ch][ev->data[1] >> 5] &= ~bit;
+        break;
+    case MIDI_CONTROL_CHANGE:
+        peer->cc++;
+        break;
+    default:
+        break;
+    }
+}
+
+/* One write: the previous note off, the next note on and a few CC values */
+static uint16_t build_write(uint8_t *buf, uint16_t cap, uint8_t ch,
+                            uint32_t round, uint32_t *notes) {
+    /* Local variables */
+    midi_packet_t pkt;
+    midi_event_t ev = {.len = 3};
+
+    midi_packet_init(&pkt, buf, cap, midi_ble_now());
+    if (round > 0) {
+        ev.data[0] = MIDI_NOTE_OFF | ch;
+        ev.data[1] = 36 + (round - 1) % 48;
+        ev.data[2] = 64;
+        midi_packet_append(&pkt, &ev);
+    }
+    ev.data[0] = MIDI_NOTE_ON | ch;
+    ev.data[1] = 36 + round % 48;
+    ev.data[2] = 100;
+    midi_packet_append(&pkt, &ev);
+    (*notes)++;
+    for (int i = 0; i < CCS_PER_WRITE; i++) {
+        ev.data[0] = MIDI_CONTROL_CHANGE | ch;
+        ev.data[1] = 1;
+        ev.data[2] = (round * CCS_PER_WRITE + i) & 0x7F;
+        midi_packet_append(&pkt, &ev);
+    }
+    return pkt.len;
+}
+
+static int held_notes(const peer_t *peer) {
+    /* Local variables */
+    int n = 0;
+
+    for (int ch = 0; ch < 16; ch++) {
+        for (int w = 0; w < 4; w++) {
+            n += __builtin_popcount(peer->held[ch][w]);
+        }
+    }
+    return n;
+}
+
+/* Public functions */
+int main(int argc, char **argv) {
+    /* Local variables */
+    uint32_t rounds = argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_ROUNDS;
+    uint8_t buf[CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU];
+    uint32_t sent_notes[PEERS] = {0};
+    uint32_t expected, events = 0, notifications = 0, bytes = 0;
+    midi_merge_src_stats_t stats;
+    midi_event_t ev = {.len = 3};
+    midi_packet_t pkt;
+    int64_t start, elapsed;
+    uint16_t len;
+    int failed = 0;
+
+    if (rounds == 0) {
+        fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+        return 2;
+    }
+
+    midi_route_init();
+    midi_curve_init();
+    midi_merge_init(CHR_VAL_HANDLE, NULL, NULL, NULL);
+    host_notify_cb = on_notify;
+    for (int i = 0; i < PEERS; i++) {
+        peers[i].conn_handle = i + 1;
+        midi_parser_reset(&peers[i].parser);
+        midi_merge_connect(peers[i].conn_handle);
+        midi_merge_subscribe(peers[i].conn_handle, true);
+    }
+
+    start = esp_timer_get_time();
+    for (uint32_t r = 0; r < rounds; r++) {
+        for (int i = 0; i < PEERS; i++) {
+            len = build_write(buf, host_att_mtu - 3, i, r, &sent_notes[i]);
+            midi_merge_input(peers[i].conn_handle, buf, len);
+            events += (r > 0) + 1 + CCS_PER_WRITE;
+        }
+        midi_merge_poll();
+    }
+    elapsed = esp_timer_get_time() - start;
+
+    for (int i = 0; i < PEERS; i++) {
+        notifications += peers[i].notifications;
+        bytes += peers[i].bytes;
+    }
+    printf("%d centrals, %u rounds, %u events in %.1f ms\n", PEERS,
+           (unsigned)rounds, (unsigned)events, elapsed / 1000.0);
+    printf("%.0f events/s, %.0f ns per event, %u notifications of %.1f bytes\n",
+           events * 1e6 / elapsed, elapsed * 1000.0 / events,
+           (unsigned)notifications, (double)bytes / notifications);
+    printf("%-6s %10s %10s %10s %10s %10s\n", "conn", "events in",
+           "coalesced", "note on", "note off", "cc out");
+    for (int i = 0; i < PEERS; i++) {
+        midi_merge_get_stats(i, &stats);
+        printf("%-6d %10u %10u %10u %10u %10u\n", peers[i].conn_handle,
+               (unsigned)stats.events_in, (unsigned)stats.thin.coalesced,
+               (unsigned)peers[i].note_on, (unsigned)peers[i].note_off,
+               (unsigned)peers[i].cc);
+
+        /* Every note of the other centrals, and its own with echo on */
+        expected = 0;
+        for (int j = 0; j < PEERS; j++) {
+#if !CONFIG_MIDI_THRU_ECHO
+            if (j == i) {
+                continue;
+            }
+#endif
+            expected += sent_notes[j];
+        }
+        if (peers[i].note_on != expected) {
+            fprintf(stderr, "conn %d: %u notes of %u\n", peers[i].conn_handle,
+                    (unsigned)peers[i].note_on, (unsigned)expected);
+            failed = 1;
+        }
+    }
+
+    /* The first central leaves with notes held */
+    midi_packet_init(&pkt, buf, host_att_mtu - 3, midi_ble_now());
+    for (int n = 0; n < HELD_NOTES; n++) {
+        ev.data[0] = MIDI_NOTE_ON | 9;
+        ev.data[1] = 60 + n;
+        ev.data[2] = 90;
+        midi_packet_append(&pkt, &ev);
+    }
+    midi_merge_input(peers[0].conn_handle, pkt.buf, pkt.len);
+    midi_merge_poll();
+    midi_merge_disconnect(peers[0].conn_handle);
+    midi_merge_poll();
+    for (int i = 1; i < PEERS; i++) {
+        /* The note of the last round is still on as well */
+        if (held_notes(&peers[i]) != PEERS - 2) {
+            fprintf(stderr, "conn %d: %d notes hung after disconnect\n",
+                    peers[i].conn_handle, held_notes(&peers[i]) - (PEERS - 2));
+            failed = 1;
+        }
+    }
+    printf("disconnect with %d notes held: %s\n", HELD_NOTES + 1,
+           failed ? "hung notes" : "all released");
+    return failed;
+}
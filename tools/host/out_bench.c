@@ -0,0 +1,244 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/*
+ * Clock jitter and note latency of midi_out under controller saturation.
+ *
+ * One destination is flooded with more controller changes than the link
+ * can carry, while a MIDI clock is queued every tick and notes come on a
+ * quiet channel and on one of the flooded channels. Each tick the output
+ * is flushed into a stub that takes a fixed number of notifications, as a
+ * connection event would, and decodes them again.
+ *
+ * Clocks and the notes of the quiet channel must go out in the tick they
+ * were queued, clocks as the first message of the packet. A note off on a
+ * flooded channel must come after the sustain pedal value queued before
+ * it. The program fails if any check does not hold.
+ *
+ *   out_bench [ticks]
+ */
+/* Includes */
+#include "host/ble_hs.h"
+#include "midi_out.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Defines */
+#define DEFAULT_TICKS 100000
+#define CONN_HANDLE 1
+#define CHR_VAL_HANDLE 0x20
+#define PACKETS_PER_TICK 1  /* notifications the link takes per tick */
+#define CCS_PER_TICK 160    /* well over what one packet holds */
+#define FLOOD_CHANNELS 4    /* channels 0-3 carry the flood */
+#define QUIET_CHANNEL 9
+#define NOTE_PERIOD 8       /* ticks between notes on each channel */
+#define CC_SUSTAIN 64
+
+/* Private types */
+typedef struct {
+    uint32_t count;
+    uint32_t max_latency; /* ticks from queueing to the notification */
+    uint32_t late;        /* sent in a later tick than queued */
+    uint32_t misplaced;   /* clocks not first in their packet */
+} latency_t;
+
+/* Private function declarations */
+static int on_notify(uint16_t conn_handle, uint16_t attr_handle,
+                     const uint8_t *data, uint16_t len);
+static void on_event(const midi_event_t *ev, void *arg);
+static void latency_add(latency_t *lat, uint32_t queued);
+static bool push(uint8_t status, uint8_t d1, uint8_t d2);
+
+/* Private variables */
+static midi_parser_t parser;
+static uint32_t tick;
+static uint32_t budget;
+static uint32_t packet_index; /* of the next event in the notification */
+
+static uint32_t clock_ticks[256]; /* queue tick of each clock in flight */
+static uint32_t clocks_queued, clocks_sent;
+static uint32_t note_ticks[16][128];
+static int held[16];
+
+static uint8_t sustain_queued; /* last sustain value accepted, channel 0 */
+static uint8_t sustain_seen;   /* last sustain value decoded, channel 0 */
+static uint32_t order_errors;
+static uint32_t ccs_queued, ccs_sent;
+
+static latency_t clock_lat, quiet_lat, flood_lat;
+
+/* Private functions */
+/* Takes PACKETS_PER_TICK notifications, then refuses like a full stack */
+static int on_notify(uint16_t conn_handle, uint16_t attr_handle,
+                     const uint8_t *data, uint16_t len) {
+    if (conn_handle != CONN_HANDLE || attr_handle != CHR_VAL_HANDLE) {
+        fprintf(stderr, "notification to unknown conn %d\n", conn_handle);
+        exit(1);
+    }
+    if (budget == 0) {
+        return BLE_HS_ENOMEM;
+    }
+    budget--;
+    packet_index = 0;
+    if (midi_ble_decode(&parser, data, len, on_event, NULL, NULL) != 0) {
+        fprintf(stderr, "malformed notification\n");
+        exit(1);
+    }
+    return 0;
+}
+
+static void on_event(const midi_event_t *ev, void *arg) {
+    /* Local variables */
+    uint8_t status = ev->data[0];
+    uint8_t ch = MIDI_STATUS_CHANNEL(status);
+
+    if (status == MIDI_TIMING_CLOCK) {
+        latency_add(&clock_lat, clock_ticks[clocks_sent++ & 0xFF]);
+        clock_lat.misplaced += packet_index != 0;
+    } else if (MIDI_STATUS_TYPE(status) == MIDI_CONTROL_CHANGE) {
+        ccs_sent++;
+        if (ch == 0 && ev->data[1] == CC_SUSTAIN) {
+            sustain_seen = ev->data[2];
+        }
+    } else if (MIDI_STATUS_TYPE(status) == MIDI_NOTE_ON ||
+               MIDI_STATUS_TYPE(status) == MIDI_NOTE_OFF) {
+        latency_add(ch == QUIET_CHANNEL ? &quiet_lat : &flood_lat,
+                    note_ticks[ch][ev->data[1]]);
+        held[ch] += MIDI_STATUS_TYPE(status) == MIDI_NOTE_ON ? 1 : -1;
+        /* The velocity of a note off carries the sustain value before it */
+        if (ch == 0 && MIDI_STATUS_TYPE(status) == MIDI_NOTE_OFF &&
+            ev->data[2] != sustain_seen) {
+            order_errors++;
+        }
+    }
+    packet_index++;
+}
+
+static void latency_add(latency_t *lat, uint32_t queued) {
+    lat->count++;
+    if (tick - queued > lat->max_latency) {
+        lat->max_latency = tick - queued;
+    }
+    lat->late += tick != queued;
+}
+
+/* Only controllers may be dropped, their lane is meant to overflow */
+static bool push(uint8_t status, uint8_t d1, uint8_t d2) {
+    /* Local variables */
+    midi_event_t ev = {.data = {status, d1, d2},
+                       .len = MIDI_IS_REALTIME(status) ? 1 : 3};
+    bool ok = midi_out_push(0, &ev);
+
+    if (MIDI_STATUS_TYPE(status) == MIDI_CONTROL_CHANGE) {
+        ccs_queued += ok;
+    } else if (!ok) {
+        fprintf(stderr, "tick %u: status 0x%02x refused\n", (unsigned)tick,
+                status);
+        exit(1);
+    }
+    return ok;
+}
+
+/* Public functions */
+int main(int argc, char **argv) {
+    /* Local variables */
+    uint32_t ticks = argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_TICKS;
+    midi_out_stats_t stats;
+    uint8_t ch, note;
+    int failed = 0;
+
+    if (ticks == 0) {
+        fprintf(stderr, "usage: %s [ticks]\n", argv[0]);
+        return 2;
+    }
+
+    midi_out_init(CHR_VAL_HANDLE);
+    midi_out_open(0, CONN_HANDLE);
+    midi_parser_reset(&parser);
+    host_notify_cb = on_notify;
+
+    for (tick = 0; tick < ticks; tick++) {
+        /* Notes alternate on and off, so at most one is held per channel.
+         * They come first, while the last flush left room for the sustain
+         * pedal value. */
+        note = tick / NOTE_PERIOD % 128;
+        if (tick % NOTE_PERIOD == 0) {
+            note_ticks[QUIET_CHANNEL][note] = tick;
+            push(MIDI_NOTE_ON | QUIET_CHANNEL, note, 100);
+            note_ticks[0][note] = tick;
+            push(MIDI_NOTE_ON, note, 100);
+        } else if (tick % NOTE_PERIOD == NOTE_PERIOD / 2) {
+            note_ticks[QUIET_CHANNEL][note] = tick;
+            push(MIDI_NOTE_OFF | QUIET_CHANNEL, note, 64);
+            /* The sustain value may be dropped with the rest of the flood */
+            if (push(MIDI_CONTROL_CHANGE, CC_SUSTAIN, tick & 0x7F)) {
+                sustain_queued = tick & 0x7F;
+            }
+            note_ticks[0][note] = tick;
+            push(MIDI_NOTE_OFF, note, sustain_queued);
+        }
+
+        for (int i = 0; i < CCS_PER_TICK; i++) {
+            ch = i % FLOOD_CHANNELS;
+            push(MIDI_CONTROL_CHANGE | ch, 1 + i / FLOOD_CHANNELS % 16,
+                 (tick + i) & 0x7F);
+            if (i == CCS_PER_TICK / 2) {
+                clock_ticks[clocks_queued++ & 0xFF] = tick;
+                push(MIDI_TIMING_CLOCK, 0, 0);
+            }
+        }
+
+        budget = PACKETS_PER_TICK;
+        midi_out_flush();
+    }
+
+    /* Let the link catch up once the flood stops */
+    while (midi_out_flush()) {
+        budget = PACKETS_PER_TICK;
+        tick++;
+    }
+
+    midi_out_get_stats(0, &stats);
+    printf("%u ticks, %d notification(s) of up to %d bytes per tick\n",
+           (unsigned)ticks, PACKETS_PER_TICK, host_att_mtu - 3);
+    printf("controllers: %u queued, %u sent, %u dropped, lane high water %u\n",
+           (unsigned)ccs_queued, (unsigned)ccs_sent,
+           (unsigned)stats.dropped[MIDI_OUT_LANE_CONTROL],
+           (unsigned)stats.depth_max[MIDI_OUT_LANE_CONTROL]);
+    printf("%-14s %10s %10s %10s %10s\n", "message", "count", "late",
+           "max ticks", "not first");
+    printf("%-14s %10u %10u %10u %10u\n", "clock", (unsigned)clock_lat.count,
+           (unsigned)clock_lat.late, (unsigned)clock_lat.max_latency,
+           (unsigned)clock_lat.misplaced);
+    printf("%-14s %10u %10u %10u %10s\n", "note, quiet", (unsigned)quiet_lat.count,
+           (unsigned)quiet_lat.late, (unsigned)quiet_lat.max_latency, "-");
+    printf("%-14s %10u %10u %10u %10s\n", "note, flooded",
+           (unsigned)flood_lat.count, (unsigned)flood_lat.late,
+           (unsigned)flood_lat.max_latency, "-");
+
+    if (clocks_sent != clocks_queued || clock_lat.late != 0 ||
+        clock_lat.misplaced != 0) {
+        fprintf(stderr, "clock: %u of %u sent, %u late, %u not first\n",
+                (unsigned)clocks_sent, (unsigned)clocks_queued,
+                (unsigned)clock_lat.late, (unsigned)clock_lat.misplaced);
+        failed = 1;
+    }
+    if (quiet_lat.late != 0) {
+        fprintf(stderr, "%u notes of the quiet channel held up by the flood\n",
+                (unsigned)quiet_lat.late);
+        failed = 1;
+    }
+    if (order_errors != 0) {
+        fprintf(stderr, "%u note offs overtook the sustain pedal before them\n",
+                (unsigned)order_errors);
+        failed = 1;
+    }
+    if (held[0] != 0 || held[QUIET_CHANNEL] != 0) {
+        fprintf(stderr, "notes hung: %d on channel 1, %d on channel %d\n",
+                held[0], held[QUIET_CHANNEL], QUIET_CHANNEL + 1);
+        failed = 1;
+    }
+    return failed;
+}
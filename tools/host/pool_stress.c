@@ -0,0 +1,176 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/*
+ * Stress test of the block pool in midi_pool.c, used as the MIDI task uses
+ * it: blocks are taken on one core, handed over through a lock-free queue
+ * and freed on the other core, which also takes and frees blocks of its
+ * own in between.
+ *
+ * A block handed out twice, a block freed to the wrong place or a count
+ * that drifts all fail the program. Once both threads are done, every
+ * block must be back in the pool and reachable from the two cores.
+ *
+ *   pool_stress [items]
+ */
+/* Includes */
+#include "esp_cpu.h"
+#include "lf_queue.h"
+#include "midi_pool.h"
+#include "sdkconfig.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Defines */
+#define DEFAULT_ITEMS 1000000
+#define QUEUE_LEN 64
+#define LOCAL_HELD 3 /* blocks the consumer keeps for itself at a time */
+#define WATCHDOG_S 60
+
+_Static_assert(QUEUE_LEN >= CONFIG_MIDI_POOL_SIZE,
+               "the queue must hold every block, as the MIDI task's does");
+
+/* Private types */
+/* What the test keeps at the start of a block while it holds it */
+typedef struct {
+    atomic_uint owned;
+    uint32_t seq;
+} block_t;
+
+/* Private function declarations */
+static block_t *take(void);
+static void give(block_t *block);
+static void *producer(void *param);
+
+/* Private variables */
+static lf_spsc_t queue;
+static void *queue_slots[QUEUE_LEN];
+static uint32_t items;
+static atomic_uint errors;
+static uint32_t pool_empty;
+
+/* Private functions */
+/* Allocate a block and mark it held, flagging a block that already was */
+static block_t *take(void) {
+    /* Local variables */
+    block_t *block = midi_pool_alloc();
+
+    if (block != NULL && atomic_exchange(&block->owned, 1) != 0) {
+        if (atomic_fetch_add(&errors, 1) < 8) {
+            printf("core %d: block %p handed out twice\n", host_core_id,
+                   (void *)block);
+        }
+    }
+    return block;
+}
+
+static void give(block_t *block) {
+    atomic_store(&block->owned, 0);
+    midi_pool_free(block);
+}
+
+/* Core 0, as the NimBLE host task taking blocks for incoming writes */
+static void *producer(void *param) {
+    /* Local variables */
+    block_t *block;
+
+    host_core_id = 0;
+    for (uint32_t seq = 1; seq <= items; seq++) {
+        while ((block = take()) == NULL) {
+            pool_empty++;
+            sched_yield();
+        }
+        block->seq = seq;
+        if (!lf_spsc_push(&queue, block)) {
+            atomic_fetch_add(&errors, 1);
+            printf("queue full with a block in hand\n");
+            give(block);
+        }
+    }
+    return NULL;
+}
+
+/* Public functions */
+int main(int argc, char **argv) {
+    /* Local variables */
+    pthread_t thread;
+    block_t *local[LOCAL_HELD] = {NULL};
+    block_t *block;
+    midi_pool_stats_t stats;
+    uint32_t next = 1;
+    int reachable = 0;
+    bool got;
+
+    items = argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_ITEMS;
+    if (items == 0) {
+        fprintf(stderr, "usage: %s [items]\n", argv[0]);
+        return 2;
+    }
+    /* A block lost for good leaves the producer spinning */
+    alarm(WATCHDOG_S);
+
+    midi_pool_init();
+    lf_spsc_init(&queue, queue_slots, QUEUE_LEN);
+
+    /* Core 1, as the MIDI task freeing what it was handed */
+    host_core_id = 1;
+    pthread_create(&thread, NULL, producer, NULL);
+    for (uint32_t n = 0; n < items; n++) {
+        block = lf_spsc_pop_wait(&queue, portMAX_DELAY);
+        if (block->seq != next++ || atomic_load(&block->owned) != 1) {
+            if (atomic_fetch_add(&errors, 1) < 8) {
+                printf("block %p: seq %u, expected %u\n", (void *)block,
+                       (unsigned)block->seq, (unsigned)next - 1);
+            }
+        }
+        give(block);
+
+        /* Turn over a few blocks of its own, pushing blocks through both
+         * caches and the shared list at once */
+        if (local[n % LOCAL_HELD] != NULL) {
+            give(local[n % LOCAL_HELD]);
+        }
+        local[n % LOCAL_HELD] = take();
+    }
+    pthread_join(thread, NULL);
+    for (int i = 0; i < LOCAL_HELD; i++) {
+        if (local[i] != NULL) {
+            give(local[i]);
+        }
+    }
+
+    midi_pool_get_stats(&stats);
+    printf("%u items through a pool of %u blocks of %d bytes\n",
+           (unsigned)items, stats.size, MIDI_POOL_BLOCK_SIZE);
+    printf("high water %u, %u allocations refused, producer waited %u times\n",
+           stats.high_water, (unsigned)stats.alloc_failed,
+           (unsigned)pool_empty);
+    if (stats.in_use != 0 || stats.high_water > stats.size) {
+        printf("%u blocks still in use, high water %u\n", stats.in_use,
+               stats.high_water);
+        atomic_fetch_add(&errors, 1);
+    }
+
+    /* Every block must come back out again, from one core or the other */
+    do {
+        got = false;
+        for (host_core_id = 0; host_core_id < portNUM_PROCESSORS;
+             host_core_id++) {
+            if (take() != NULL) {
+                reachable++;
+                got = true;
+            }
+        }
+    } while (got);
+    if (reachable != stats.size) {
+        printf("%d of %u blocks reachable\n", reachable, stats.size);
+        atomic_fetch_add(&errors, 1);
+    }
+
+    printf("%u errors\n", atomic_load(&errors));
+    return atomic_load(&errors) != 0;
+}
@@ -0,0 +1,240 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/*
+ * Replays PPG recordings through the heart rate pipeline in ppg.c and
+ * reports its accuracy and cost.
+ *
+ * A recording is a CSV file with one raw sample per line, optionally
+ * followed by the reference heart rate in BPM from a chest strap or ECG:
+ *
+ *   sample[,reference bpm]
+ *
+ * Lines that do not start with a number, such as a header, are skipped.
+ * Without a file a synthetic recording is replayed: pulses with a dicrotic
+ * notch, baseline wander and noise, at a rate sweeping 55-160 BPM.
+ *
+ * The recording is then replayed once more through heart_rate.c, published
+ * once a second, with a subscriber that is only sent every
+ * SUBSCRIBER_EVERY'th measurement, as when indications are coalesced. It
+ * must still receive every RR interval; the program fails if not.
+ *
+ *   ppg_replay [recording.csv [sample rate]]
+ */
+/* Includes */
+#include "esp_timer.h"
+#include "heart_rate.h"
+#include "ppg.h"
+#include "sdkconfig.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#else
+#define HAVE_CYCLES 0
+#endif
+
+/* Defines */
+#define BLOCK 25            /* samples per ppg_process() call */
+#define SYNTH_SECONDS 300
+#define TOLERANCE_BPM 5
+#define MAX_SAMPLES (1 << 24)
+#define SUBSCRIBER_EVERY 3 /* measurements per one sent to the subscriber */
+
+/* Private types */
+typedef struct {
+    int32_t *samples;
+    float *reference; /* BPM, NAN where the recording has none */
+    size_t count;
+} recording_t;
+
+/* Private function declarations */
+static int load_csv(const char *path, recording_t *rec);
+static void synthesize(recording_t *rec, uint32_t rate);
+static float gauss(float x, float mu, float sigma);
+static uint64_t now_cycles(void);
+static size_t replay_subscriber(const recording_t *rec, uint32_t rate);
+
+/* Private functions */
+static int load_csv(const char *path, recording_t *rec) {
+    /* Local variables */
+    FILE *f = fopen(path, "r");
+    char line[256];
+    char *end;
+    long sample;
+    size_t cap = 0;
+
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    memset(rec, 0, sizeof(*rec));
+    while (fgets(line, sizeof(line), f) != NULL && rec->count < MAX_SAMPLES) {
+        sample = strtol(line, &end, 10);
+        if (end == line) {
+            continue;
+        }
+        if (rec->count == cap) {
+            cap = cap ? cap * 2 : 4096;
+            rec->samples = realloc(rec->samples, cap * sizeof(*rec->samples));
+            rec->reference =
+                realloc(rec->reference, cap * sizeof(*rec->reference));
+            if (rec->samples == NULL || rec->reference == NULL) {
+                fclose(f);
+                return -1;
+            }
+        }
+        rec->samples[rec->count] = (int32_t)sample;
+        rec->reference[rec->count] = *end == ',' ? strtof(end + 1, NULL) : NAN;
+        rec->count++;
+    }
+    fclose(f);
+    return rec->count > 0 ? 0 : -1;
+}
+
+static float gauss(float x, float mu, float sigma) {
+    return expf(-(x - mu) * (x - mu) / (2 * sigma * sigma));
+}
+
+/* Reference is the rate the synthetic pulses were generated at */
+static void synthesize(recording_t *rec, uint32_t rate) {
+    /* Local variables */
+    float phase = 0, t, bpm, noise;
+
+    srand(1);
+    rec->count = (size_t)SYNTH_SECONDS * rate;
+    rec->samples = malloc(rec->count * sizeof(*rec->samples));
+    rec->reference = malloc(rec->count * sizeof(*rec->reference));
+    for (size_t i = 0; i < rec->count; i++) {
+        t = (float)i / rate;
+        bpm = 107.5f - 52.5f * cosf(2 * (float)M_PI * t / SYNTH_SECONDS);
+        /* Beat to beat variation of a few percent */
+        bpm *= 1 + 0.03f * sinf(2 * (float)M_PI * t * 0.25f);
+        phase += bpm / 60 / rate;
+        if (phase >= 1) {
+            phase -= 1;
+        }
+        noise = ((float)rand() / RAND_MAX - 0.5f) * 400;
+        rec->samples[i] =
+            (int32_t)(100000 + 3000 * sinf(2 * (float)M_PI * 0.2f * t) +
+                      2000 * gauss(phase, 0.2f, 0.06f) +
+                      700 * gauss(phase, 0.45f, 0.08f) + noise);
+        rec->reference[i] = bpm;
+    }
+}
+
+static uint64_t now_cycles(void) {
+#if HAVE_CYCLES
+    return __rdtsc();
+#else
+    return esp_timer_get_time() * 1000;
+#endif
+}
+
+/*
+ *  Replay through heart_rate.c as the firmware runs it and count the RR
+ *  intervals a subscriber receives.
+ */
+static size_t replay_subscriber(const recording_t *rec, uint32_t rate) {
+    /* Local variables */
+    uint8_t val[HEART_RATE_MEAS_MAX];
+    uint32_t rr_next;
+    uint16_t len;
+    size_t received = 0, n, updates = 0;
+
+    heart_rate_init();
+    rr_next = heart_rate_rr_end();
+    for (size_t i = 0; i < rec->count; i += n) {
+        n = rec->count - i < rate ? rec->count - i : rate;
+        for (size_t j = 0; j < n; j += BLOCK) {
+            heart_rate_push_samples(&rec->samples[i + j],
+                                    n - j < BLOCK ? n - j : BLOCK);
+        }
+        update_heart_rate();
+        if (++updates % SUBSCRIBER_EVERY == 0) {
+            len = heart_rate_read_measurement(val, &rr_next);
+            received += (len - 3) / 2;
+        }
+    }
+    /* Whatever is left waits for the next sends */
+    do {
+        len = heart_rate_read_measurement(val, &rr_next);
+        received += (len - 3) / 2;
+    } while (len > 3);
+    return received;
+}
+
+/* Public functions */
+int main(int argc, char **argv) {
+    /* Local variables */
+    static ppg_t ppg;
+    recording_t rec;
+    uint32_t rate = argc > 2 ? strtoul(argv[2], NULL, 0)
+                             : CONFIG_PPG_SAMPLE_RATE_HZ;
+    uint64_t cycles = 0, start;
+    size_t n, scored = 0, within = 0, first_bpm = 0, beats = 0;
+    double abs_err = 0, err;
+    uint16_t bpm, rr;
+    size_t received;
+
+    if (rate == 0) {
+        fprintf(stderr, "usage: %s [recording.csv [sample rate]]\n", argv[0]);
+        return 2;
+    }
+    if (argc > 1) {
+        if (load_csv(argv[1], &rec) != 0) {
+            fprintf(stderr, "no samples in %s\n", argv[1]);
+            return 1;
+        }
+    } else {
+        synthesize(&rec, rate);
+    }
+
+    ppg_init(&ppg, rate);
+    for (size_t i = 0; i < rec.count; i += n) {
+        n = rec.count - i < BLOCK ? rec.count - i : BLOCK;
+        start = now_cycles();
+        ppg_process(&ppg, &rec.samples[i], n);
+        cycles += now_cycles() - start;
+
+        while (ppg_pop_rr(&ppg, &rr)) {
+            beats++;
+        }
+        bpm = ppg_bpm(&ppg);
+        if (bpm != 0 && first_bpm == 0) {
+            first_bpm = i + n;
+        }
+        /* Score the rate reported at the end of each block, as it is read */
+        if (bpm != 0 && !isnan(rec.reference[i + n - 1])) {
+            err = fabs(bpm - rec.reference[i + n - 1]);
+            abs_err += err;
+            within += err <= TOLERANCE_BPM;
+            scored++;
+        }
+    }
+
+    printf("%s: %zu samples at %u Hz, %.1f s\n", argc > 1 ? argv[1] : "synthetic",
+           rec.count, rate, (double)rec.count / rate);
+    printf("beats %zu, first rate after %.1f s\n", beats,
+           (double)first_bpm / rate);
+    if (scored > 0) {
+        printf("mean error %.2f BPM, %.1f%% within %d BPM\n", abs_err / scored,
+               100.0 * within / scored, TOLERANCE_BPM);
+    } else {
+        printf("no reference rate to score against\n");
+    }
+    printf("%.1f %s per sample\n", (double)cycles / rec.count,
+           HAVE_CYCLES ? "cycles" : "ns");
+
+    received = replay_subscriber(&rec, rate);
+    printf("RR intervals to a subscriber sent every %d measurements: %zu of "
+           "%zu\n",
+           SUBSCRIBER_EVERY, received, beats);
+
+    free(rec.samples);
+    free(rec.reference);
+    return received == beats ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/*
+ * Stress test and benchmark of the lock-free queue in lf_queue.c.
+ *
+ * A producer thread pushes numbered items while the consumer drains them
+ * with the blocking pop, so every item must arrive exactly once and in
+ * order, and a lost wakeup shows up as a hang caught by the watchdog.
+ * The same transfer through a mutex and condition variable queue, which is
+ * what a FreeRTOS queue amounts to on the host, is timed for comparison.
+ *
+ *   queue_stress [items]
+ */
+/* Includes */
+#include "esp_timer.h"
+#include "lf_queue.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <unistd.h>
+
+/* Defines */
+#define DEFAULT_ITEMS 2000000
+#define QUEUE_LEN 64
+#define WATCHDOG_S 60
+
+/* Items are their sequence number, starting at 1 so none is NULL */
+#define ITEM(seq) ((void *)(uintptr_t)(seq))
+#define ITEM_SEQ(it) ((uint32_t)(uintptr_t)(it))
+
+/* Private types */
+typedef enum { KIND_SPSC, KIND_LOCKED } queue_kind_t;
+
+/* Host model of a FreeRTOS queue: one lock around a ring, waits on a cond */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint32_t head, tail;
+    void *slots[QUEUE_LEN];
+} locked_queue_t;
+
+typedef struct {
+    queue_kind_t kind;
+    uint32_t items;
+    lf_spsc_t spsc;
+    void *spsc_slots[QUEUE_LEN];
+    locked_queue_t locked;
+    uint32_t full_retries;
+} bench_t;
+
+/* Private function declarations */
+static void *producer(void *param);
+static void *consume(bench_t *b);
+static int run(queue_kind_t kind, uint32_t items, double *ns_per_item);
+
+/* Private functions */
+static void *producer(void *param) {
+    /* Local variables */
+    bench_t *b = param;
+    locked_queue_t *lq = &b->locked;
+    bool pushed;
+
+    for (uint32_t seq = 1; seq <= b->items; seq++) {
+        for (;;) {
+            if (b->kind == KIND_SPSC) {
+                pushed = lf_spsc_push(&b->spsc, ITEM(seq));
+            } else {
+                pthread_mutex_lock(&lq->lock);
+                while (lq->head - lq->tail == QUEUE_LEN) {
+                    pthread_cond_wait(&lq->not_full, &lq->lock);
+                }
+                lq->slots[lq->head++ % QUEUE_LEN] = ITEM(seq);
+                pthread_cond_signal(&lq->not_empty);
+                pthread_mutex_unlock(&lq->lock);
+                pushed = true;
+            }
+            if (pushed) {
+                break;
+            }
+            b->full_retries++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void *consume(bench_t *b) {
+    /* Local variables */
+    locked_queue_t *lq = &b->locked;
+    void *item;
+
+    if (b->kind == KIND_SPSC) {
+        return lf_spsc_pop_wait(&b->spsc, portMAX_DELAY);
+    }
+    pthread_mutex_lock(&lq->lock);
+    while (lq->head == lq->tail) {
+        pthread_cond_wait(&lq->not_empty, &lq->lock);
+    }
+    item = lq->slots[lq->tail++ % QUEUE_LEN];
+    pthread_cond_signal(&lq->not_full);
+    pthread_mutex_unlock(&lq->lock);
+    return item;
+}
+
+/* Number of items lost, duplicated or out of order */
+static int run(queue_kind_t kind, uint32_t items, double *ns_per_item) {
+    /* Local variables */
+    static bench_t b;
+    pthread_t thread;
+    uint32_t next = 1;
+    int64_t start;
+    int errors = 0;
+    void *item;
+
+    b = (bench_t){.kind = kind, .items = items};
+    lf_spsc_init(&b.spsc, b.spsc_slots, QUEUE_LEN);
+    pthread_mutex_init(&b.locked.lock, NULL);
+    pthread_cond_init(&b.locked.not_empty, NULL);
+    pthread_cond_init(&b.locked.not_full, NULL);
+
+    start = esp_timer_get_time();
+    pthread_create(&thread, NULL, producer, &b);
+    for (uint32_t n = 0; n < items; n++) {
+        item = consume(&b);
+        if (ITEM_SEQ(item) != next) {
+            if (errors++ < 8) {
+                printf("unexpected item %p after %u\n", item, (unsigned)n);
+            }
+            continue;
+        }
+        next++;
+    }
+    pthread_join(thread, NULL);
+    *ns_per_item = (esp_timer_get_time() - start) * 1000.0 / items;
+    return errors;
+}
+
+/* Public functions */
+int main(int argc, char **argv) {
+    /* Local variables */
+    uint32_t items = argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_ITEMS;
+    double spsc_ns, locked_ns;
+    int errors = 0;
+
+    if (items == 0) {
+        fprintf(stderr, "usage: %s [items]\n", argv[0]);
+        return 2;
+    }
+    /* A lost wakeup leaves the consumer asleep for good */
+    alarm(WATCHDOG_S);
+
+    errors += run(KIND_SPSC, items, &spsc_ns);
+    errors += run(KIND_LOCKED, items, &locked_ns);
+
+    printf("%u items, queue of %d\n", items, QUEUE_LEN);
+    printf("%-8s %8s\n", "", "ns/item");
+    printf("%-8s %8.1f\n", "spsc", spsc_ns);
+    printf("%-8s %8.1f\n", "locked", locked_ns);
+    printf("%d errors\n", errors);
+    return errors != 0;
+}
@@ -0,0 +1,186 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/*
+ * Reconnect time after a link loss, from the disconnect to the CONNECT_IND
+ * of the central, for the advertising sequence of gap.c: high duty cycle
+ * directed advertising to a bonded peer for 1.28 s, then the fast burst of
+ * CONFIG_BLE_ADV_FAST_DURATION_MS, then slow advertising for good.
+ *
+ * The central scans one primary channel per scan interval, hopping 37, 38,
+ * 39, and hears a PDU that falls whole into its scan window. It connects to
+ * the first one it accepts. Scan phase, first channel and the advDelay of
+ * undirected events are random in each trial. Directed PDUs go to the
+ * peer's identity address, which a central on a resolvable private address
+ * ignores; gap.c advertises undirected to those peers instead, and the
+ * third row shows what that saves. 1M PHY, 31 bytes of advertising data.
+ *
+ * Trials that do not reconnect within a minute count as a minute and are
+ * listed as lost. The program fails if the directed path is slower than
+ * the undirected one on average, or loses a bonded peer.
+ *
+ *   reconnect_bench [trials]
+ */
+/* Includes */
+#include "sdkconfig.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Defines */
+#define DEFAULT_TRIALS 10000
+#define HORIZON_US 60000000.0
+#define T_IFS_US 150
+/* Air time on the 1M PHY of preamble, access address, header, payload, CRC */
+#define ADV_IND_US ((1 + 4 + 2 + 6 + 31 + 3) * 8)
+#define ADV_DIRECT_IND_US ((1 + 4 + 2 + 12 + 3) * 8)
+#define CONNECT_IND_US ((1 + 4 + 2 + 34 + 3) * 8)
+/* Longest event interval high duty cycle directed advertising may use */
+#define DIRECTED_ITVL_US 3750
+#define DIRECTED_US 1280000
+#define ADV_DELAY_MAX_US 10000
+#define FAST_ITVL_US (CONFIG_BLE_ADV_FAST_INTERVAL_MS * 1000.0)
+#define FAST_US (CONFIG_BLE_ADV_FAST_DURATION_MS * 1000.0)
+#define SLOW_ITVL_US (CONFIG_BLE_ADV_INTERVAL_MS * 1000.0)
+
+/* Private types */
+typedef enum {
+    PEER_UNDIRECTED,  /* not bonded, or bonded on a private address */
+    PEER_IDENTITY,    /* bonded, connects from its identity address */
+    PEER_RPA_IGNORED, /* bonded on a private address, advertised to directly */
+    PEER_KINDS,
+} peer_t;
+
+typedef struct {
+    const char *name;
+    double interval_us;
+    double window_us;
+} scan_t;
+
+/* Private function declarations */
+static bool central_hears(const scan_t *scan, double phase, int chan0,
+                          int chan, double start, double len);
+static double reconnect_us(const scan_t *scan, peer_t peer);
+static int cmp_double(const void *a, const void *b);
+
+/* Private variables */
+static const scan_t scans[] = {
+    {"continuous", 30000, 30000},
+    {"half duty", 60000, 30000},
+    {"background", 1280000, 11250},
+};
+
+static const char *peer_names[PEER_KINDS] = {
+    "undirected",
+    "directed",
+    "directed, RPA",
+};
+
+/* Private functions */
+/* Scan windows start at -phase, the first one on channel 37 + chan0 */
+static bool central_hears(const scan_t *scan, double phase, int chan0,
+                          int chan, double start, double len) {
+    /* Local variables */
+    double t = start + phase;
+    long k = (long)(t / scan->interval_us);
+
+    return (chan0 + k) % 3 == chan &&
+           t - k * scan->interval_us + len <= scan->window_us;
+}
+
+/* Time to the end of the CONNECT_IND, or a negative value past the horizon */
+static double reconnect_us(const scan_t *scan, peer_t peer) {
+    /* Local variables */
+    double phase = (double)rand() / RAND_MAX * scan->interval_us;
+    int chan0 = rand() % 3;
+    bool directed = CONFIG_BLE_ADV_DIRECTED && peer != PEER_UNDIRECTED;
+    double fast_end = (directed ? DIRECTED_US : 0) + FAST_US;
+    double t = 0, pdu, step, itvl;
+    bool dir_now;
+
+    while (t < HORIZON_US) {
+        dir_now = directed && t < DIRECTED_US;
+        pdu = dir_now ? ADV_DIRECT_IND_US : ADV_IND_US;
+        /* Each PDU leaves room for a CONNECT_IND before the next channel */
+        step = pdu + T_IFS_US + CONNECT_IND_US;
+        for (int c = 0; c < 3; c++) {
+            if ((!dir_now || peer == PEER_IDENTITY) &&
+                central_hears(scan, phase, chan0, c, t + c * step, pdu)) {
+                return t + c * step + step;
+            }
+        }
+
+        if (dir_now) {
+            t += DIRECTED_ITVL_US;
+            t = t < DIRECTED_US ? t : DIRECTED_US;
+        } else {
+            itvl = t < fast_end ? FAST_ITVL_US : SLOW_ITVL_US;
+            t += itvl + (double)rand() / RAND_MAX * ADV_DELAY_MAX_US;
+        }
+    }
+    return -1;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    /* Local variables */
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Public functions */
+int main(int argc, char **argv) {
+    /* Local variables */
+    int trials = argc > 1 ? atoi(argv[1]) : DEFAULT_TRIALS;
+    double *times;
+    double mean[PEER_KINDS];
+    int lost[PEER_KINDS];
+    int failed = 0;
+
+    if (trials <= 0) {
+        fprintf(stderr, "usage: %s [trials]\n", argv[0]);
+        return 2;
+    }
+    times = malloc(trials * sizeof(*times));
+    if (times == NULL) {
+        return 1;
+    }
+    srand(1);
+
+    printf("%d trials, fast %d ms for %d ms, slow %d ms, directed %s\n",
+           trials, CONFIG_BLE_ADV_FAST_INTERVAL_MS,
+           CONFIG_BLE_ADV_FAST_DURATION_MS, CONFIG_BLE_ADV_INTERVAL_MS,
+           CONFIG_BLE_ADV_DIRECTED ? "on" : "off");
+    printf("%-11s %7s %6s %-14s %9s %9s %9s %6s\n", "scan", "itvl", "window",
+           "advertising", "mean ms", "p50 ms", "p99 ms", "lost");
+    for (size_t s = 0; s < sizeof(scans) / sizeof(scans[0]); s++) {
+        for (int p = 0; p < PEER_KINDS; p++) {
+            mean[p] = 0;
+            lost[p] = 0;
+            for (int i = 0; i < trials; i++) {
+                times[i] = reconnect_us(&scans[s], p);
+                if (times[i] < 0) {
+                    times[i] = HORIZON_US;
+                    lost[p]++;
+                }
+                mean[p] += times[i] / trials;
+            }
+            qsort(times, trials, sizeof(*times), cmp_double);
+            printf("%-11s %7.2f %6.2f %-14s %9.1f %9.1f %9.1f %6d\n",
+                   scans[s].name, scans[s].interval_us / 1000,
+                   scans[s].window_us / 1000, peer_names[p], mean[p] / 1000,
+                   times[trials / 2] / 1000,
+                   times[trials - trials / 100 - 1] / 1000, lost[p]);
+        }
+        if (mean[PEER_IDENTITY] > mean[PEER_UNDIRECTED] ||
+            lost[PEER_IDENTITY] != 0) {
+            fprintf(stderr, "%s: directed %.1f ms on average, %d lost, "
+                            "undirected %.1f ms\n",
+                    scans[s].name, mean[PEER_IDENTITY] / 1000,
+                    lost[PEER_IDENTITY], mean[PEER_UNDIRECTED] / 1000);
+            failed = 1;
+        }
+    }
+    free(times);
+    return failed;
+}
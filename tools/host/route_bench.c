@@ -0,0 +1,188 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/*
+ * Compares the compile-time MIDI route with the NVS route interpreter.
+ *
+ * The route from sdkconfig is run both ways: as the generated tables, and as
+ * the same settings stored in NVS. Every status byte with every data byte
+ * must come out identical, then both are timed over a stream of channel
+ * messages.
+ *
+ *   route_bench [events] [rounds]
+ */
+/* Includes */
+#include "esp_timer.h"
+#include "midi_route.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Defines */
+#define DEFAULT_EVENTS 4096
+#define DEFAULT_ROUNDS 2000
+
+/* Private function declarations */
+static void config_from_sdkconfig(midi_route_config_t *cfg);
+static void use_route(const midi_route_config_t *cfg);
+static int check_all(const midi_route_config_t *cfg);
+static double time_route(const midi_event_t *events, int count, int rounds);
+
+/* Private functions */
+/* The interpreter settings equal to the compile-time route */
+static void config_from_sdkconfig(midi_route_config_t *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->version = MIDI_ROUTE_CONFIG_VERSION;
+    cfg->velocity_gain = CONFIG_MIDI_ROUTE_VELOCITY_GAIN;
+    cfg->velocity_offset = CONFIG_MIDI_ROUTE_VELOCITY_OFFSET;
+#ifdef CONFIG_MIDI_ROUTE_PASS_NOTES
+    cfg->type_mask |= MIDI_ROUTE_NOTE;
+#endif
+#ifdef CONFIG_MIDI_ROUTE_PASS_POLY_PRESSURE
+    cfg->type_mask |= MIDI_ROUTE_POLY_PRESSURE;
+#endif
+#ifdef CONFIG_MIDI_ROUTE_PASS_CONTROL_CHANGE
+    cfg->type_mask |= MIDI_ROUTE_CONTROL_CHANGE;
+#endif
+#ifdef CONFIG_MIDI_ROUTE_PASS_PROGRAM_CHANGE
+    cfg->type_mask |= MIDI_ROUTE_PROGRAM_CHANGE;
+#endif
+#ifdef CONFIG_MIDI_ROUTE_PASS_CHANNEL_PRESSURE
+    cfg->type_mask |= MIDI_ROUTE_CHANNEL_PRESSURE;
+#endif
+#ifdef CONFIG_MIDI_ROUTE_PASS_PITCH_BEND
+    cfg->type_mask |= MIDI_ROUTE_PITCH_BEND;
+#endif
+#ifdef CONFIG_MIDI_ROUTE_PASS_SYSTEM_COMMON
+    cfg->type_mask |= MIDI_ROUTE_SYSTEM_COMMON;
+#endif
+#ifdef CONFIG_MIDI_ROUTE_PASS_REALTIME
+    cfg->type_mask |= MIDI_ROUTE_REALTIME;
+#endif
+#ifdef CONFIG_MIDI_ROUTE_PASS_SYSEX
+    cfg->type_mask |= MIDI_ROUTE_SYSEX;
+#endif
+    for (int ch = 0; ch < 16; ch++) {
+        cfg->channel_map[ch] = CONFIG_MIDI_ROUTE_OUT_CHANNEL
+                                   ? CONFIG_MIDI_ROUTE_OUT_CHANNEL - 1
+                                   : ch;
+        cfg->transpose[ch] = CONFIG_MIDI_ROUTE_TRANSPOSE;
+    }
+}
+
+/* Store cfg in NVS, or erase it for NULL, and load the route again */
+static void use_route(const midi_route_config_t *cfg) {
+    /* Local variables */
+    nvs_handle_t nvs;
+
+    nvs_open("midi", NVS_READWRITE, &nvs);
+    if (cfg != NULL) {
+        nvs_set_blob(nvs, "route", cfg, sizeof(*cfg));
+    } else {
+        nvs_erase_key(nvs, "route");
+    }
+    nvs_close(nvs);
+    midi_route_init();
+}
+
+/* Number of inputs where the two routes disagree */
+static int check_all(const midi_route_config_t *cfg) {
+    /* Local variables */
+    static midi_event_t fixed[128 * 128 * 128];
+    static bool fixed_pass[128 * 128 * 128];
+    midi_event_t interp;
+    bool interp_pass;
+    int mismatches = 0;
+    int i = 0;
+
+    use_route(NULL);
+    for (int status = 0x80; status < 0x100; status++) {
+        for (int d = 0; d < 128 * 128; d++, i++) {
+            fixed[i] = (midi_event_t){{status, d >> 7, d & 0x7F}, 3, 0};
+            fixed_pass[i] = midi_route_apply(&fixed[i]);
+        }
+    }
+
+    use_route(cfg);
+    i = 0;
+    for (int status = 0x80; status < 0x100; status++) {
+        for (int d = 0; d < 128 * 128; d++, i++) {
+            interp = (midi_event_t){{status, d >> 7, d & 0x7F}, 3, 0};
+            interp_pass = midi_route_apply(&interp);
+            if (interp_pass == fixed_pass[i] &&
+                (!interp_pass || memcmp(interp.data, fixed[i].data, 3) == 0)) {
+                continue;
+            }
+            if (mismatches++ < 8) {
+                printf("mismatch %02X %02X %02X\n", status, d >> 7, d & 0x7F);
+            }
+        }
+    }
+    return mismatches;
+}
+
+/* Nanoseconds per event of the route loaded last */
+static double time_route(const midi_event_t *events, int count, int rounds) {
+    /* Local variables */
+    midi_event_t ev;
+    volatile unsigned passed = 0;
+    int64_t start = esp_timer_get_time();
+
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < count; i++) {
+            ev = events[i];
+            passed += midi_route_apply(&ev);
+        }
+    }
+    return (esp_timer_get_time() - start) * 1000.0 / ((double)count * rounds);
+}
+
+/* Public functions */
+int main(int argc, char **argv) {
+    /* Local variables */
+    int count = argc > 1 ? atoi(argv[1]) : DEFAULT_EVENTS;
+    int rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+    midi_route_config_t cfg;
+    midi_event_t *events;
+    double fixed_ns, interp_ns;
+    int mismatches;
+
+    if (count <= 0 || rounds <= 0) {
+        fprintf(stderr, "usage: %s [events] [rounds]\n", argv[0]);
+        return 2;
+    }
+    config_from_sdkconfig(&cfg);
+
+    mismatches = check_all(&cfg);
+    printf("all inputs: %d mismatches\n", mismatches);
+
+    /* Notes, controllers and bends on all channels, as a keyboard sends */
+    events = malloc(sizeof(*events) * count);
+    if (events == NULL) {
+        return 1;
+    }
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        static const uint8_t types[] = {MIDI_NOTE_ON, MIDI_NOTE_OFF,
+                                        MIDI_NOTE_ON, MIDI_CONTROL_CHANGE,
+                                        MIDI_PITCH_BEND};
+        events[i] = (midi_event_t){
+            {types[rand() % sizeof(types)] | (rand() & 0x0F), rand() & 0x7F,
+             rand() & 0x7F},
+            3,
+            0};
+    }
+
+    use_route(NULL);
+    fixed_ns = time_route(events, count, rounds);
+    use_route(&cfg);
+    interp_ns = time_route(events, count, rounds);
+    printf("compile-time route %.2f ns/event, interpreter %.2f ns/event "
+           "(%.1fx)\n",
+           fixed_ns, interp_ns, interp_ns / fixed_ns);
+
+    free(events);
+    return mismatches != 0;
+}
@@ -0,0 +1,30 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef COMMON_H
+#define COMMON_H
+
+/*
+ * Host stand-in for main/include/common.h: the same standard headers and
+ * defines, with stub/host/ble_hs.h in place of NimBLE.
+ */
+
+/* Includes */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "host/ble_hs.h"
+
+/* Defines */
+#define TAG "NimBLE_GATT_Server"
+#define DEVICE_NAME "NimBLE_GATT"
+
+#endif // COMMON_H
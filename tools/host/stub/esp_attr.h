@@ -0,0 +1,11 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef ESP_ATTR_H
+#define ESP_ATTR_H
+
+/* Memory placement means nothing on the host */
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#endif // ESP_ATTR_H
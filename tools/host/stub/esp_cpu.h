@@ -0,0 +1,35 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef ESP_CPU_H
+#define ESP_CPU_H
+
+/*
+ * Host stand-in for the CPU cycle counter: the time stamp counter on x86,
+ * nanoseconds elsewhere. Only differences of it are meaningful. The core a
+ * thread runs on is whatever it set host_core_id to, 0 unless it did.
+ */
+
+/* Includes */
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include "esp_timer.h"
+#endif
+
+/* Public variables */
+extern __thread int host_core_id;
+
+/* Public functions */
+static inline int esp_cpu_get_core_id(void) { return host_core_id; }
+
+static inline uint32_t esp_cpu_get_cycle_count(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return (uint32_t)__rdtsc();
+#else
+    return (uint32_t)(esp_timer_get_time() * 1000);
+#endif
+}
+
+#endif // ESP_CPU_H
@@ -0,0 +1,23 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef ESP_ERR_H
+#define ESP_ERR_H
+
+/* Includes */
+#include <stdint.h>
+
+/* Defines */
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+
+/* Public types */
+typedef int esp_err_t;
+
+#endif // ESP_ERR_H
@@ -0,0 +1,140 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Defines */
+#define NVS_MAX_NAMESPACES 8
+#define NVS_MAX_ENTRIES 32
+#define NVS_NAME_LEN 16
+
+/* Private types */
+typedef struct {
+    nvs_handle_t ns;
+    char key[NVS_NAME_LEN];
+    void *value;
+    size_t length;
+} nvs_entry_t;
+
+/* Private function declarations */
+static nvs_entry_t *nvs_find(nvs_handle_t handle, const char *key);
+
+/* Public variables */
+__thread int host_core_id;
+
+/* Private variables */
+static char namespaces[NVS_MAX_NAMESPACES][NVS_NAME_LEN];
+static nvs_entry_t entries[NVS_MAX_ENTRIES];
+
+/* Private functions */
+static nvs_entry_t *nvs_find(nvs_handle_t handle, const char *key) {
+    for (int i = 0; i < NVS_MAX_ENTRIES; i++) {
+        if (entries[i].value != NULL && entries[i].ns == handle &&
+            strncmp(entries[i].key, key, NVS_NAME_LEN) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+/* Public functions */
+int64_t esp_timer_get_time(void) {
+    /* Local variables */
+    struct timespec ts;
+    static int64_t start;
+    int64_t now;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if (start == 0) {
+        start = now;
+    }
+    return now - start;
+}
+
+/* Handles are 1 + the namespace index, a namespace is made on first open */
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode,
+                   nvs_handle_t *handle) {
+    for (int i = 0; i < NVS_MAX_NAMESPACES; i++) {
+        if (namespaces[i][0] == '\0' && mode == NVS_READWRITE) {
+            strncpy(namespaces[i], name, NVS_NAME_LEN - 1);
+        }
+        if (strncmp(namespaces[i], name, NVS_NAME_LEN) == 0) {
+            *handle = i + 1;
+            return ESP_OK;
+        }
+        if (namespaces[i][0] == '\0') {
+            break;
+        }
+    }
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+void nvs_close(nvs_handle_t handle) {}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value,
+                       size_t *length) {
+    /* Local variables */
+    nvs_entry_t *entry = nvs_find(handle, key);
+
+    if (entry == NULL) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (value == NULL) {
+        *length = entry->length;
+        return ESP_OK;
+    }
+    if (*length < entry->length) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(value, entry->value, entry->length);
+    *length = entry->length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value,
+                       size_t length) {
+    /* Local variables */
+    nvs_entry_t *entry = nvs_find(handle, key);
+    void *copy = malloc(length ? length : 1);
+
+    if (copy == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; entry == NULL && i < NVS_MAX_ENTRIES; i++) {
+        if (entries[i].value == NULL) {
+            entry = &entries[i];
+            entry->ns = handle;
+            strncpy(entry->key, key, NVS_NAME_LEN - 1);
+        }
+    }
+    if (entry == NULL) {
+        free(copy);
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(copy, value, length);
+    free(entry->value);
+    entry->value = copy;
+    entry->length = length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+    /* Local variables */
+    nvs_entry_t *entry = nvs_find(handle, key);
+
+    if (entry == NULL) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    free(entry->value);
+    memset(entry, 0, sizeof(*entry));
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) { return ESP_OK; }
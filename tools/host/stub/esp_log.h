@@ -0,0 +1,29 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+/* Includes */
+#include <stdio.h>
+
+/* Defines */
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL 3
+#endif
+
+/* Log lines go to stderr so they never mix with program output */
+#define ESP_LOG_HOST(level, letter, tag, format, ...)                          \
+    do {                                                                       \
+        if (LOG_LOCAL_LEVEL >= (level)) {                                      \
+            fprintf(stderr, letter " (%s) " format "\n", tag, ##__VA_ARGS__);  \
+        }                                                                      \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_HOST(1, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_HOST(2, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_HOST(3, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_HOST(4, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_HOST(5, "V", tag, format, ##__VA_ARGS__)
+
+#endif // ESP_LOG_H
@@ -0,0 +1,14 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+/* Includes */
+#include <stdint.h>
+
+/* Public function declarations */
+/* Microseconds since the program started, from CLOCK_MONOTONIC */
+int64_t esp_timer_get_time(void);
+
+#endif // ESP_TIMER_H
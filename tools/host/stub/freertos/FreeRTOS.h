@@ -0,0 +1,46 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+/*
+ * Host stand-in for the parts of FreeRTOS the firmware modules use: ticks,
+ * task notifications and critical sections, implemented with POSIX threads
+ * in stub/freertos_host.c. Every thread is a task.
+ */
+
+/* Includes */
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+/* Defines */
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFF)
+#define configTICK_RATE_HZ CONFIG_FREERTOS_HZ
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)((ms) * configTICK_RATE_HZ / 1000))
+
+/* Critical sections become a mutex, nothing preempts a host thread */
+#define portMUX_INITIALIZER_UNLOCKED PTHREAD_MUTEX_INITIALIZER
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL(mux) pthread_mutex_unlock(mux)
+
+/* Two cores as on the esp32s3, a thread picks its own with host_core_id.
+ * Nothing interrupts a host thread, so masking interrupts does nothing. */
+#define portNUM_PROCESSORS 2
+#define portSET_INTERRUPT_MASK_FROM_ISR() 0
+#define portCLEAR_INTERRUPT_MASK_FROM_ISR(mask) ((void)(mask))
+
+/* Public types */
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef pthread_mutex_t portMUX_TYPE;
+
+#endif // FREERTOS_H
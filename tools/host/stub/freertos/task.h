@@ -0,0 +1,27 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef TASK_H
+#define TASK_H
+
+/* Includes */
+#include "freertos/FreeRTOS.h"
+
+/* Defines */
+#define tskIDLE_PRIORITY 0
+
+/* Public types */
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *param);
+
+/* Public function declarations */
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t timeout);
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t ticks);
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack,
+                       void *param, UBaseType_t priority,
+                       TaskHandle_t *handle);
+
+#endif // TASK_H
@@ -0,0 +1,139 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "freertos/task.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Private types */
+struct host_task {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;
+};
+
+typedef struct {
+    TaskFunction_t fn;
+    void *param;
+    struct host_task *task;
+} task_start_t;
+
+/* Private function declarations */
+static struct host_task *task_new(void);
+static void *task_run(void *arg);
+
+/* Private variables */
+static __thread struct host_task *current_task;
+
+/* Private functions */
+static struct host_task *task_new(void) {
+    /* Local variables */
+    struct host_task *task = calloc(1, sizeof(*task));
+
+    pthread_mutex_init(&task->lock, NULL);
+    pthread_cond_init(&task->cond, NULL);
+    return task;
+}
+
+static void *task_run(void *arg) {
+    /* Local variables */
+    task_start_t start = *(task_start_t *)arg;
+
+    free(arg);
+    current_task = start.task;
+    start.fn(start.param);
+    return NULL;
+}
+
+/* Public functions */
+/* The handle of a thread is made on first use and lives as long as the
+ * program, so a producer can never notify a freed task */
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    if (current_task == NULL) {
+        current_task = task_new();
+    }
+    return current_task;
+}
+
+/* A detached thread; priority and stack size are ignored */
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack,
+                       void *param, UBaseType_t priority,
+                       TaskHandle_t *handle) {
+    /* Local variables */
+    task_start_t *start = malloc(sizeof(*start));
+    pthread_t thread;
+
+    if (start == NULL) {
+        return pdFALSE;
+    }
+    *start = (task_start_t){.fn = fn, .param = param, .task = task_new()};
+    if (handle != NULL) {
+        *handle = start->task;
+    }
+    if (pthread_create(&thread, NULL, task_run, start) != 0) {
+        free(start);
+        return pdFALSE;
+    }
+    pthread_detach(thread);
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t timeout) {
+    /* Local variables */
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    struct timespec deadline;
+    uint64_t ns;
+    uint32_t value;
+    int rc = 0;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    ns = deadline.tv_nsec + (uint64_t)timeout * portTICK_PERIOD_MS * 1000000;
+    deadline.tv_sec += ns / 1000000000;
+    deadline.tv_nsec = ns % 1000000000;
+
+    pthread_mutex_lock(&task->lock);
+    while (task->notify == 0 && rc != ETIMEDOUT && timeout != 0) {
+        if (timeout == portMAX_DELAY) {
+            rc = pthread_cond_wait(&task->cond, &task->lock);
+        } else {
+            rc = pthread_cond_timedwait(&task->cond, &task->lock, &deadline);
+        }
+    }
+    value = task->notify;
+    if (value != 0) {
+        task->notify = clear_on_exit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    /* Local variables */
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)(ts.tv_sec * configTICK_RATE_HZ +
+                        ts.tv_nsec / (1000000000 / configTICK_RATE_HZ));
+}
+
+void vTaskDelay(TickType_t ticks) {
+    /* Local variables */
+    struct timespec ts = {
+        .tv_sec = ticks / configTICK_RATE_HZ,
+        .tv_nsec = (long)(ticks % configTICK_RATE_HZ) *
+                   (1000000000 / configTICK_RATE_HZ),
+    };
+
+    nanosleep(&ts, NULL);
+}
@@ -0,0 +1,45 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef BLE_HS_H
+#define BLE_HS_H
+
+/*
+ * Host stand-in for the few NimBLE calls the MIDI path makes, implemented
+ * in stub/nimble_host.c. Notifications are handed to host_notify_cb, set by
+ * the program, instead of a radio.
+ */
+
+/* Includes */
+#include <stdint.h>
+
+/* Defines */
+#define BLE_HS_EAGAIN 1
+#define BLE_HS_ENOMEM 6
+#define BLE_HS_ENOTCONN 7
+#define BLE_HS_EMSGSIZE 4
+#define BLE_HS_EDONE 14
+#define BLE_HS_CONN_HANDLE_NONE 0xFFFF
+
+/* Public types */
+struct os_mbuf {
+    uint8_t *om_data;
+    uint16_t om_len;
+};
+
+/* Returns 0 when the notification was taken, as ble_gatts_notify_custom */
+typedef int (*host_notify_cb_t)(uint16_t conn_handle, uint16_t attr_handle,
+                                const uint8_t *data, uint16_t len);
+
+/* Public variables */
+extern host_notify_cb_t host_notify_cb;
+extern uint16_t host_att_mtu;
+
+/* Public function declarations */
+struct os_mbuf *ble_hs_mbuf_from_flat(const void *buf, uint16_t len);
+void os_mbuf_free_chain(struct os_mbuf *om);
+int ble_gatts_notify_custom(uint16_t conn_handle, uint16_t attr_handle,
+                            struct os_mbuf *om);
+uint16_t ble_att_mtu(uint16_t conn_handle);
+
+#endif // BLE_HS_H
@@ -0,0 +1,43 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+/* Includes */
+#include "host/ble_hs.h"
+#include "sdkconfig.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Public variables */
+host_notify_cb_t host_notify_cb;
+uint16_t host_att_mtu = CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU;
+
+/* Public functions */
+struct os_mbuf *ble_hs_mbuf_from_flat(const void *buf, uint16_t len) {
+    /* Local variables */
+    struct os_mbuf *om = malloc(sizeof(*om) + len);
+
+    if (om == NULL) {
+        return NULL;
+    }
+    om->om_data = (uint8_t *)(om + 1);
+    om->om_len = len;
+    memcpy(om->om_data, buf, len);
+    return om;
+}
+
+void os_mbuf_free_chain(struct os_mbuf *om) { free(om); }
+
+/* Consumes om whatever the outcome, as the stack does */
+int ble_gatts_notify_custom(uint16_t conn_handle, uint16_t attr_handle,
+                            struct os_mbuf *om) {
+    /* Local variables */
+    int rc = 0;
+
+    if (host_notify_cb != NULL) {
+        rc = host_notify_cb(conn_handle, attr_handle, om->om_data, om->om_len);
+    }
+    os_mbuf_free_chain(om);
+    return rc;
+}
+
+uint16_t ble_att_mtu(uint16_t conn_handle) { return host_att_mtu; }
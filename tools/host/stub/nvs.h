@@ -0,0 +1,34 @@
+/*
+ * SPDX-License-Identifier: Unlicense OR CC0-1.0
+ */
+#ifndef NVS_H
+#define NVS_H
+
+/*
+ * In-memory NVS for host builds. Blobs live until the program exits, so a
+ * test stores a configuration with nvs_set_blob() before the module under
+ * test loads it.
+ */
+
+/* Includes */
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* Public types */
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+
+/* Public function declarations */
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode,
+                   nvs_handle_t *handle);
+void nvs_close(nvs_handle_t handle);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value,
+                       size_t *length);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value,
+                       size_t length);
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key);
+esp_err_t nvs_commit(nvs_handle_t handle);
+
+#endif // NVS_H
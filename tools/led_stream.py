@@ -0,0 +1,238 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Unlicense OR CC0-1.0
+"""Encode, decode and size LED animations for the LED stream characteristic.
+
+Each write without response carries one packet, see main/include/led_stream.h:
+
+    u8 flags | u8 frame | u16 first pixel | tokens
+
+A token byte c < 0x80 is followed by c + 1 literal pixels, c >= 0x80 by one
+pixel repeated (c & 0x7F) + 1 times. Keyframes carry colors, delta frames the
+XOR with the previous frame, so unchanged stretches collapse into runs of
+zeros. Each frame is sent as a keyframe when that is no larger than the delta,
+and at least every --key-interval frames.
+
+Run without a device, the built-in animations are encoded, decoded again and
+checked, and the bytes per frame and the bit rate are compared with raw RGB.
+"""
+
+import argparse
+import colorsys
+import math
+import random
+import struct
+import sys
+
+LED_STREAM_UUID = "00001528-1212-efde-1523-785feabcd123"
+LED_STREAM_KEY = 0x01
+LED_STREAM_END = 0x80
+HEADER = struct.Struct("<BBH")
+ATT_WRITE_OVERHEAD = 3  # opcode and handle of each write command
+
+
+def segments(data):
+    """Split pixels into ("run", pixel, n) and ("lit", pixels) stretches."""
+    out = []
+    i = 0
+    while i < len(data):
+        j = i + 1
+        while j < len(data) and data[j] == data[i]:
+            j += 1
+        if j - i >= 2:
+            out.append(("run", data[i], j - i))
+        elif out and out[-1][0] == "lit":
+            out[-1][1].append(data[i])
+        else:
+            out.append(("lit", [data[i]]))
+        i = j
+    return out
+
+
+def encode_frame(data, frame, key, max_payload):
+    """Packets for one frame, each at most max_payload bytes."""
+    packets = []
+    body = bytearray()
+    start = 0
+    pos = 0
+
+    def flush(last):
+        flags = (LED_STREAM_KEY if key else 0) | (LED_STREAM_END if last else 0)
+        packets.append(HEADER.pack(flags, frame & 0xFF, start) + body)
+
+    for seg in segments(data):
+        left = seg[2] if seg[0] == "run" else len(seg[1])
+        done = 0
+        while left:
+            space = max_payload - HEADER.size - len(body)
+            if space < 4:
+                flush(False)
+                body.clear()
+                start = pos
+                continue
+            if seg[0] == "run":
+                n = min(left, 128)
+                body.append(0x80 | (n - 1))
+                body.extend(seg[1])
+            else:
+                n = min(left, 128, (space - 1) // 3)
+                body.append(n - 1)
+                for px in seg[1][done : done + n]:
+                    body.extend(px)
+            done += n
+            left -= n
+            pos += n
+    flush(True)
+    return packets
+
+
+def encode_stream(frames, max_payload, key_interval):
+    """Packets for a sequence of frames, lists of (r, g, b) tuples."""
+    prev = None
+    for i, cur in enumerate(frames):
+        key_packets = encode_frame(cur, i, True, max_payload)
+        if prev is not None and i % key_interval:
+            delta = [
+                (a[0] ^ b[0], a[1] ^ b[1], a[2] ^ b[2]) for a, b in zip(cur, prev)
+            ]
+            delta_packets = encode_frame(delta, i, False, max_payload)
+            if sum(map(len, delta_packets)) < sum(map(len, key_packets)):
+                key_packets = delta_packets
+        prev = cur
+        yield key_packets
+
+
+class Decoder:
+    """Host model of led_stream.c, for checking the encoder."""
+
+    def __init__(self, num_pixels):
+        self.pixels = [(0, 0, 0)] * num_pixels
+        self.frame = 0
+        self.pos = 0
+        self.key = False
+        self.in_frame = False
+        self.synced = False
+
+    def reject(self):
+        if self.in_frame:
+            self.in_frame = False
+            self.synced = False
+        return -1
+
+    def input(self, packet):
+        if len(packet) < HEADER.size:
+            return self.reject()
+        flags, frame, first = HEADER.unpack_from(packet)
+        key = bool(flags & LED_STREAM_KEY)
+        if first == 0:
+            if self.in_frame:
+                self.in_frame = False
+                self.synced = False
+            if not key and (not self.synced or frame != (self.frame + 1) & 0xFF):
+                return self.reject()
+            self.in_frame, self.key, self.frame, self.pos = True, key, frame, 0
+        elif not self.in_frame or frame != self.frame or first != self.pos or key != self.key:
+            return self.reject()
+
+        i = HEADER.size
+        while i < len(packet):
+            c = packet[i]
+            n = (c & 0x7F) + 1
+            need = 3 if c & 0x80 else 3 * n
+            i += 1
+            if len(packet) - i < need or self.pos + n > len(self.pixels):
+                return self.reject()
+            for k in range(n):
+                o = i if c & 0x80 else i + 3 * k
+                px = tuple(packet[o : o + 3])
+                if not self.key:
+                    old = self.pixels[self.pos]
+                    px = (old[0] ^ px[0], old[1] ^ px[1], old[2] ^ px[2])
+                self.pixels[self.pos] = px
+                self.pos += 1
+            i += need
+
+        if not flags & LED_STREAM_END:
+            return 0
+        if self.pos != len(self.pixels):
+            return self.reject()
+        self.in_frame = False
+        self.synced = True
+        return 1
+
+
+def rgb(h, s, v):
+    return tuple(int(c * 255) for c in colorsys.hsv_to_rgb(h % 1.0, s, v))
+
+
+def animations(n, count, rng):
+    """Built-in animations, count frames of n pixels each."""
+    yield "static", [[rgb(i / n, 1, 0.5) for i in range(n)]] * count
+    yield "fade", [[rgb(t / count, 1, 0.5)] * n for t in range(count)]
+    yield "comet", [
+        [
+            rgb(0.6, 1, max(0.0, 1 - ((t * 3 - i) % n) / 12))
+            if (t * 3 - i) % n < 12
+            else (0, 0, 0)
+            for i in range(n)
+        ]
+        for t in range(count)
+    ]
+    frames = []
+    cur = [(0, 0, 0)] * n
+    for _ in range(count):
+        cur = list(cur)
+        for _ in range(max(1, n // 50)):
+            cur[rng.randrange(n)] = rgb(rng.random(), 1, rng.random())
+        frames.append(cur)
+    yield "sparkle", frames
+    yield "rainbow", [
+        [rgb(i / n + t / 90, 1, 0.5) for i in range(n)] for t in range(count)
+    ]
+    yield "pulse", [
+        [rgb(i / n, 1, 0.3 + 0.2 * math.sin(t / 5)) for i in range(n)]
+        for t in range(count)
+    ]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--pixels", type=int, default=300)
+    parser.add_argument("--fps", type=float, default=30)
+    parser.add_argument("--frames", type=int, default=300)
+    parser.add_argument("--mtu", type=int, default=247, help="ATT MTU")
+    parser.add_argument("--key-interval", type=int, default=30)
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    max_payload = args.mtu - ATT_WRITE_OVERHEAD
+    if max_payload < HEADER.size + 4 or args.pixels > 0xFFFF:
+        sys.exit("MTU too small or too many pixels")
+    raw_writes = -(-args.pixels * 3 // max_payload)
+    raw = args.pixels * 3 + raw_writes * ATT_WRITE_OVERHEAD
+
+    print(
+        f"{args.pixels} pixels, {args.fps:g} fps, MTU {args.mtu}: raw RGB is "
+        f"{raw} bytes/frame, {raw * 8 * args.fps / 1000:.0f} kbit/s"
+    )
+    print(f"{'animation':<10} {'bytes/frame':>12} {'writes':>7} {'kbit/s':>8} {'ratio':>6}")
+    rng = random.Random(args.seed)
+    for name, frames in animations(args.pixels, args.frames, rng):
+        dec = Decoder(args.pixels)
+        total = 0
+        writes = 0
+        for frame, packets in zip(frames, encode_stream(frames, max_payload, args.key_interval)):
+            for p in packets:
+                rc = dec.input(p)
+                total += len(p) + ATT_WRITE_OVERHEAD
+                writes += 1
+            if rc != 1 or dec.pixels != frame:
+                sys.exit(f"{name}: decoded frame differs")
+        per_frame = total / len(frames)
+        print(
+            f"{name:<10} {per_frame:>12.0f} {writes / len(frames):>7.1f} "
+            f"{per_frame * 8 * args.fps / 1000:>8.0f} {raw / per_frame:>6.1f}"
+        )
+
+
+if __name__ == "__main__":
+    main()
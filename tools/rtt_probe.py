@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Unlicense OR CC0-1.0
+"""Measure BLE round-trip latency against the device's probe characteristic.
+
+Every probe is written without response and answered by a notification that
+carries the device receive and transmit times followed by the probe itself:
+
+    u32 rx_us | u32 tx_us | u32 seq | u64 host send time (ns) | padding
+
+Reports round-trip time, device processing time and jitter distributions.
+Requires bleak (pip install bleak).
+"""
+
+import argparse
+import asyncio
+import csv
+import statistics
+import struct
+import sys
+import time
+
+from bleak import BleakClient, BleakScanner
+
+PROBE_UUID = "f0b21002-c280-110a-69c8-715c64d360bd"
+REPLY_HDR = struct.Struct("<II")
+PROBE_HDR = struct.Struct("<IQ")
+
+
+def percentile(values, p):
+    ordered = sorted(values)
+    k = (len(ordered) - 1) * p / 100
+    lo = int(k)
+    hi = min(lo + 1, len(ordered) - 1)
+    return ordered[lo] + (ordered[hi] - ordered[lo]) * (k - lo)
+
+
+def log2_histogram(values_us, label):
+    buckets = {}
+    for v in values_us:
+        b = max(0, int(v).bit_length() - 1)
+        buckets[b] = buckets.get(b, 0) + 1
+    peak = max(buckets.values())
+    print(f"\n{label} (us)")
+    for b in range(min(buckets), max(buckets) + 1):
+        n = buckets.get(b, 0)
+        bar = "#" * (n * 50 // peak)
+        print(f"  {1 << b:>8} .. {(2 << b) - 1:<8} {n:>6} {bar}")
+
+
+def summarize(label, values_us):
+    print(
+        f"{label:<12} n={len(values_us)} min={min(values_us):.0f} "
+        f"p50={percentile(values_us, 50):.0f} p90={percentile(values_us, 90):.0f} "
+        f"p99={percentile(values_us, 99):.0f} max={max(values_us):.0f} "
+        f"mean={statistics.fmean(values_us):.0f} "
+        f"stdev={statistics.pstdev(values_us):.0f}"
+    )
+
+
+async def run(args):
+    if args.address:
+        device = args.address
+    else:
+        device = await BleakScanner.find_device_by_name(args.name, timeout=10.0)
+        if device is None:
+            sys.exit(f"device '{args.name}' not found")
+
+    replies = {}
+    pending = {}
+
+    def on_notify(_, data):
+        now = time.perf_counter_ns()
+        if len(data) < REPLY_HDR.size + PROBE_HDR.size:
+            return
+        rx_us, tx_us = REPLY_HDR.unpack_from(data)
+        seq, _ = PROBE_HDR.unpack_from(data, REPLY_HDR.size)
+        if seq in pending:
+            replies[seq] = (now, rx_us, tx_us)
+            pending.pop(seq).set()
+
+    async with BleakClient(device) as client:
+        mtu = client.mtu_size
+        size = max(PROBE_HDR.size, min(args.size, mtu - 3 - REPLY_HDR.size))
+        print(f"connected, MTU {mtu}, probe size {size} bytes")
+        await client.start_notify(PROBE_UUID, on_notify)
+
+        rows = []
+        lost = 0
+        for seq in range(args.count):
+            sent = time.perf_counter_ns()
+            probe = PROBE_HDR.pack(seq, sent).ljust(size, b"\0")
+            pending[seq] = asyncio.Event()
+            await client.write_gatt_char(PROBE_UUID, probe, response=False)
+            try:
+                await asyncio.wait_for(pending[seq].wait(), args.timeout)
+            except asyncio.TimeoutError:
+                pending.pop(seq, None)
+                lost += 1
+                continue
+            recv, rx_us, tx_us = replies.pop(seq)
+            rtt_us = (recv - sent) / 1000
+            device_us = (tx_us - rx_us) & 0xFFFFFFFF
+            rows.append((seq, rtt_us, device_us, rx_us))
+            await asyncio.sleep(args.interval / 1000)
+
+        await client.stop_notify(PROBE_UUID)
+
+    if not rows:
+        sys.exit("no replies received")
+
+    rtts = [r[1] for r in rows]
+    device = [r[2] for r in rows]
+    jitter = [abs(b - a) for a, b in zip(rtts, rtts[1:])] or [0.0]
+
+    print(f"\n{len(rows)} replies, {lost} lost")
+    summarize("rtt", rtts)
+    summarize("device", device)
+    summarize("jitter", jitter)
+    log2_histogram(rtts, "round-trip time")
+    log2_histogram(jitter, "jitter between consecutive probes")
+
+    if args.csv:
+        with open(args.csv, "w", newline="") as f:
+            w = csv.writer(f)
+            w.writerow(["seq", "rtt_us", "device_us", "device_rx_us"])
+            w.writerows(rows)
+        print(f"\nraw samples written to {args.csv}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--name", default="ESP32 MIDI", help="advertised name")
+    parser.add_argument("--address", help="connect to this address instead")
+    parser.add_argument("--count", type=int, default=500, help="probes to send")
+    parser.add_argument("--size", type=int, default=12, help="probe size in bytes")
+    parser.add_argument(
+        "--interval", type=float, default=20, help="pause between probes (ms)"
+    )
+    parser.add_argument(
+        "--timeout", type=float, default=1.0, help="reply timeout (s)"
+    )
+    parser.add_argument("--csv", help="write raw samples to this file")
+    asyncio.run(run(parser.parse_args()))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: Unlicense OR CC0-1.0
+"""Convert the device event trace to Chrome Trace / Perfetto JSON.
+
+The trace is either dumped over BLE from the diagnostics service (--ble,
+requires bleak) or read from a raw dump saved earlier. Open the resulting
+JSON in chrome://tracing or https://ui.perfetto.dev.
+"""
+
+import argparse
+import asyncio
+import json
+import struct
+import sys
+
+TRACE_UUID = "f0b21003-c280-110a-69c8-715c64d360bd"
+TRACE_CMD_DUMP = 0x01
+TRACE_CMD_RESUME = 0x02
+
+# u32 start_us, u32 dur_us, u8 id, u8 core, u16 arg
+RECORD = struct.Struct("<IIBBH")
+
+# Must follow trace_id_t in main/include/trace.h
+NAMES = [
+    ("gap_event", "ble"),
+    ("gatt_midi_write", "ble"),
+    ("gatt_probe", "ble"),
+    ("midi_decode", "midi"),
+    ("midi_output", "midi"),
+    ("midi_rx_dropped", "midi"),
+    ("led_refresh", "led"),
+]
+
+# NimBLE BLE_GAP_EVENT_* values worth naming in the viewer
+GAP_EVENTS = {
+    0: "connect",
+    1: "disconnect",
+    3: "conn_update",
+    4: "conn_update_req",
+    9: "adv_complete",
+    13: "notify_tx",
+    14: "subscribe",
+    15: "mtu",
+}
+
+
+async def dump_ble(args):
+    from bleak import BleakClient, BleakScanner
+
+    if args.address:
+        device = args.address
+    else:
+        device = await BleakScanner.find_device_by_name(args.name, timeout=10.0)
+        if device is None:
+            sys.exit(f"device '{args.name}' not found")
+
+    data = bytearray()
+    async with BleakClient(device) as client:
+        await client.write_gatt_char(TRACE_UUID, bytes([TRACE_CMD_DUMP]), True)
+        while True:
+            chunk = await client.read_gatt_char(TRACE_UUID)
+            if not chunk:
+                break
+            data += chunk
+        if not args.keep:
+            await client.write_gatt_char(
+                TRACE_UUID, bytes([TRACE_CMD_RESUME]), True
+            )
+    return bytes(data)
+
+
+def convert(data):
+    events = []
+    base = None
+    last = None
+    wraps = 0
+    for off in range(0, len(data) - RECORD.size + 1, RECORD.size):
+        start, dur, ident, core, arg = RECORD.unpack_from(data, off)
+        # Start times are a 32-bit microsecond counter
+        if last is not None and start < last and last - start > 1 << 31:
+            wraps += 1
+        last = start
+        ts = start + (wraps << 32)
+        if base is None:
+            base = ts
+
+        name, cat = NAMES[ident] if ident < len(NAMES) else (f"id{ident}", "?")
+        args = {"arg": arg}
+        if ident == 0:
+            name = f"gap_{GAP_EVENTS.get(arg, arg)}"
+        ev = {
+            "name": name,
+            "cat": cat,
+            "pid": 0,
+            "tid": core,
+            "ts": ts - base,
+            "args": args,
+        }
+        if dur == 0 and name == "midi_rx_dropped":
+            ev.update(ph="i", s="t")
+        else:
+            ev.update(ph="X", dur=dur)
+        events.append(ev)
+
+    meta = [
+        {"name": "thread_name", "ph": "M", "pid": 0, "tid": c,
+         "args": {"name": f"core {c}"}}
+        for c in sorted({e["tid"] for e in events})
+    ]
+    return {"traceEvents": meta + events, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", nargs="?", help="raw trace dump to convert")
+    parser.add_argument("--ble", action="store_true", help="dump over BLE")
+    parser.add_argument("--name", default="ESP32 MIDI", help="advertised name")
+    parser.add_argument("--address", help="connect to this address instead")
+    parser.add_argument(
+        "--keep", action="store_true", help="leave tracing stopped after a dump"
+    )
+    parser.add_argument("--raw", help="also save the raw dump to this file")
+    parser.add_argument("-o", "--output", default="trace.json")
+    args = parser.parse_args()
+
+    if args.ble:
+        data = asyncio.run(dump_ble(args))
+    elif args.input:
+        with open(args.input, "rb") as f:
+            data = f.read()
+    else:
+        parser.error("give a raw dump or --ble")
+
+    if args.raw:
+        with open(args.raw, "wb") as f:
+            f.write(data)
+
+    trace = convert(data)
+    with open(args.output, "w") as f:
+        json.dump(trace, f)
+    print(f"{len(data) // RECORD.size} records written to {args.output}")
+
+
+if __name__ == "__main__":
+    main()